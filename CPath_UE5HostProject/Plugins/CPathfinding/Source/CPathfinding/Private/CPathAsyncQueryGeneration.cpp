@@ -0,0 +1,177 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathAsyncQueryGeneration.h"
+#include "CPathVolume.h"
+#include "Engine/World.h"
+#include "Async/Async.h"
+
+FCPathAsyncQueryGenerator::FCPathAsyncQueryGenerator(ACPathVolume* Volume)
+	:
+	VolumeRef(Volume),
+	AllocatorCache(&Volume->OctreeAllocator)
+{
+}
+
+FCPathAsyncQueryGenerator::~FCPathAsyncQueryGenerator()
+{
+	if (Processing.IsValid())
+		Processing.Wait();
+}
+
+void FCPathAsyncQueryGenerator::Start()
+{
+	Levels.clear();
+	CurrentDepth = 0;
+	Finished = false;
+	Processing = Async(EAsyncExecution::ThreadPool, [this]()
+	{
+		GatherOuterTrees();
+		Finished = Levels[0].empty();
+		if (Finished)
+			FinishTrees();
+	});
+}
+
+bool FCPathAsyncQueryGenerator::Update()
+{
+	if (Processing.IsValid())
+	{
+		if (!Processing.IsReady())
+			return false;
+		Processing.Reset();
+
+		// Keeps OctreeCountAtDepth and TotalNodeCount of the volume up to date while the graph is generated
+		FCPathMemoryStats Stats;
+		VolumeRef->UpdateMemoryStats(Stats);
+
+		if (Finished)
+			return true;
+		QueryDepth(CurrentDepth);
+		return false;
+	}
+
+	if (QueriesInFlight > 0)
+		return false;
+
+	uint32 Depth = CurrentDepth++;
+	Processing = Async(EAsyncExecution::ThreadPool, [this, Depth]()
+	{
+		ProcessDepth(Depth);
+		Finished = Levels[Depth + 1].empty();
+		if (Finished)
+			FinishTrees();
+	});
+	return false;
+}
+
+void FCPathAsyncQueryGenerator::OnOverlapCompleted(const FTraceHandle& Handle, FOverlapDatum& Datum)
+{
+	QueriesInFlight--;
+
+	// Touching components are returned too, the node is occupied either way
+	if (Datum.OutOverlaps.Num())
+	{
+		Levels[CurrentDepth][Datum.UserData].Overlapped = true;
+	}
+}
+
+void FCPathAsyncQueryGenerator::GatherOuterTrees()
+{
+	Levels.emplace_back();
+	for (uint32 OuterIndex = 0; OuterIndex < VolumeRef->OuterNodeCount; OuterIndex++)
+	{
+		if (!VolumeRef->IsOuterIndexInVolume(OuterIndex))
+			continue;
+
+		FQueryNode Node;
+		Node.Tree = VolumeRef->GetOrCreateOuterTree(OuterIndex);
+		Node.Location = VolumeRef->WorldLocationFromTreeID(OuterIndex);
+		Node.GenerationDepth = VolumeRef->GetOuterTreeGenerationDepth(OuterIndex);
+		Levels[0].push_back(Node);
+	}
+}
+
+void FCPathAsyncQueryGenerator::QueryDepth(uint32 Depth)
+{
+	FOverlapDelegate Delegate;
+	Delegate.BindUObject(VolumeRef, &ACPathVolume::OnAsyncOverlapCompleted);
+
+	const std::vector<FCollisionShape>& Shapes = VolumeRef->TraceShapesByDepth[Depth];
+	std::vector<FQueryNode>& Nodes = Levels[Depth];
+	for (uint32 NodeIndex = 0; NodeIndex < Nodes.size(); NodeIndex++)
+	{
+		for (const FCollisionShape& Shape : Shapes)
+		{
+			VolumeRef->GetWorld()->AsyncOverlapByChannel(Nodes[NodeIndex].Location, FQuat::Identity, VolumeRef->TraceChannel, Shape,
+				VolumeRef->StaticQueryParams, FCollisionResponseParams::DefaultResponseParam, &Delegate, NodeIndex);
+			QueriesInFlight++;
+		}
+	}
+}
+
+void FCPathAsyncQueryGenerator::ProcessDepth(uint32 Depth)
+{
+	Levels.resize(Depth + 2);
+	std::vector<FQueryNode>& Nodes = Levels[Depth];
+	std::vector<FQueryNode>& Children = Levels[Depth + 1];
+	OctreeCountAtDepth[Depth] += Nodes.size();
+
+	for (FQueryNode& Node : Nodes)
+	{
+		// RecheckOctreeAtDepth (and its overrides) decide as usual, but the scene overlap is already known
+		ACPathVolume::SetThreadPrefetchedOverlap(Node.Overlapped);
+		Node.HasFree = VolumeRef->RecheckOctreeAtDepth(Node.Tree, Node.Location, Depth);
+		if (Node.HasFree || Depth >= Node.GenerationDepth)
+			continue;
+
+		// Out of memory budget, this tree stays an occupied leaf instead of being subdivided
+		if (VolumeRef->IsOverMemoryBudget())
+		{
+			VolumeRef->MemoryBudgetReached.store(true, std::memory_order_relaxed);
+			continue;
+		}
+
+		// Only here Depth + 1 is known to be a valid depth, the last depth has no voxel size below it
+		FVector ChildHalfSize = VolumeRef->GetVoxelSizeByDepth(Depth + 1) / 2.f;
+		Node.Tree->Children = VolumeRef->OctreeAllocator.AllocateChildren(AllocatorCache, Depth + 1);
+		Node.FirstChild = Children.size();
+		for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+		{
+			FQueryNode Child;
+			Child.Tree = &Node.Tree->Children[ChildIndex];
+			Child.Location = Node.Location + VolumeRef->LookupTable_ChildPositionOffsetMaskByIndex[ChildIndex] * ChildHalfSize;
+			Child.GenerationDepth = Node.GenerationDepth;
+			Children.push_back(Child);
+		}
+	}
+	ACPathVolume::SetThreadPrefetchedOverlap(TOptional<bool>());
+}
+
+void FCPathAsyncQueryGenerator::FinishTrees()
+{
+	for (int32 Depth = (int32)Levels.size() - 2; Depth >= 0; Depth--)
+	{
+		for (FQueryNode& Node : Levels[Depth])
+		{
+			if (Node.FirstChild < 0)
+				continue;
+
+			for (uint32 ChildIndex = 0; ChildIndex < 8 && !Node.HasFree; ChildIndex++)
+			{
+				Node.HasFree = Levels[Depth + 1][Node.FirstChild + ChildIndex].HasFree;
+			}
+			if (!Node.HasFree)
+				VolumeRef->OctreeAllocator.FreeChildren(Node.Tree, AllocatorCache, Depth + 1);
+		}
+	}
+	Levels.clear();
+
+#ifdef LOG_GENERATORS
+	int NodeCount = 0;
+	for (int i = 0; i <= VolumeRef->OctreeDepth; i++)
+	{
+		NodeCount += OctreeCountAtDepth[i];
+	}
+	UE_LOG(LogTemp, Warning, TEXT("Async query generator generated %d nodes"), NodeCount);
+#endif
+}
@@ -3,22 +3,23 @@
 
 #include "CPathAsyncVolumeGeneration.h"
 #include "CPathVolume.h"
+#include "CPathGenerationPool.h"
 #include "Engine/World.h"
 #include <thread>
 
-FCPathAsyncVolumeGenerator::FCPathAsyncVolumeGenerator(ACPathVolume* Volume, uint32 StartIndex, uint32 EndIndex, uint8 ThreadID, FString ThreadName, bool Obstacles)
+FCPathAsyncVolumeGenerator::FCPathAsyncVolumeGenerator(ACPathVolume* Volume, uint8 ThreadID, FString ThreadName, bool Obstacles)
 	:
 	FCPathAsyncVolumeGenerator(Volume)
 {
 	bObstacles = Obstacles;
-	FirstIndex = StartIndex;
-	LastIndex = EndIndex;
 	GenThreadID = ThreadID;
 	Name = ThreadName;
 }
 
 // Sets default values
 FCPathAsyncVolumeGenerator::FCPathAsyncVolumeGenerator(ACPathVolume* Volume)
+	:
+	AllocatorCache(&Volume->OctreeAllocator)
 {
 	VolumeRef = Volume;
 
@@ -27,8 +28,8 @@ FCPathAsyncVolumeGenerator::FCPathAsyncVolumeGenerator(ACPathVolume* Volume)
 FCPathAsyncVolumeGenerator::~FCPathAsyncVolumeGenerator()
 {
 	bStop = true;
-	if (ThreadRef)
-		ThreadRef->Kill(true);
+	if (FCPathGenerationPool* Pool = FCPathGenerationPool::Get())
+		Pool->Retract(this);
 }
 
 bool FCPathAsyncVolumeGenerator::Init()
@@ -38,43 +39,58 @@ bool FCPathAsyncVolumeGenerator::Init()
 
 uint32 FCPathAsyncVolumeGenerator::Run()
 {
+	// Waiting for pathfinders to finish. Generators have priority over pathfinders, BatchGeneratorsLeft already blocks further ones from starting.
+	// The pool worker is given back meanwhile, so that generators of other volumes can use it, and the generator is queued again.
+	bYielded = VolumeRef->PathfindersRunning.load() > 0 && !bStop;
+	if (bYielded)
+		return 0;
+
 	bIncreasedGenRunning = true;
 	VolumeRef->GeneratorsRunning++;
 
-	// Waiting for pathfinders to finish.
-	// Generators have priority over pathfinders, so we block further pathfinders from starting by incrementing GeneratorsRunning first	
-	while (VolumeRef->PathfindersRunning.load() > 0 && !bStop)
-		std::this_thread::sleep_for(std::chrono::milliseconds(25));
-
 #ifdef LOG_GENERATORS
 	auto GenerationStart = TIMENOW;
 #endif
 
-	if (LastIndex > 0)
+	// Tasks split from heavy subtrees go first, so that a batch never waits for a single generator.
+	// Generators only leave once nobody can add any more work.
+	FCPathGenerationTask Task;
+	uint32 FirstIndex, LastIndex;
+	while (!bStop)
 	{
-		if (bObstacles)
+		if (VolumeRef->PopGenerationTask(Task))
 		{
-			auto StartIter = VolumeRef->TreesToRegenerate.begin();
-			for (uint32 i = 0; i < FirstIndex; i++)
-				StartIter++;
-
-			auto EndIter = StartIter;
-			for (uint32 i = FirstIndex; i < LastIndex; i++)
-				EndIter++;
-
-			for (auto Iter = StartIter; Iter != EndIter && !bStop; Iter++)
+			SetIdle(false);
+			GenerationDepth = Task.GenerationDepth;
+			RefreshSubtree(Task.Tree, Task.Depth, Task.Location, Task.BrickMask, std::move(Task.Join), std::move(Task.Candidates));
+			VolumeRef->GenerationWorkLeft--;
+		}
+		else if (VolumeRef->TakeGenerationChunk(FirstIndex, LastIndex))
+		{
+			SetIdle(false);
+			for (uint32 Index = FirstIndex; Index < LastIndex && !bStop; Index++)
 			{
-				RefreshTree(*Iter);
+				RefreshBatchItem(Index);
 			}
+			VolumeRef->GenerationWorkLeft--;
+		}
+		else if (VolumeRef->GenerationWorkLeft.load() > 0)
+		{
+			SetIdle(true);
+			std::this_thread::yield();
 		}
 		else
 		{
-			for (uint32 OuterIndex = FirstIndex; OuterIndex < LastIndex && !bStop; OuterIndex++)
-			{
-				RefreshTree(OuterIndex);
-			}
+			break;
 		}
 	}
+	SetIdle(false);
+
+	// The last generator of this batch does the post processing, while pathfinders are still blocked
+	if (--VolumeRef->BatchGeneratorsLeft == 0 && !bStop)
+	{
+		VolumeRef->OnGenerationBatchFinished();
+	}
 
 #ifdef LOG_GENERATORS
 	auto GenerationTime = TIMEDIFF(GenerationStart, TIMENOW);
@@ -111,15 +127,314 @@ void FCPathAsyncVolumeGenerator::Exit()
 
 void FCPathAsyncVolumeGenerator::RefreshTree(uint32 OuterIndex)
 {
-	CPathOctree* OctreeRef = &VolumeRef->Octrees[OuterIndex];
+	CPathOctree* OctreeRef = VolumeRef->GetOrCreateOuterTree(OuterIndex);
+	if (!OctreeRef)
+	{
+		return;
+	}
+	uint64* BrickMask = VolumeRef->OuterBrickMasks.size() ? &VolumeRef->OuterBrickMasks[OuterIndex] : nullptr;
+	// The density probe queries the same components candidate pruning needs
+	std::shared_ptr<const FCPathCandidateList> ProbedCandidates;
+	GenerationDepth = VolumeRef->GetOuterTreeGenerationDepth(OuterIndex, &ProbedCandidates);
+	FVector TreeLocation = VolumeRef->WorldLocationFromTreeID(OuterIndex);
+	TaskOuterIndex = OuterIndex;
+	RefreshSubtree(OctreeRef, 0, TreeLocation, BrickMask, nullptr, GatherTreeCandidates(TreeLocation, 0, std::move(ProbedCandidates)));
+}
+
+std::shared_ptr<const FCPathCandidateList> FCPathAsyncVolumeGenerator::GatherTreeCandidates(FVector TreeLocation, uint32 Depth, std::shared_ptr<const FCPathCandidateList> Gathered) const
+{
+	// A tree that is only checked at its own depth needs a single query anyway, and rasterized geometry needs none
+	if (!VolumeRef->UseCandidatePruning || VolumeRef->GeometryRasterizer || (GenerationDepth <= Depth && !VolumeRef->UseLeafBricks))
+		return nullptr;
+
+	return Gathered ? Gathered : VolumeRef->GatherCandidates(TreeLocation, VolumeRef->GetVoxelSizeByDepth(Depth) / 2.f);
+}
+
+void FCPathAsyncVolumeGenerator::RefreshBatchItem(uint32 Index)
+{
+	if (bObstacles)
+		RefreshDirtySubtree(VolumeRef->GenerationBatchItems[Index]);
+	else if (VolumeRef->UseSparseOuterGrid)
+		RefreshPage(Index);
+	else if (VolumeRef->UseProgressiveGeneration)
+		RefreshTree(VolumeRef->GenerationBatchItems[Index]);
+	else if (VolumeRef->IsOuterIndexInVolume(Index))
+		RefreshTree(Index);
+}
+
+void FCPathAsyncVolumeGenerator::RefreshDirtySubtree(CPathTreeID TreeID)
+{
+	uint32 OuterIndex = CPathTreeIDCodec::ExtractOuterIndex(TreeID);
+	uint32 Depth = CPathTreeIDCodec::ExtractDepth(TreeID);
+	bool Layered = VolumeRef->StaticLayer.IsBuilt();
+	if (Depth == 0)
+	{
+		if (Layered)
+			ComposeTree(OuterIndex);
+		else
+			RefreshTree(OuterIndex);
+		return;
+	}
+
+	// Shared blocks on the way were already copied by the volume
+	const CPathLinearOctree& StaticLayer = VolumeRef->StaticLayer;
+	CPathOctree* ParentRef = nullptr;
+	CPathOctree* OctreeRef = VolumeRef->GetOuterTree(OuterIndex);
+	uint32 StaticIndex = OuterIndex;
+	uint32 ChildIndex = 0;
+	for (uint32 CurrDepth = 1; CurrDepth <= Depth; CurrDepth++)
+	{
+		ChildIndex = CPathTreeIDCodec::ExtractChildIndex(TreeID, CurrDepth);
+		ParentRef = OctreeRef;
+		OctreeRef = &OctreeRef->Children[ChildIndex];
+
+		// Static occupied leafs are copied as they are, so a dirty subtree is never below one of them
+		if (Layered && StaticIndex != CPATH_INVALID_NODEINDEX)
+			StaticIndex = StaticLayer.HasChildren(OuterIndex, CurrDepth - 1, StaticIndex) ? StaticLayer.GetChild(OuterIndex, CurrDepth - 1, StaticIndex, ChildIndex) : CPATH_INVALID_NODEINDEX;
+	}
+
+	FVector TreeLocation = VolumeRef->WorldLocationFromTreeID(TreeID);
+	if (Layered)
+	{
+		GenerationDepth = VolumeRef->OuterMaxDepths.size() ? VolumeRef->OuterMaxDepths[OuterIndex] : VolumeRef->OctreeDepth;
+		ComposeTreeRec(OctreeRef, Depth, TreeLocation, OuterIndex, StaticIndex, VolumeRef->GatherDynamicCandidates(TreeLocation, VolumeRef->GetVoxelSizeByDepth(Depth) / 2.f));
+		return;
+	}
+
+	uint64* BrickMask = VolumeRef->UseLeafBricks ? CPathOctreeAllocator::GetBlockPayload<uint64>(ParentRef->Children) + ChildIndex : nullptr;
+	GenerationDepth = VolumeRef->GetOuterTreeGenerationDepth(OuterIndex);
+	RefreshSubtree(OctreeRef, Depth, TreeLocation, BrickMask, nullptr, GatherTreeCandidates(TreeLocation, Depth));
+}
+
+void FCPathAsyncVolumeGenerator::ComposeTree(uint32 OuterIndex)
+{
+	CPathOctree* OctreeRef = VolumeRef->GetOrCreateOuterTree(OuterIndex);
 	if (!OctreeRef)
 	{
 		return;
 	}
-	RefreshTreeRec(OctreeRef, 0, VolumeRef->WorldLocationFromTreeID(OuterIndex));
+
+	// The density probe would query the scene again, so dynamic obstacles are only limited by DepthRegions
+	GenerationDepth = VolumeRef->OuterMaxDepths.size() ? VolumeRef->OuterMaxDepths[OuterIndex] : VolumeRef->OctreeDepth;
+	FVector TreeLocation = VolumeRef->WorldLocationFromTreeID(OuterIndex);
+	ComposeTreeRec(OctreeRef, 0, TreeLocation, OuterIndex, OuterIndex, VolumeRef->GatherDynamicCandidates(TreeLocation, VolumeRef->GetVoxelSizeByDepth(0) / 2.f));
 }
 
-bool FCPathAsyncVolumeGenerator::RefreshTreeRec(CPathOctree* OctreeRef, uint32 Depth, FVector TreeLocation)
+bool FCPathAsyncVolumeGenerator::ComposeTreeRec(CPathOctree* OctreeRef, uint32 Depth, FVector TreeLocation, uint32 OuterIndex, uint32 StaticIndex, const FCPathObstacleShapeList& Obstacles)
+{
+	const CPathLinearOctree& StaticLayer = VolumeRef->StaticLayer;
+	bool HasStaticNode = StaticIndex != CPATH_INVALID_NODEINDEX;
+
+	// Static geometry fills the whole node, dynamic obstacles cant make it any worse
+	if (HasStaticNode && !StaticLayer.GetIsFree(OuterIndex, Depth, StaticIndex) && !StaticLayer.HasChildren(OuterIndex, Depth, StaticIndex))
+	{
+		return CopyStaticSubtree(OctreeRef, Depth, OuterIndex, StaticIndex);
+	}
+
+	bool DynamicOccupied = false;
+	if (Obstacles.size())
+	{
+		for (const FCollisionShape& Shape : VolumeRef->TraceShapesByDepth[Depth])
+		{
+			if (VolumeRef->OverlapsAnyObstacleShape(Obstacles, TreeLocation, Shape))
+			{
+				DynamicOccupied = true;
+				break;
+			}
+		}
+	}
+
+	OctreeCountAtDepth[Depth]++;
+
+	if (!DynamicOccupied)
+	{
+		return CopyStaticSubtree(OctreeRef, Depth, OuterIndex, StaticIndex);
+	}
+
+	OctreeRef->SetIsFree(false);
+	if (++Depth <= GenerationDepth)
+	{
+		FVector HalfSize = VolumeRef->GetVoxelSizeByDepth(Depth) / 2.f;
+
+		if (!OctreeRef->Children)
+		{
+			if (VolumeRef->IsOverMemoryBudget())
+			{
+				VolumeRef->MemoryBudgetReached.store(true, std::memory_order_relaxed);
+				return false;
+			}
+			OctreeRef->Children = VolumeRef->OctreeAllocator.AllocateChildren(AllocatorCache, Depth);
+		}
+		else if (VolumeRef->OctreeAllocator.IsFrozen(OctreeRef->Children))
+		{
+			OctreeRef->Children = VolumeRef->OctreeAllocator.AllocateCopy(OctreeRef->Children, AllocatorCache, Depth);
+		}
+
+		bool HasStaticChildren = HasStaticNode && StaticLayer.HasChildren(OuterIndex, Depth - 1, StaticIndex);
+		uint8 FreeChildren = 0;
+		for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+		{
+			FVector Location = TreeLocation + VolumeRef->LookupTable_ChildPositionOffsetMaskByIndex[ChildIndex] * HalfSize;
+			uint32 StaticChild = HasStaticChildren ? StaticLayer.GetChild(OuterIndex, Depth - 1, StaticIndex, ChildIndex) : CPATH_INVALID_NODEINDEX;
+			FreeChildren += ComposeTreeRec(&OctreeRef->Children[ChildIndex], Depth, Location, OuterIndex, StaticChild, Obstacles);
+		}
+
+		if (FreeChildren)
+		{
+			return true;
+		}
+	}
+	VolumeRef->OctreeAllocator.FreeChildren(OctreeRef, AllocatorCache, Depth);
+	return false;
+}
+
+bool FCPathAsyncVolumeGenerator::CopyStaticSubtree(CPathOctree* OctreeRef, uint32 Depth, uint32 OuterIndex, uint32 StaticIndex)
+{
+	const CPathLinearOctree& StaticLayer = VolumeRef->StaticLayer;
+	if (StaticIndex == CPATH_INVALID_NODEINDEX)
+	{
+		OctreeRef->SetIsFree(true);
+		VolumeRef->OctreeAllocator.FreeChildren(OctreeRef, AllocatorCache, Depth + 1);
+		return true;
+	}
+
+	OctreeRef->Data = StaticLayer.GetData(OuterIndex, Depth, StaticIndex);
+	if (!StaticLayer.HasChildren(OuterIndex, Depth, StaticIndex))
+	{
+		VolumeRef->OctreeAllocator.FreeChildren(OctreeRef, AllocatorCache, Depth + 1);
+		return OctreeRef->GetIsFree();
+	}
+
+	if (!OctreeRef->Children)
+	{
+		// Same as in generation, the tree stays an occupied leaf
+		if (VolumeRef->IsOverMemoryBudget())
+		{
+			VolumeRef->MemoryBudgetReached.store(true, std::memory_order_relaxed);
+			return false;
+		}
+		OctreeRef->Children = VolumeRef->OctreeAllocator.AllocateChildren(AllocatorCache, Depth + 1);
+	}
+	else if (VolumeRef->OctreeAllocator.IsFrozen(OctreeRef->Children))
+	{
+		OctreeRef->Children = VolumeRef->OctreeAllocator.AllocateCopy(OctreeRef->Children, AllocatorCache, Depth + 1);
+	}
+
+	uint8 FreeChildren = 0;
+	for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+	{
+		FreeChildren += CopyStaticSubtree(&OctreeRef->Children[ChildIndex], Depth + 1, OuterIndex, StaticLayer.GetChild(OuterIndex, Depth, StaticIndex, ChildIndex));
+	}
+	return FreeChildren > 0;
+}
+
+void FCPathAsyncVolumeGenerator::RefreshPage(uint32 PageIndex)
+{
+	FIntVector FirstCoords, CellCount;
+	VolumeRef->GetOuterPageCells(PageIndex, FirstCoords, CellCount);
+
+	FVector OuterSize = VolumeRef->GetVoxelSizeByDepth(0);
+	FVector PageExtent = FVector(CellCount.X, CellCount.Y, CellCount.Z) * OuterSize / 2.f;
+	FVector PageCenter = VolumeRef->StartPosition + FVector(FirstCoords.X, FirstCoords.Y, FirstCoords.Z) * OuterSize - OuterSize / 2.f + PageExtent;
+	if (VolumeRef->IsOuterPageEmpty(PageCenter, PageExtent))
+		return;
+
+	for (int X = FirstCoords.X; X < FirstCoords.X + CellCount.X; X++)
+	{
+		for (int Y = FirstCoords.Y; Y < FirstCoords.Y + CellCount.Y; Y++)
+		{
+			for (int Z = FirstCoords.Z; Z < FirstCoords.Z + CellCount.Z; Z++)
+			{
+				RefreshTree(VolumeRef->OuterIndexFromCoords(X, Y, Z));
+			}
+		}
+	}
+}
+
+void FCPathAsyncVolumeGenerator::SetIdle(bool Idle)
+{
+	if (Idle != bIdle)
+	{
+		bIdle = Idle;
+		VolumeRef->IdleGenerators += Idle ? 1 : -1;
+	}
+}
+
+void FCPathAsyncVolumeGenerator::RefreshSubtree(CPathOctree* OctreeRef, uint32 Depth, FVector TreeLocation, uint64* BrickMask, std::shared_ptr<FCPathSubtreeJoin> Parent,
+	std::shared_ptr<const FCPathCandidateList> Candidates)
+{
+	TaskParent = std::move(Parent);
+	TaskCandidates = std::move(Candidates);
+	bTaskSplit = false;
+	if (TaskParent)
+		TaskOuterIndex = TaskParent->OuterIndex;
+	ACPathVolume::SetThreadCandidates(TaskCandidates.get());
+	bool IsFree = RefreshTreeRec(OctreeRef, Depth, TreeLocation, BrickMask, true);
+	ACPathVolume::SetThreadCandidates(nullptr);
+	if (!bTaskSplit && TaskParent)
+	{
+		CompleteSubtree(TaskParent, IsFree);
+	}
+	else if (!bTaskSplit && !bObstacles)
+	{
+		VolumeRef->MarkOuterTreeGenerated(TaskOuterIndex);
+	}
+	TaskParent.reset();
+	TaskCandidates.reset();
+}
+
+bool FCPathAsyncVolumeGenerator::ShouldSplit(uint32 Depth) const
+{
+	return Depth + MinSplitLevels <= GenerationDepth && VolumeRef->IdleGenerators.load(std::memory_order_relaxed) > 0 && !VolumeRef->HasQueuedGenerationTasks();
+}
+
+void FCPathAsyncVolumeGenerator::SplitSubtree(CPathOctree* OctreeRef, uint32 Depth, FVector TreeLocation, uint64* ChildBrickMasks)
+{
+	std::shared_ptr<FCPathSubtreeJoin> Join = std::make_shared<FCPathSubtreeJoin>();
+	Join->Tree = OctreeRef;
+	Join->Depth = Depth;
+	Join->Parent = TaskParent;
+	Join->OuterIndex = TaskOuterIndex;
+
+	FVector HalfSize = VolumeRef->GetVoxelSizeByDepth(Depth) / 2.f;
+	FCPathGenerationTask Tasks[8];
+	for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+	{
+		FCPathGenerationTask& Task = Tasks[ChildIndex];
+		Task.Tree = &OctreeRef->Children[ChildIndex];
+		Task.Depth = Depth;
+		Task.Location = TreeLocation + VolumeRef->LookupTable_ChildPositionOffsetMaskByIndex[ChildIndex] * HalfSize;
+		Task.BrickMask = ChildBrickMasks ? ChildBrickMasks + ChildIndex : nullptr;
+		Task.GenerationDepth = GenerationDepth;
+		Task.Join = Join;
+		Task.Candidates = TaskCandidates;
+	}
+	VolumeRef->PushGenerationTasks(Tasks, 8);
+	bTaskSplit = true;
+}
+
+void FCPathAsyncVolumeGenerator::CompleteSubtree(std::shared_ptr<FCPathSubtreeJoin> Join, bool IsFree)
+{
+	while (Join)
+	{
+		if (IsFree)
+			Join->FreeChildren++;
+		if (--Join->ChildrenLeft > 0)
+			return;
+
+		// This was the last child, the rest is the same as in RefreshTreeRec
+		IsFree = Join->FreeChildren.load() > 0;
+		if (!IsFree)
+			VolumeRef->OctreeAllocator.FreeChildren(Join->Tree, AllocatorCache, Join->Depth);
+
+		// The root of the split finished, so the whole outer tree did
+		if (!Join->Parent && !bObstacles)
+			VolumeRef->MarkOuterTreeGenerated(Join->OuterIndex);
+		Join = Join->Parent;
+	}
+}
+
+bool FCPathAsyncVolumeGenerator::RefreshTreeRec(CPathOctree* OctreeRef, uint32 Depth, FVector TreeLocation, uint64* BrickMask, bool CanSplit)
 {
 
 	bool IsFree = VolumeRef->RecheckOctreeAtDepth(OctreeRef, TreeLocation, Depth);
@@ -128,22 +443,44 @@ bool FCPathAsyncVolumeGenerator::RefreshTreeRec(CPathOctree* OctreeRef, uint32 D
 
 	if (IsFree)
 	{
-		delete[] OctreeRef->Children;
-		OctreeRef->Children = nullptr;
+		VolumeRef->OctreeAllocator.FreeChildren(OctreeRef, AllocatorCache, Depth + 1);
+		if (BrickMask)
+			*BrickMask = 0;
 		return true;
 	}
-	else if (++Depth <= (uint32)VolumeRef->OctreeDepth)
+	else if (++Depth <= GenerationDepth)
 	{
-		float HalfSize = VolumeRef->GetVoxelSizeByDepth(Depth) / 2.f;
+		FVector HalfSize = VolumeRef->GetVoxelSizeByDepth(Depth) / 2.f;
 
 		if (!OctreeRef->Children)
-			OctreeRef->Children = new CPathOctree[8];
+		{
+			// Out of memory budget, this tree stays an occupied leaf instead of being subdivided
+			if (VolumeRef->IsOverMemoryBudget())
+			{
+				VolumeRef->MemoryBudgetReached.store(true, std::memory_order_relaxed);
+				return false;
+			}
+			OctreeRef->Children = VolumeRef->OctreeAllocator.AllocateChildren(AllocatorCache, Depth);
+		}
+		else if (VolumeRef->OctreeAllocator.IsFrozen(OctreeRef->Children))
+		{
+			// Children are shared with other trees after deduplication, so they are copied before being modified
+			OctreeRef->Children = VolumeRef->OctreeAllocator.AllocateCopy(OctreeRef->Children, AllocatorCache, Depth);
+		}
+		uint64* ChildBrickMasks = VolumeRef->UseLeafBricks ? CPathOctreeAllocator::GetBlockPayload<uint64>(OctreeRef->Children) : nullptr;
+
+		if (CanSplit && ShouldSplit(Depth))
+		{
+			SplitSubtree(OctreeRef, Depth, TreeLocation, ChildBrickMasks);
+			return false;
+		}
+
 		uint8 FreeChildren = 0;
 		// Checking children
 		for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
 		{
 			FVector Location = TreeLocation + VolumeRef->LookupTable_ChildPositionOffsetMaskByIndex[ChildIndex] * HalfSize;
-			FreeChildren += RefreshTreeRec(&OctreeRef->Children[ChildIndex], Depth, Location);
+			FreeChildren += RefreshTreeRec(&OctreeRef->Children[ChildIndex], Depth, Location, ChildBrickMasks ? ChildBrickMasks + ChildIndex : nullptr);
 		}
 
 		if (FreeChildren)
@@ -152,12 +489,23 @@ bool FCPathAsyncVolumeGenerator::RefreshTreeRec(CPathOctree* OctreeRef, uint32 D
 		}
 		else
 		{
-			delete[] OctreeRef->Children;
-			OctreeRef->Children = nullptr;
+			VolumeRef->OctreeAllocator.FreeChildren(OctreeRef, AllocatorCache, Depth);
 			return false;
 		}
 
 	}
+	else
+	{
+		// Generation depth of this tree can be lower than when it was generated last time
+		VolumeRef->OctreeAllocator.FreeChildren(OctreeRef, AllocatorCache, Depth);
+
+		if (BrickMask && Depth - 1 == (uint32)VolumeRef->OctreeDepth)
+		{
+			// Occupied leaf at OctreeDepth, a brick with any free sub-voxel keeps its parent from being merged into an occupied leaf
+			*BrickMask = VolumeRef->RecheckBrick(TreeLocation);
+			return *BrickMask != 0;
+		}
+	}
 	return false;
 }
 
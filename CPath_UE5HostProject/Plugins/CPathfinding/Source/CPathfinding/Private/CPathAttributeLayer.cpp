@@ -0,0 +1,92 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathAttributeLayer.h"
+#include "Misc/ScopeLock.h"
+
+CPathAttributeLayer::CPathAttributeLayer(FName InName, uint32 InElementSize)
+	:
+	Name(InName),
+	ElementSize(InElementSize)
+{
+	for (uint32 ChunkIndex = 0; ChunkIndex < ChunkCount; ChunkIndex++)
+	{
+		Chunks[ChunkIndex].store(nullptr);
+	}
+}
+
+CPathAttributeLayer::~CPathAttributeLayer()
+{
+	Reset();
+}
+
+uint8* CPathAttributeLayer::FindOrAdd(uint32 NodeIndex)
+{
+	checkf(NodeIndex != CPATH_INVALID_NODEINDEX, TEXT("CPATH - Attribute Layer:::Node has no index"));
+
+	uint32 PageIndex = NodeIndex / NodesPerPage;
+	std::atomic<std::atomic<uint8*>*>& ChunkRef = Chunks[PageIndex / PagesPerChunk];
+	std::atomic<uint8*>* Chunk = ChunkRef.load(std::memory_order_acquire);
+	uint8* Page = Chunk ? Chunk[PageIndex % PagesPerChunk].load(std::memory_order_acquire) : nullptr;
+	if (!Page)
+	{
+		// Multiple generators can need the same page at once
+		FScopeLock Lock(&PagesLock);
+		Chunk = ChunkRef.load(std::memory_order_acquire);
+		if (!Chunk)
+		{
+			Chunk = new std::atomic<uint8*>[PagesPerChunk];
+			for (uint32 Index = 0; Index < PagesPerChunk; Index++)
+			{
+				Chunk[Index].store(nullptr);
+			}
+			ChunkRef.store(Chunk, std::memory_order_release);
+			ChunksAllocated++;
+		}
+
+		std::atomic<uint8*>& PageRef = Chunk[PageIndex % PagesPerChunk];
+		Page = PageRef.load(std::memory_order_acquire);
+		if (!Page)
+		{
+			Page = (uint8*)FMemory::MallocZeroed((SIZE_T)NodesPerPage * ElementSize);
+			PageRef.store(Page, std::memory_order_release);
+			PagesAllocated++;
+		}
+	}
+	return Page + (SIZE_T)(NodeIndex % NodesPerPage) * ElementSize;
+}
+
+bool CPathAttributeLayer::IsEqual(uint32 NodeIndexA, uint32 NodeIndexB) const
+{
+	const uint8* ValueA = Find(NodeIndexA);
+	const uint8* ValueB = Find(NodeIndexB);
+	for (uint32 i = 0; i < ElementSize; i++)
+	{
+		if ((ValueA ? ValueA[i] : 0) != (ValueB ? ValueB[i] : 0))
+			return false;
+	}
+	return true;
+}
+
+void CPathAttributeLayer::Reset()
+{
+	FScopeLock Lock(&PagesLock);
+	for (uint32 ChunkIndex = 0; ChunkIndex < ChunkCount; ChunkIndex++)
+	{
+		std::atomic<uint8*>* Chunk = Chunks[ChunkIndex].exchange(nullptr);
+		if (!Chunk)
+			continue;
+
+		for (uint32 Index = 0; Index < PagesPerChunk; Index++)
+		{
+			FMemory::Free(Chunk[Index].load());
+		}
+		delete[] Chunk;
+	}
+	ChunksAllocated.store(0);
+	PagesAllocated.store(0);
+}
+
+uint64 CPathAttributeLayer::GetAllocatedSize() const
+{
+	return sizeof(Chunks) + (uint64)ChunksAllocated.load() * PagesPerChunk * sizeof(std::atomic<uint8*>) + (uint64)PagesAllocated.load() * NodesPerPage * ElementSize;
+}
@@ -0,0 +1,40 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathDirtyRegions.h"
+#include <algorithm>
+
+void CPathDirtyRegions::Reset(uint32 OuterNodeCount)
+{
+	DirtyOuterTrees.assign((OuterNodeCount + 63) / 64, 0);
+	Regions.clear();
+}
+
+void CPathDirtyRegions::Add(CPathTreeID TreeID)
+{
+	uint32 OuterIndex = CPathTreeIDCodec::ExtractOuterIndex(TreeID);
+	uint64 Bit = uint64(1) << (OuterIndex & 63);
+	uint64& Word = DirtyOuterTrees[OuterIndex >> 6];
+	if (Word & Bit)
+		return;
+
+	if (CPathTreeIDCodec::ExtractDepth(TreeID) == 0)
+		Word |= Bit;
+	Regions.push_back(TreeID);
+}
+
+void CPathDirtyRegions::Clear()
+{
+	// Only words with a dirty outer tree can be set, and all of their bits belong to regions that are removed as well
+	for (CPathTreeID TreeID : Regions)
+	{
+		DirtyOuterTrees[CPathTreeIDCodec::ExtractOuterIndex(TreeID) >> 6] = 0;
+	}
+	Regions.clear();
+}
+
+void CPathDirtyRegions::Compact()
+{
+	std::sort(Regions.begin(), Regions.end());
+	Regions.erase(std::unique(Regions.begin(), Regions.end()), Regions.end());
+}
+
@@ -2,6 +2,78 @@
 
 #include "CPathDynamicObstacle.h"
 #include "CPathVolume.h"
+#include "Components/PrimitiveComponent.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "PhysicsEngine/AggregateGeom.h"
+#include "Components/InstancedStaticMeshComponent.h"
+
+FBox FCPathObstacleShape::GetBounds() const
+{
+	if (Radius > 0.f)
+		return FBox::BuildAABB(Center, FVector(Radius));
+
+	// Extent of a rotated box on a world axis is the sum of its axes projected on it
+	FVector AxisX = Rotation.GetAxisX() * Extent.X;
+	FVector AxisY = Rotation.GetAxisY() * Extent.Y;
+	FVector AxisZ = Rotation.GetAxisZ() * Extent.Z;
+	return FBox::BuildAABB(Center, AxisX.GetAbs() + AxisY.GetAbs() + AxisZ.GetAbs());
+}
+
+// Separating axis test of an oriented box and an axis aligned box, 3 axes of each box and 9 cross products of their axes
+static bool OrientedBoxOverlapsBox(const FCPathObstacleShape& Shape, FVector Center, FVector Extent)
+{
+	FVector Axes[3] = { Shape.Rotation.GetAxisX(), Shape.Rotation.GetAxisY(), Shape.Rotation.GetAxisZ() };
+	FVector T = Shape.Center - Center;
+
+	// R[i][j] is the j axis of the oriented box on world axis i. Epsilon keeps cross products of near parallel axes from separating.
+	float R[3][3], AbsR[3][3];
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			R[i][j] = Axes[j][i];
+			AbsR[i][j] = FMath::Abs(R[i][j]) + KINDA_SMALL_NUMBER;
+		}
+	}
+
+	for (int i = 0; i < 3; i++)
+	{
+		float Radius = Shape.Extent[0] * AbsR[i][0] + Shape.Extent[1] * AbsR[i][1] + Shape.Extent[2] * AbsR[i][2];
+		if (FMath::Abs(T[i]) > Extent[i] + Radius)
+			return false;
+	}
+	for (int j = 0; j < 3; j++)
+	{
+		float Radius = Extent[0] * AbsR[0][j] + Extent[1] * AbsR[1][j] + Extent[2] * AbsR[2][j];
+		if (FMath::Abs(FVector::DotProduct(T, Axes[j])) > Shape.Extent[j] + Radius)
+			return false;
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		int i1 = (i + 1) % 3;
+		int i2 = (i + 2) % 3;
+		for (int j = 0; j < 3; j++)
+		{
+			int j1 = (j + 1) % 3;
+			int j2 = (j + 2) % 3;
+			float RadiusA = Extent[i1] * AbsR[i2][j] + Extent[i2] * AbsR[i1][j];
+			float RadiusB = Shape.Extent[j1] * AbsR[i][j2] + Shape.Extent[j2] * AbsR[i][j1];
+			if (FMath::Abs(T[i2] * R[i1][j] - T[i1] * R[i2][j]) > RadiusA + RadiusB)
+				return false;
+		}
+	}
+	return true;
+}
+
+bool FCPathObstacleShape::OverlapsBox(FVector BoxCenter, FVector BoxExtent) const
+{
+	if (Radius > 0.f)
+	{
+		FVector Outside = ((Center - BoxCenter).GetAbs() - BoxExtent).ComponentMax(FVector::ZeroVector);
+		return Outside.SizeSquared() <= Radius * Radius;
+	}
+	return OrientedBoxOverlapsBox(*this, BoxCenter, BoxExtent);
+}
 
 // Sets default values for this component's properties
 UCPathDynamicObstacle::UCPathDynamicObstacle()
@@ -36,7 +108,7 @@ void UCPathDynamicObstacle::Activate(bool bReset)
 
 	for (AActor* Volume : OverlappigVolumes)
 	{
-		Cast<ACPathVolume>(Volume)->TrackedDynamicObstacles.insert(this);
+		Cast<ACPathVolume>(Volume)->TrackDynamicObstacle(this);
 	}
 
 }
@@ -49,57 +121,79 @@ void UCPathDynamicObstacle::Deactivate()
 		auto CastedVolume = Cast<ACPathVolume>(Volume);
 		if (IsValid(CastedVolume))
 		{
-			CastedVolume->TrackedDynamicObstacles.erase(this);
+			CastedVolume->UntrackDynamicObstacle(this);
 		}
 	}
 	OverlappigVolumes.Empty();
 }
 
-void UCPathDynamicObstacle::AddIndexesToUpdate(ACPathVolume* Volume)
+FBox UCPathDynamicObstacle::GetObstacleBounds() const
 {
 	FVector Origin, Extent;
 	GetOwner()->GetActorBounds(true, Origin, Extent);
+	return FBox::BuildAABB(Origin, Extent);
+}
 
-	FVector XYZ = Volume->WorldLocationToLocalCoordsInt3(Origin);
-	if (!Volume->IsInBounds(XYZ))
+void UCPathDynamicObstacle::GetObstacleShapes(std::vector<FCPathObstacleShape>& Shapes) const
+{
+	TArray<UPrimitiveComponent*> Components;
+	GetOwner()->GetComponents<UPrimitiveComponent>(Components);
+	for (UPrimitiveComponent* Component : Components)
 	{
-		return;
+		if (Component->IsCollisionEnabled())
+			GetComponentShapes(Component, Shapes);
 	}
-	uint32 Index = Volume->LocalCoordsInt3ToIndex(XYZ);
-	FVector DistanceFromCenter = Origin - Volume->WorldLocationFromTreeID(Index);
+}
 
-	float VoxelSize = Volume->GetVoxelSizeByDepth(0);
-	float VoxelExtent = VoxelSize / 2.f;
+void UCPathDynamicObstacle::GetComponentShapes(UPrimitiveComponent* Component, std::vector<FCPathObstacleShape>& Shapes)
+{
+	auto AddBox = [&Shapes](const FTransform& Transform, FVector LocalCenter, FVector LocalExtent)
+	{
+		FCPathObstacleShape Shape;
+		Shape.Center = Transform.TransformPosition(LocalCenter);
+		Shape.Extent = LocalExtent * Transform.GetScale3D().GetAbs();
+		Shape.Rotation = Transform.GetRotation();
+		Shapes.push_back(Shape);
+	};
 
-	// How many outer trees should we include in given direction
-	int MaxOffsetInDirection[6];
-	MaxOffsetInDirection[Left] = FMath::CeilToInt((Extent.Y - (VoxelExtent + DistanceFromCenter.Y)) / VoxelSize);
-	MaxOffsetInDirection[Front] = FMath::CeilToInt((Extent.X - (VoxelExtent + DistanceFromCenter.X)) / VoxelSize);
-	MaxOffsetInDirection[Right] = FMath::CeilToInt((Extent.Y - (VoxelExtent - DistanceFromCenter.Y)) / VoxelSize);
-	MaxOffsetInDirection[Behind] = FMath::CeilToInt((Extent.X - (VoxelExtent - DistanceFromCenter.X)) / VoxelSize);
-	MaxOffsetInDirection[Below] = FMath::CeilToInt((Extent.Z - (VoxelExtent + DistanceFromCenter.Z)) / VoxelSize);
-	MaxOffsetInDirection[Above] = FMath::CeilToInt((Extent.Z - (VoxelExtent - DistanceFromCenter.Z)) / VoxelSize);
+	// Instances have their own bodies that the body setup doesnt describe
+	const FTransform& Transform = Component->GetComponentTransform();
+	UBodySetup* BodySetup = Component->GetBodySetup();
+	if (!BodySetup || BodySetup->GetCollisionTraceFlag() == CTF_UseComplexAsSimple || BodySetup->AggGeom.TaperedCapsuleElems.Num()
+		|| !BodySetup->AggGeom.GetElementCount() || Cast<UInstancedStaticMeshComponent>(Component))
+	{
+		FBox LocalBounds = Component->CalcBounds(FTransform::Identity).GetBox();
+		AddBox(Transform, LocalBounds.GetCenter(), LocalBounds.GetExtent());
+		return;
+	}
 
-	FVector Offset = FVector::ZeroVector;
-	for (int X = -MaxOffsetInDirection[Front]; X <= MaxOffsetInDirection[Behind]; X++)
+	// Non uniform scale is applied to radiuses as the biggest axis scale, same as in CPathGeometryRasterizer
+	const FKAggregateGeom& Geometry = BodySetup->AggGeom;
+	float RadiusScale = Transform.GetScale3D().GetAbsMax();
+	for (const FKBoxElem& Box : Geometry.BoxElems)
 	{
-		Offset.X = X;
-		for (int Y = -MaxOffsetInDirection[Left]; Y <= MaxOffsetInDirection[Right]; Y++)
-		{
-			Offset.Y = Y;
-			for (int Z = -MaxOffsetInDirection[Below]; Z <= MaxOffsetInDirection[Above]; Z++)
-			{
-				Offset.Z = Z;
-
-				FVector CurrXYZ = XYZ + Offset;
-				if (Volume->IsInBounds(CurrXYZ))
-				{
-					Index = Volume->LocalCoordsInt3ToIndex(CurrXYZ);
-					Volume->TreesToRegenerate.insert(Index);
-					Volume->TreesToRegeneratePreviousUpdate.insert(Index);
-				}
-			}
-		}
+		AddBox(Box.GetTransform() * Transform, FVector::ZeroVector, FVector(Box.X, Box.Y, Box.Z) / 2.f);
+	}
+	for (const FKSphereElem& Sphere : Geometry.SphereElems)
+	{
+		FCPathObstacleShape Shape;
+		Shape.Center = Transform.TransformPosition(Sphere.Center);
+		Shape.Radius = Sphere.Radius * RadiusScale;
+		Shapes.push_back(Shape);
+	}
+	for (const FKSphylElem& Capsule : Geometry.SphylElems)
+	{
+		FTransform CapsuleTransform = Capsule.GetTransform() * Transform;
+		FCPathObstacleShape Shape;
+		Shape.Center = CapsuleTransform.GetLocation();
+		Shape.Rotation = CapsuleTransform.GetRotation();
+		float Radius = Capsule.Radius * RadiusScale;
+		Shape.Extent = FVector(Radius, Radius, Capsule.Length / 2.f * FMath::Abs(CapsuleTransform.GetScale3D().Z) + Radius);
+		Shapes.push_back(Shape);
+	}
+	for (const FKConvexElem& Convex : Geometry.ConvexElems)
+	{
+		AddBox(Convex.GetTransform() * Transform, Convex.ElemBox.GetCenter(), Convex.ElemBox.GetExtent());
 	}
 }
 
@@ -113,7 +207,15 @@ void UCPathDynamicObstacle::BeginPlay()
 {
 	Super::BeginPlay();
 	GetOwner()->OnActorBeginOverlap.AddDynamic(this, &UCPathDynamicObstacle::OnBeginOverlap);
-	GetOwner()->OnActorEndOverlap.AddDynamic(this, &UCPathDynamicObstacle::OnBeginOverlap);
+	GetOwner()->OnActorEndOverlap.AddDynamic(this, &UCPathDynamicObstacle::OnEndOverlap);
+
+	// Components that move relative to the root dont move the root, so every one of them is watched
+	TArray<USceneComponent*> SceneComponents;
+	GetOwner()->GetComponents<USceneComponent>(SceneComponents);
+	for (USceneComponent* SceneComponent : SceneComponents)
+	{
+		SceneComponent->TransformUpdated.AddUObject(this, &UCPathDynamicObstacle::OnTransformUpdated);
+	}
 	if (ActivateOnBeginPlay)
 	{
 		Activate();
@@ -122,6 +224,11 @@ void UCPathDynamicObstacle::BeginPlay()
 
 
 
+void UCPathDynamicObstacle::OnTransformUpdated(USceneComponent* UpdatedComponent, EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport)
+{
+	TransformChangeCount++;
+}
+
 void UCPathDynamicObstacle::OnBeginOverlap(AActor* Owner, AActor* OtherActor)
 {
 	if (IsActive())
@@ -129,7 +236,7 @@ void UCPathDynamicObstacle::OnBeginOverlap(AActor* Owner, AActor* OtherActor)
 		ACPathVolume* Volume = Cast<ACPathVolume>(OtherActor);
 		if (Volume)
 		{
-			Volume->TrackedDynamicObstacles.insert(this);
+			Volume->TrackDynamicObstacle(this);
 			OverlappigVolumes.Add(Volume);
 		}
 	}
@@ -142,7 +249,7 @@ void UCPathDynamicObstacle::OnEndOverlap(AActor* Owner, AActor* OtherActor)
 		ACPathVolume* Volume = Cast<ACPathVolume>(OtherActor);
 		if (Volume)
 		{
-			Volume->TrackedDynamicObstacles.erase(this);
+			Volume->UntrackDynamicObstacle(this);
 			OverlappigVolumes.Remove(Volume);
 		}
 	}
@@ -13,6 +13,32 @@
 #include "Engine/World.h"
 
 
+// Publishes memory used by a running search to its volume, and takes it back when the search ends
+struct FCPathScratchMemoryReporter
+{
+	FCPathScratchMemoryReporter(ACPathVolume* InVolume)
+		:
+		Volume(InVolume)
+	{
+		Volume->SearchesInFlight++;
+	}
+
+	~FCPathScratchMemoryReporter()
+	{
+		Volume->PathfindingScratchBytes -= ReportedBytes;
+		Volume->SearchesInFlight--;
+	}
+
+	void Update(int64 Bytes)
+	{
+		Volume->PathfindingScratchBytes += Bytes - ReportedBytes;
+		ReportedBytes = Bytes;
+	}
+
+	ACPathVolume* Volume;
+	int64 ReportedBytes = 0;
+};
+
 CPathAStar::CPathAStar()
 {
 }
@@ -40,7 +66,8 @@ CPathAStarNode* CPathAStar::FindPath(ACPathVolume* VolumeRef, FVector Start, FVe
 		FailReason = VolumeNotValid;
 		return nullptr;
 	}
-	if (!VolumeRef->InitialGenerationCompleteAtom.load())
+	// With UseProgressiveGeneration, only start and end need to be generated
+	if (!VolumeRef->IsGeneratedAt(Start) || !VolumeRef->IsGeneratedAt(End))
 	{
 		FailReason = VolumeNotGenerated;
 		return nullptr;
@@ -63,16 +90,20 @@ CPathAStarNode* CPathAStar::FindPath(ACPathVolume* VolumeRef, FVector Start, FVe
 	// In case someome called FindPath on the same AStar instance
 	ProcessedNodes.clear();
 
+	FCPathScratchMemoryReporter ScratchMemory(Volume);
+
 
 	// Finding start and end node
-	uint32 TempID;
+	CPathTreeID TempID;
 	if (!Volume->FindClosestFreeLeaf(Start, TempID))
 	{
 		FailReason = WrongStartLocation;
 		return nullptr;
 	}
 
-	CPathAStarNode StartNode(TempID);
+	// With free space boxes, the search works with whole boxes instead of their trees
+	CPathAStarNode StartNode(Volume->GetSearchNodeID(TempID));
+	StartNode.NodeIndex = Volume->GetNodeIndex(TempID);
 	StartNode.WorldLocation = Start;
 
 	if (!Volume->FindClosestFreeLeaf(End, TempID))
@@ -82,8 +113,9 @@ CPathAStarNode* CPathAStar::FindPath(ACPathVolume* VolumeRef, FVector Start, FVe
 	}
 
 	// Initializing priority queue
-	CPathAStarNode TargetNode(TempID);
-	TargetLocation = Volume->WorldLocationFromTreeID(TargetNode.TreeID);
+	CPathAStarNode TargetNode(Volume->GetSearchNodeID(TempID));
+	TargetNode.NodeIndex = Volume->GetNodeIndex(TempID);
+	TargetLocation = Volume->GetSearchNodeLocation(TargetNode.TreeID, End);
 	TargetNode.WorldLocation = TargetLocation;
 	CalcFitness(TargetNode);
 	CalcFitness(StartNode);
@@ -104,6 +136,7 @@ CPathAStarNode* CPathAStar::FindPath(ACPathVolume* VolumeRef, FVector Start, FVe
 			break;
 		}
 
+		CPathAStarNode* CurrentNodePtr = ProcessedNodes.back().get();
 		std::vector<CPathAStarNode> Neighbours = VolumeRef->FindFreeNeighbourLeafs(CurrentNode);
 		for (CPathAStarNode NewTreeNode : Neighbours)
 		{
@@ -112,8 +145,21 @@ CPathAStarNode* CPathAStar::FindPath(ACPathVolume* VolumeRef, FVector Start, FVe
 
 			if (!VisitedNodes.count(NewTreeNode))
 			{
-				NewTreeNode.PreviousNode = ProcessedNodes.back().get();
-				NewTreeNode.WorldLocation = Volume->WorldLocationFromTreeID(NewTreeNode.TreeID);
+				NewTreeNode.PreviousNode = CurrentNodePtr;
+
+				// Boxes are left through the face shared with the neighbour, so the path doesnt cut past the neighbour's side
+				FVector ExitLocation = Volume->GetSearchNodeExit(CurrentNode.TreeID, CurrentNode.WorldLocation, NewTreeNode.TreeID);
+				if (ExitLocation != CurrentNode.WorldLocation)
+				{
+					ProcessedNodes.push_back(std::make_unique<CPathAStarNode>(CurrentNode));
+					ProcessedNodes.back()->WorldLocation = ExitLocation;
+					ProcessedNodes.back()->PreviousNode = CurrentNodePtr;
+					VolumeRef->CalcFitness(*ProcessedNodes.back(), TargetLocation, UserData);
+					NewTreeNode.PreviousNode = ProcessedNodes.back().get();
+				}
+
+				// Boxes are entered at the point closest to the previous node, which lies on their shared face
+				NewTreeNode.WorldLocation = Volume->GetSearchNodeLocation(NewTreeNode.TreeID, ExitLocation);
 
 				// CalcFitness(NewNode); - this is inline and not virtual so in theory faster, but not extendable.
 				// Also from my testing, the speed difference between the two was unnoticeable at 150000 nodes processed.
@@ -124,6 +170,14 @@ CPathAStarNode* CPathAStar::FindPath(ACPathVolume* VolumeRef, FVector Start, FVe
 			}
 		}
 
+		// Rough size of the containers, node overhead of unordered_set and unique_ptr included
+		if ((ProcessedNodes.size() & 255) == 0)
+		{
+			ScratchMemory.Update(Pq.size() * sizeof(CPathAStarNode)
+				+ VisitedNodes.size() * (sizeof(CPathAStarNode) + 2 * sizeof(void*)) + VisitedNodes.bucket_count() * sizeof(void*)
+				+ ProcessedNodes.size() * (sizeof(CPathAStarNode) + sizeof(void*)));
+		}
+
 		auto CurrDuration = TIMEDIFF(TimeStart, TIMENOW);
 		if (CurrDuration >= TimeLimitMS)
 		{
@@ -145,7 +199,7 @@ CPathAStarNode* CPathAStar::FindPath(ACPathVolume* VolumeRef, FVector Start, FVe
 	if (FoundPathEnd)
 	{
 		// Adding last node that exactly reflects user's requested location
-		uint32 LastTreeID;
+		CPathTreeID LastTreeID;
 		if (Volume->FindLeafByWorldLocation(End, LastTreeID, false))
 		{
 			ProcessedNodes.push_back(std::make_unique<CPathAStarNode>(CPathAStarNode(LastTreeID)));
@@ -197,11 +251,16 @@ bool CPathAStar::FindPath()
 	RawPathNodes.Empty();
 	UserPath.Empty();
 
+	// Where agents are about to go, so dynamic obstacle updates regenerate it first
+	Volume->NotePathUsage(PathStart);
+	Volume->NotePathUsage(PathEnd);
+
 	auto FoundPathEnd = FindPath(Volume, PathStart, PathEnd, Smoothing, UsrData, SearchTimeLimit, &RawPathNodes);
 
 	if (FoundPathEnd)
 	{
 		TransformToUserPath(FoundPathEnd, UserPath);
+		Volume->NotePathUsage(UserPath);
 		return true;
 	}
 	return false;
@@ -374,25 +433,72 @@ bool FCPathRunnableFindPath::Init()
 
 uint32 FCPathRunnableFindPath::Run()
 {
-	// Waiting for the volume to finish generating
-	while ((AsyncActionRef->AStar->Volume->GeneratorsRunning.load() > 0 || !AsyncActionRef->AStar->Volume->InitialGenerationCompleteAtom.load()) && !AsyncActionRef->AStar->bStop)
+	CPathAStar* AStar = AsyncActionRef->AStar;
+	ACPathVolume* Volume = AStar->Volume;
+	bool FoundPath = false;
+	while (true)
 	{
-		std::this_thread::sleep_for(std::chrono::milliseconds(25));
-		SleepCounter += 25;
+		// Waiting for the volume to finish generating, or with UseProgressiveGeneration only for the outer trees of start and end.
+		// Initial generators never touch outer trees they finished, so only later batches have to be waited for.
+		while (((Volume->IsGenerationBatchActive() && Volume->InitialGenerationCompleteAtom.load()) || !Volume->IsGeneratedAt(AStar->PathStart) || !Volume->IsGeneratedAt(AStar->PathEnd))
+			&& !AStar->bStop)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(25));
+			SleepCounter += 25;
+
+			// Cancel request for path if idled for 5 seconds or more
+			if (SleepCounter >= 5000)
+			{
+				AStar->FailReason = VolumeNotGenerated;
+				AsyncActionRef->ThreadResponse.store(0);
+				return 0;
+			}
+		}
+
+		// Preventing further generation while we search for a path
+		bIncreasedPathfRunning = true;
+		Volume->PathfindersRunning++;
+
+		// A batch can be queued between the check above and the increment. Its generators may have already seen no pathfinders, so this one waits instead.
+		if (Volume->IsGenerationBatchActive() && Volume->InitialGenerationCompleteAtom.load())
+		{
+			Volume->PathfindersRunning--;
+			bIncreasedPathfRunning = false;
+			continue;
+		}
+
+		ACPathVolume::ConsumeThreadReachedUngenerated();
+		FoundPath = AStar->FindPath();
+
+		// The path may go through outer trees that werent generated yet, so the search is repeated once more of the volume is.
+		// With UseLazyGeneration, coarse trees the search reached are occupied until the next update subdivides them,
+		// so the search is repeated after that even if it found a path, which could be a detour around them.
+		std::vector<uint32> ReachedCoarseTrees;
+		bool ReachedUngenerated = ACPathVolume::ConsumeThreadReachedUngenerated(&ReachedCoarseTrees);
+		bool Retry = ReachedUngenerated && !AStar->bStop && (ReachedCoarseTrees.size() || (!FoundPath && !Volume->InitialGenerationCompleteAtom.load()));
 
-		// Cancel request for path if idled for 5 seconds or more
+		if (bIncreasedPathfRunning)
+			Volume->PathfindersRunning--;
+		bIncreasedPathfRunning = false;
+
+		if (!Retry)
+			break;
+
+		do
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(25));
+			SleepCounter += 25;
+		} while (Volume->IsAnyOuterTreeAwaitingRefinement(ReachedCoarseTrees) && SleepCounter < 5000 && !AStar->bStop);
+
+		// Giving up on refinement, the path that was found is still valid
 		if (SleepCounter >= 5000)
 		{
-			AsyncActionRef->AStar->FailReason = VolumeNotGenerated;
-			AsyncActionRef->ThreadResponse.store(0);
+			if (!FoundPath)
+				AStar->FailReason = VolumeNotGenerated;
+			break;
 		}
 	}
 
-	// Preventing further generation while we search for a path
-	bIncreasedPathfRunning = true;
-	AsyncActionRef->AStar->Volume->PathfindersRunning++;
-
-	auto FoundPath = AsyncActionRef->AStar->FindPath();
 	if (FoundPath)
 	{
 		AsyncActionRef->ThreadResponse.store(1);
@@ -401,10 +507,6 @@ uint32 FCPathRunnableFindPath::Run()
 	{
 		AsyncActionRef->ThreadResponse.store(0);
 	}
-
-	if (bIncreasedPathfRunning)
-		AsyncActionRef->AStar->Volume->PathfindersRunning--;
-	bIncreasedPathfRunning = false;
 	return 0;
 }
 
@@ -0,0 +1,180 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathGenerationPool.h"
+#include "CPathfinding.h"
+#include "CPathAsyncVolumeGeneration.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "HAL/Event.h"
+#include "Misc/ScopeLock.h"
+#include "UObject/GarbageCollection.h"
+#include <algorithm>
+#include <thread>
+
+// A single thread of FCPathGenerationPool, runs generators one after another
+class FCPathGenerationWorker : public FRunnable
+{
+public:
+	FCPathGenerationWorker(FCPathGenerationPool* InPool, uint32 Index)
+		:
+		Pool(InPool),
+		WakeEvent(FPlatformProcess::GetSynchEventFromPool(false))
+	{
+		FString ThreadName = "CPathGenerator Worker, ID: ";
+		ThreadName.AppendInt(Index);
+		ThreadRef = FRunnableThread::Create(this, *ThreadName);
+	}
+
+	~FCPathGenerationWorker()
+	{
+		if (ThreadRef)
+		{
+			ThreadRef->WaitForCompletion();
+			delete ThreadRef;
+		}
+		FPlatformProcess::ReturnSynchEventToPool(WakeEvent);
+	}
+
+	virtual uint32 Run() override
+	{
+		while (FCPathAsyncVolumeGenerator* Generator = Pool->WaitForGenerator(this))
+		{
+			// Candidate components are resolved on this thread, GC has to wait until the generator stops touching them
+			{
+				FGCScopeGuard GCGuard;
+				Generator->Init();
+				Generator->Run();
+				Generator->Exit();
+			}
+			if (!Generator->bYielded)
+				Generator->PoolState.store(FCPathAsyncVolumeGenerator::PoolFinished);
+			else if (!Pool->Requeue(Generator))
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return 0;
+	}
+
+	FCPathGenerationPool* Pool;
+
+	FEvent* WakeEvent;
+
+	FRunnableThread* ThreadRef = nullptr;
+};
+
+FCPathGenerationPool::FCPathGenerationPool()
+{
+}
+
+FCPathGenerationPool::~FCPathGenerationPool()
+{
+	{
+		FScopeLock Lock(&QueueLock);
+		bStopping = true;
+		for (FCPathAsyncVolumeGenerator* Generator : Queue)
+		{
+			Generator->PoolState.store(FCPathAsyncVolumeGenerator::PoolNotQueued);
+		}
+		Queue.clear();
+		for (FCPathGenerationWorker* Worker : Workers)
+		{
+			Worker->WakeEvent->Trigger();
+		}
+	}
+
+	for (FCPathGenerationWorker* Worker : Workers)
+	{
+		delete Worker;
+	}
+	Workers.clear();
+}
+
+FCPathGenerationPool* FCPathGenerationPool::Get()
+{
+	return FCPathfindingModule::GetGenerationPool();
+}
+
+void FCPathGenerationPool::Enqueue(FCPathAsyncVolumeGenerator* Generator)
+{
+	FScopeLock Lock(&QueueLock);
+	if (bStopping)
+		return;
+
+	if (Workers.empty())
+		StartWorkers();
+
+	Generator->PoolState.store(FCPathAsyncVolumeGenerator::PoolQueued);
+	Queue.push_back(Generator);
+	if (IdleWorkers.size())
+	{
+		IdleWorkers.back()->WakeEvent->Trigger();
+		IdleWorkers.pop_back();
+	}
+}
+
+void FCPathGenerationPool::Retract(FCPathAsyncVolumeGenerator* Generator)
+{
+	// A running generator can yield and be queued again, so the queue is checked until it isnt running
+	while (true)
+	{
+		{
+			FScopeLock Lock(&QueueLock);
+			uint8 State = Generator->PoolState.load();
+			if (State == FCPathAsyncVolumeGenerator::PoolQueued)
+			{
+				Queue.erase(std::find(Queue.begin(), Queue.end(), Generator));
+				Generator->PoolState.store(FCPathAsyncVolumeGenerator::PoolNotQueued);
+				return;
+			}
+			if (State != FCPathAsyncVolumeGenerator::PoolRunning)
+				return;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+bool FCPathGenerationPool::Requeue(FCPathAsyncVolumeGenerator* Generator)
+{
+	FScopeLock Lock(&QueueLock);
+	if (bStopping || Generator->bStop)
+	{
+		Generator->PoolState.store(FCPathAsyncVolumeGenerator::PoolFinished);
+		return true;
+	}
+
+	bool OthersQueued = Queue.size() > 0;
+	Generator->PoolState.store(FCPathAsyncVolumeGenerator::PoolQueued);
+	Queue.push_back(Generator);
+	return OthersQueued;
+}
+
+FCPathAsyncVolumeGenerator* FCPathGenerationPool::WaitForGenerator(FCPathGenerationWorker* Worker)
+{
+	while (true)
+	{
+		{
+			FScopeLock Lock(&QueueLock);
+			if (bStopping)
+				return nullptr;
+
+			if (Queue.size())
+			{
+				FCPathAsyncVolumeGenerator* Generator = Queue.front();
+				Queue.pop_front();
+				Generator->PoolState.store(FCPathAsyncVolumeGenerator::PoolRunning);
+				return Generator;
+			}
+			IdleWorkers.push_back(Worker);
+		}
+		Worker->WakeEvent->Wait();
+	}
+}
+
+void FCPathGenerationPool::StartWorkers()
+{
+	// Same as the default of ACPathVolume::MaxGenerationThreads, so the rest of the game keeps a core
+	uint32 WorkerCount = FMath::Clamp(FPlatformMisc::NumberOfCores() - 1, 1, 31);
+	for (uint32 Index = 0; Index < WorkerCount; Index++)
+	{
+		Workers.push_back(new FCPathGenerationWorker(this, Index));
+	}
+}
@@ -0,0 +1,534 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathGeometryRasterizer.h"
+#include "CPathDynamicObstacle.h"
+#include "Components/PrimitiveComponent.h"
+#include "Components/StaticMeshComponent.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Engine/StaticMesh.h"
+#include "StaticMeshResources.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "PhysicsEngine/AggregateGeom.h"
+#include "Async/ParallelFor.h"
+#include "Math/VectorRegister.h"
+
+// Corners of a box as signs of its extent, and its 12 triangles
+static const FVector LookupTable_BoxCorners[8] = {
+	{-1, -1, -1},
+	{1, -1, -1},
+	{1, 1, -1},
+	{-1, 1, -1},
+	{-1, -1, 1},
+	{1, -1, 1},
+	{1, 1, 1},
+	{-1, 1, 1}
+};
+
+static const uint8 LookupTable_BoxTriangles[12][3] = {
+	{0, 1, 2}, {0, 2, 3},
+	{4, 6, 5}, {4, 7, 6},
+	{0, 5, 1}, {0, 4, 5},
+	{3, 2, 6}, {3, 6, 7},
+	{0, 3, 7}, {0, 7, 4},
+	{1, 5, 6}, {1, 6, 2}
+};
+
+// One triangle per face of the box above, enough for its planes
+static const int32 LookupTable_BoxHullIndices[6][3] = {
+	{0, 1, 2},
+	{4, 6, 5},
+	{0, 5, 1},
+	{3, 2, 6},
+	{0, 3, 7},
+	{1, 5, 6}
+};
+
+CPathGeometryRasterizer::CPathGeometryRasterizer()
+{
+}
+
+void CPathGeometryRasterizer::Build(const TArray<UPrimitiveComponent*>& Components, FVector InOrigin, FVector InCellSize, FIntVector InCellCount, FVector InMargin)
+{
+	Origin = InOrigin;
+	CellSize = InCellSize;
+	CellCount = InCellCount;
+	Margin = InMargin;
+	CellIndexByKey.Empty();
+	Cells.clear();
+
+	for (UPrimitiveComponent* Component : Components)
+	{
+		if (!AddComponent(Component))
+		{
+			FallbackComponents.push_back(std::make_pair(Component, Component->Bounds.GetBox()));
+		}
+	}
+	TriangleCount = Triangles.size();
+
+	// Everything is binned by its bounding box first, cells are grown by Margin
+	std::vector<std::vector<uint32>> CellTriangles;
+	std::vector<std::vector<uint32>> CellSpheres;
+	std::vector<std::vector<uint32>> CellHulls;
+	auto ForEachCellInBox = [this, &CellTriangles, &CellSpheres, &CellHulls](FVector Min, FVector Max, TFunctionRef<void(int32 CellIndex)> Function)
+	{
+		FIntVector First, Last;
+		for (int Axis = 0; Axis < 3; Axis++)
+		{
+			First[Axis] = FMath::Max(FMath::FloorToInt((Min[Axis] - Margin[Axis] - Origin[Axis]) / CellSize[Axis]), 0);
+			Last[Axis] = FMath::Min(FMath::FloorToInt((Max[Axis] + Margin[Axis] - Origin[Axis]) / CellSize[Axis]), CellCount[Axis] - 1);
+			if (First[Axis] > Last[Axis])
+				return;
+		}
+
+		for (int X = First.X; X <= Last.X; X++)
+		{
+			for (int Y = First.Y; Y <= Last.Y; Y++)
+			{
+				for (int Z = First.Z; Z <= Last.Z; Z++)
+				{
+					int32 CellIndex = GetOrAddCell(FIntVector(X, Y, Z));
+					CellTriangles.resize(Cells.size());
+					CellSpheres.resize(Cells.size());
+					CellHulls.resize(Cells.size());
+					Function(CellIndex);
+				}
+			}
+		}
+	};
+
+	for (uint32 Index = 0; Index < Triangles.size(); Index++)
+	{
+		const FTriangle& Triangle = Triangles[Index];
+		FVector Min = Triangle.Vertex[0].ComponentMin(Triangle.Vertex[1]).ComponentMin(Triangle.Vertex[2]);
+		FVector Max = Triangle.Vertex[0].ComponentMax(Triangle.Vertex[1]).ComponentMax(Triangle.Vertex[2]);
+		ForEachCellInBox(Min, Max, [&CellTriangles, Index](int32 CellIndex) { CellTriangles[CellIndex].push_back(Index); });
+	}
+	for (uint32 Index = 0; Index < Spheres.size(); Index++)
+	{
+		FVector Radius(Spheres[Index].Radius);
+		ForEachCellInBox(Spheres[Index].Center - Radius, Spheres[Index].Center + Radius, [&CellSpheres, Index](int32 CellIndex) { CellSpheres[CellIndex].push_back(Index); });
+	}
+	for (uint32 Index = 0; Index < Hulls.size(); Index++)
+	{
+		ForEachCellInBox(Hulls[Index].Bounds.Min, Hulls[Index].Bounds.Max, [&CellHulls, Index](int32 CellIndex) { CellHulls[CellIndex].push_back(Index); });
+	}
+	for (const std::pair<UPrimitiveComponent*, FBox>& Fallback : FallbackComponents)
+	{
+		ForEachCellInBox(Fallback.second.Min, Fallback.second.Max, [this, &Fallback](int32 CellIndex) { Cells[CellIndex].Fallback.emplace_back(Fallback.first, Fallback.second); });
+	}
+
+	// Bounding boxes of large or diagonal triangles touch a lot of cells they dont overlap, so they are filtered with the exact test
+	FVector3f CellExtent = FVector3f(CellSize / 2.f + Margin);
+	ParallelFor(Cells.size(), [this, &CellTriangles, &CellSpheres, &CellHulls, CellExtent](int32 CellIndex)
+	{
+		FCell& Cell = Cells[CellIndex];
+
+		std::vector<FTrianglePacket> Candidates;
+		PackTriangles(Triangles, CellTriangles[CellIndex], Cell.Center, Candidates);
+		std::vector<uint32> Overlapping;
+		for (uint32 PacketIndex = 0; PacketIndex < Candidates.size(); PacketIndex++)
+		{
+			uint32 Mask = PacketOverlapMask(Candidates[PacketIndex], FVector3f(0.f), CellExtent);
+			for (uint32 Lane = 0; Lane < 4 && PacketIndex * 4 + Lane < CellTriangles[CellIndex].size(); Lane++)
+			{
+				if ((Mask >> Lane) & 1)
+					Overlapping.push_back(CellTriangles[CellIndex][PacketIndex * 4 + Lane]);
+			}
+		}
+		PackTriangles(Triangles, Overlapping, Cell.Center, Cell.Packets);
+
+		for (uint32 Index : CellSpheres[CellIndex])
+		{
+			FSphere Sphere;
+			Sphere.Center = FVector3f(Spheres[Index].Center - Cell.Center);
+			Sphere.Radius = Spheres[Index].Radius;
+			if (SphereOverlapsBox(Sphere, FVector3f(0.f), CellExtent))
+				Cell.Spheres.push_back(Sphere);
+		}
+
+		for (uint32 Index : CellHulls[CellIndex])
+		{
+			FHull Hull;
+			Hull.FirstPlane = Cell.HullPlanes.size();
+			Hull.PlaneCount = Hulls[Index].Planes.size();
+			for (const FPlane& Plane : Hulls[Index].Planes)
+			{
+				Cell.HullPlanes.push_back(FVector4f((float)Plane.X, (float)Plane.Y, (float)Plane.Z, (float)(Plane.W - (Plane.GetNormal() | Cell.Center))));
+			}
+			Cell.Hulls.push_back(Hull);
+		}
+	});
+
+	std::vector<FTriangle>().swap(Triangles);
+	std::vector<FWorldSphere>().swap(Spheres);
+	std::vector<FWorldHull>().swap(Hulls);
+	std::vector<std::pair<UPrimitiveComponent*, FBox>>().swap(FallbackComponents);
+}
+
+bool CPathGeometryRasterizer::IsBoxOccupied(FVector Center, FVector Extent) const
+{
+	int32 CellIndex = FindCell(Center);
+	if (CellIndex < 0)
+		return false;
+
+	const FCell& Cell = Cells[CellIndex];
+	FVector3f LocalCenter(Center - Cell.Center);
+	FVector3f LocalExtent(Extent);
+	for (const FTrianglePacket& Packet : Cell.Packets)
+	{
+		if (PacketOverlapMask(Packet, LocalCenter, LocalExtent))
+			return true;
+	}
+	for (const FSphere& Sphere : Cell.Spheres)
+	{
+		if (SphereOverlapsBox(Sphere, LocalCenter, LocalExtent))
+			return true;
+	}
+
+	// The box doesnt touch any surface, so its either completely inside of a closed element or completely outside
+	for (const FHull& Hull : Cell.Hulls)
+	{
+		if (IsInsideHull(&Cell.HullPlanes[Hull.FirstPlane], Hull.PlaneCount, LocalCenter))
+			return true;
+	}
+	return false;
+}
+
+const FCPathCandidateList* CPathGeometryRasterizer::GetFallbackComponents(FVector Center) const
+{
+	int32 CellIndex = FindCell(Center);
+	if (CellIndex < 0 || Cells[CellIndex].Fallback.empty())
+		return nullptr;
+	return &Cells[CellIndex].Fallback;
+}
+
+uint64 CPathGeometryRasterizer::GetAllocatedSize() const
+{
+	uint64 Size = Cells.capacity() * sizeof(FCell) + CellIndexByKey.GetAllocatedSize();
+	for (const FCell& Cell : Cells)
+	{
+		Size += Cell.Packets.capacity() * sizeof(FTrianglePacket) + Cell.Spheres.capacity() * sizeof(FSphere)
+			+ Cell.Hulls.capacity() * sizeof(FHull) + Cell.HullPlanes.capacity() * sizeof(FVector4f) + Cell.Fallback.capacity() * sizeof(FCPathCandidateList::value_type);
+	}
+	return Size;
+}
+
+bool CPathGeometryRasterizer::AddComponent(UPrimitiveComponent* Component)
+{
+	// Anything that can move is snapshotted now as oriented boxes and spheres around its collision, workers cant read its transform safely
+	if (Component->Mobility != EComponentMobility::Static)
+	{
+		std::vector<FCPathObstacleShape> Shapes;
+		UCPathDynamicObstacle::GetComponentShapes(Component, Shapes);
+		for (const FCPathObstacleShape& Shape : Shapes)
+		{
+			if (Shape.Radius > 0.f)
+				Spheres.push_back({ Shape.Center, Shape.Radius });
+			else
+				AddBox(FTransform(Shape.Rotation, Shape.Center), Shape.Extent);
+		}
+		return true;
+	}
+
+	// Instances have their own bodies that the body setup doesnt describe
+	if (Cast<UInstancedStaticMeshComponent>(Component))
+		return false;
+
+	UBodySetup* BodySetup = Component->GetBodySetup();
+	if (!BodySetup)
+		return false;
+
+	const FTransform& Transform = Component->GetComponentTransform();
+	if (BodySetup->GetCollisionTraceFlag() == CTF_UseComplexAsSimple)
+	{
+		UStaticMeshComponent* MeshComponent = Cast<UStaticMeshComponent>(Component);
+		return MeshComponent && AddStaticMeshTriangles(MeshComponent, Transform);
+	}
+	return AddBodySetup(BodySetup, Transform);
+}
+
+bool CPathGeometryRasterizer::AddBodySetup(const UBodySetup* BodySetup, const FTransform& Transform)
+{
+	const FKAggregateGeom& Geometry = BodySetup->AggGeom;
+	if (Geometry.TaperedCapsuleElems.Num())
+		return false;
+
+	// Non uniform scale is applied to radiuses as the biggest axis scale, which only makes them more conservative
+	float RadiusScale = Transform.GetScale3D().GetAbsMax();
+
+	for (const FKBoxElem& Box : Geometry.BoxElems)
+	{
+		AddBox(Box.GetTransform() * Transform, FVector(Box.X, Box.Y, Box.Z) / 2.f);
+	}
+
+	for (const FKSphereElem& Sphere : Geometry.SphereElems)
+	{
+		FWorldSphere WorldSphere;
+		WorldSphere.Center = Transform.TransformPosition(Sphere.Center);
+		WorldSphere.Radius = Sphere.Radius * RadiusScale;
+		Spheres.push_back(WorldSphere);
+	}
+
+	for (const FKSphylElem& Capsule : Geometry.SphylElems)
+	{
+		FTransform CapsuleTransform = Capsule.GetTransform() * Transform;
+		FVector HalfLength = FVector(0, 0, Capsule.Length / 2.f);
+		AddCapsule(CapsuleTransform.TransformPosition(-HalfLength), CapsuleTransform.TransformPosition(HalfLength), Capsule.Radius * RadiusScale);
+	}
+
+	for (const FKConvexElem& Convex : Geometry.ConvexElems)
+	{
+		// Older convex elements may not have their hull triangulated
+		if (Convex.IndexData.Num() < 3)
+			return false;
+
+		FTransform ConvexTransform = Convex.GetTransform() * Transform;
+		TArray<FVector> Vertices;
+		Vertices.Reserve(Convex.VertexData.Num());
+		for (const FVector& Vertex : Convex.VertexData)
+		{
+			Vertices.Add(ConvexTransform.TransformPosition(Vertex));
+		}
+		for (int32 Index = 0; Index + 2 < Convex.IndexData.Num(); Index += 3)
+		{
+			AddTriangle(Vertices[Convex.IndexData[Index]], Vertices[Convex.IndexData[Index + 1]], Vertices[Convex.IndexData[Index + 2]]);
+		}
+		AddHull(Vertices.GetData(), Vertices.Num(), Convex.IndexData.GetData(), Convex.IndexData.Num());
+	}
+	return true;
+}
+
+void CPathGeometryRasterizer::AddBox(const FTransform& Transform, FVector Extent)
+{
+	FVector Corners[8];
+	for (int Corner = 0; Corner < 8; Corner++)
+	{
+		Corners[Corner] = Transform.TransformPosition(LookupTable_BoxCorners[Corner] * Extent);
+	}
+	for (int Triangle = 0; Triangle < 12; Triangle++)
+	{
+		AddTriangle(Corners[LookupTable_BoxTriangles[Triangle][0]], Corners[LookupTable_BoxTriangles[Triangle][1]], Corners[LookupTable_BoxTriangles[Triangle][2]]);
+	}
+	AddHull(Corners, 8, &LookupTable_BoxHullIndices[0][0], 18);
+}
+
+bool CPathGeometryRasterizer::AddStaticMeshTriangles(UStaticMeshComponent* MeshComponent, const FTransform& Transform)
+{
+	UStaticMesh* Mesh = MeshComponent->GetStaticMesh();
+
+	// Without CPU access, vertices only exist on the GPU in cooked builds
+	if (!Mesh || !Mesh->bAllowCPUAccess || !Mesh->GetRenderData() || !Mesh->GetRenderData()->LODResources.Num())
+		return false;
+
+	const FStaticMeshLODResources& LOD = Mesh->GetRenderData()->LODResources[FMath::Clamp(Mesh->LODForCollision, 0, Mesh->GetRenderData()->LODResources.Num() - 1)];
+	const FPositionVertexBuffer& Positions = LOD.VertexBuffers.PositionVertexBuffer;
+	FIndexArrayView Indices = LOD.IndexBuffer.GetArrayView();
+	for (int32 Index = 0; Index + 2 < Indices.Num(); Index += 3)
+	{
+		AddTriangle(Transform.TransformPosition(FVector(Positions.VertexPosition(Indices[Index]))),
+			Transform.TransformPosition(FVector(Positions.VertexPosition(Indices[Index + 1]))),
+			Transform.TransformPosition(FVector(Positions.VertexPosition(Indices[Index + 2]))));
+	}
+	return true;
+}
+
+void CPathGeometryRasterizer::AddTriangle(FVector A, FVector B, FVector C)
+{
+	FTriangle Triangle;
+	Triangle.Vertex[0] = A;
+	Triangle.Vertex[1] = B;
+	Triangle.Vertex[2] = C;
+	Triangles.push_back(Triangle);
+}
+
+void CPathGeometryRasterizer::AddCapsule(FVector A, FVector B, float Radius)
+{
+	if (Radius <= 0.f)
+		return;
+
+	// Spheres at most Radius apart, every point of the capsule is at most sqrt(Radius^2 + (Spacing/2)^2) from the closest one
+	float Length = (B - A).Size();
+	int32 Segments = FMath::Max(FMath::CeilToInt(Length / Radius), 1);
+	float Spacing = Length / Segments;
+	float CoverRadius = FMath::Sqrt(Radius * Radius + Spacing * Spacing / 4.f);
+	for (int32 Sphere = 0; Sphere <= Segments; Sphere++)
+	{
+		FWorldSphere WorldSphere;
+		WorldSphere.Center = A + (B - A) * ((float)Sphere / Segments);
+		WorldSphere.Radius = CoverRadius;
+		Spheres.push_back(WorldSphere);
+	}
+}
+
+void CPathGeometryRasterizer::AddHull(const FVector* Vertices, int32 VertexCount, const int32* Indices, int32 IndexCount)
+{
+	FWorldHull Hull;
+	Hull.Bounds = FBox(Vertices, VertexCount);
+	FVector HullCenter = FVector::ZeroVector;
+	for (int32 Vertex = 0; Vertex < VertexCount; Vertex++)
+	{
+		HullCenter += Vertices[Vertex] / VertexCount;
+	}
+
+	for (int32 Index = 0; Index + 2 < IndexCount; Index += 3)
+	{
+		// Winding of the triangles is not guaranteed, the center of a convex element is always inside of it
+		FVector A = Vertices[Indices[Index]];
+		FVector Normal = ((Vertices[Indices[Index + 1]] - A) ^ (Vertices[Indices[Index + 2]] - A)).GetSafeNormal();
+		if (Normal.IsZero())
+			continue;
+
+		FPlane Plane(A, Normal);
+		if (Plane.PlaneDot(HullCenter) > 0.f)
+			Plane = Plane.Flip();
+		Hull.Planes.push_back(Plane);
+	}
+
+	if (Hull.Planes.size() >= 4)
+		Hulls.push_back(std::move(Hull));
+}
+
+int32 CPathGeometryRasterizer::FindCell(FVector Location) const
+{
+	const int32* CellIndex = CellIndexByKey.Find(CellKeyFromCoords(CellCoordsFromLocation(Location)));
+	return CellIndex ? *CellIndex : -1;
+}
+
+FIntVector CPathGeometryRasterizer::CellCoordsFromLocation(FVector Location) const
+{
+	FIntVector Coords;
+	for (int Axis = 0; Axis < 3; Axis++)
+	{
+		Coords[Axis] = FMath::Clamp(FMath::FloorToInt((Location[Axis] - Origin[Axis]) / CellSize[Axis]), 0, CellCount[Axis] - 1);
+	}
+	return Coords;
+}
+
+uint32 CPathGeometryRasterizer::CellKeyFromCoords(FIntVector Coords) const
+{
+	return Coords.X + CellCount.X * (Coords.Y + CellCount.Y * Coords.Z);
+}
+
+int32 CPathGeometryRasterizer::GetOrAddCell(FIntVector Coords)
+{
+	uint32 Key = CellKeyFromCoords(Coords);
+	if (const int32* CellIndex = CellIndexByKey.Find(Key))
+		return *CellIndex;
+
+	Cells.emplace_back();
+	Cells.back().Center = Origin + (FVector(Coords) + 0.5f) * CellSize;
+	CellIndexByKey.Add(Key, Cells.size() - 1);
+	return Cells.size() - 1;
+}
+
+void CPathGeometryRasterizer::PackTriangles(const std::vector<FTriangle>& InTriangles, const std::vector<uint32>& Indices, FVector Center, std::vector<FTrianglePacket>& OutPackets)
+{
+	OutPackets.resize((Indices.size() + 3) / 4);
+	for (uint32 Index = 0; Index < OutPackets.size() * 4; Index++)
+	{
+		// Unused lanes of the last packet repeat its first triangle, so they never add an overlap
+		const FTriangle& Triangle = InTriangles[Indices[Index < Indices.size() ? Index : Index & ~3u]];
+		FTrianglePacket& Packet = OutPackets[Index / 4];
+		for (int Corner = 0; Corner < 3; Corner++)
+		{
+			for (int Axis = 0; Axis < 3; Axis++)
+			{
+				Packet.Vertex[Corner][Axis][Index % 4] = Triangle.Vertex[Corner][Axis] - Center[Axis];
+			}
+		}
+	}
+}
+
+// True in lanes where the projections of the triangle (P0, P1, P2) and of the box (-R, R) on an axis dont overlap
+static FORCEINLINE VectorRegister4Float SeparatedOnAxis(VectorRegister4Float P0, VectorRegister4Float P1, VectorRegister4Float P2, VectorRegister4Float R)
+{
+	VectorRegister4Float Min = VectorMin(P0, VectorMin(P1, P2));
+	VectorRegister4Float Max = VectorMax(P0, VectorMax(P1, P2));
+	return VectorBitwiseOr(VectorCompareGT(Min, R), VectorCompareGT(VectorNegate(R), Max));
+}
+
+uint32 CPathGeometryRasterizer::PacketOverlapMask(const FTrianglePacket& Packet, const FVector3f& Center, const FVector3f& Extent)
+{
+	// Separating axis test of a triangle and a box (Akenine-Moller), on 4 triangles at once.
+	// Axes are the 3 box normals, the triangle normal, and the 9 cross products of box normals and triangle edges.
+	VectorRegister4Float H[3];
+	VectorRegister4Float V[3][3];
+	for (int Axis = 0; Axis < 3; Axis++)
+	{
+		H[Axis] = VectorSetFloat1(Extent[Axis]);
+		VectorRegister4Float C = VectorSetFloat1(Center[Axis]);
+		for (int Corner = 0; Corner < 3; Corner++)
+		{
+			V[Corner][Axis] = VectorSubtract(VectorLoad(Packet.Vertex[Corner][Axis]), C);
+		}
+	}
+
+	VectorRegister4Float Separated = SeparatedOnAxis(V[0][0], V[1][0], V[2][0], H[0]);
+	Separated = VectorBitwiseOr(Separated, SeparatedOnAxis(V[0][1], V[1][1], V[2][1], H[1]));
+	Separated = VectorBitwiseOr(Separated, SeparatedOnAxis(V[0][2], V[1][2], V[2][2], H[2]));
+
+	VectorRegister4Float E[3][3];
+	VectorRegister4Float AbsE[3][3];
+	for (int Edge = 0; Edge < 3; Edge++)
+	{
+		for (int Axis = 0; Axis < 3; Axis++)
+		{
+			E[Edge][Axis] = VectorSubtract(V[(Edge + 1) % 3][Axis], V[Edge][Axis]);
+			AbsE[Edge][Axis] = VectorAbs(E[Edge][Axis]);
+		}
+	}
+
+	// Triangle normal
+	VectorRegister4Float N[3];
+	for (int Axis = 0; Axis < 3; Axis++)
+	{
+		int B = (Axis + 1) % 3;
+		int C = (Axis + 2) % 3;
+		N[Axis] = VectorSubtract(VectorMultiply(E[0][B], E[1][C]), VectorMultiply(E[0][C], E[1][B]));
+	}
+	VectorRegister4Float D = VectorMultiplyAdd(N[0], V[0][0], VectorMultiplyAdd(N[1], V[0][1], VectorMultiply(N[2], V[0][2])));
+	VectorRegister4Float R = VectorMultiplyAdd(H[0], VectorAbs(N[0]), VectorMultiplyAdd(H[1], VectorAbs(N[1]), VectorMultiply(H[2], VectorAbs(N[2]))));
+	Separated = VectorBitwiseOr(Separated, VectorCompareGT(VectorAbs(D), R));
+
+	// Box normal (Axis) x Edge, the axis has no component along Axis
+	for (int Edge = 0; Edge < 3; Edge++)
+	{
+		for (int Axis = 0; Axis < 3; Axis++)
+		{
+			int B = (Axis + 1) % 3;
+			int C = (Axis + 2) % 3;
+			VectorRegister4Float P[3];
+			for (int Corner = 0; Corner < 3; Corner++)
+			{
+				P[Corner] = VectorSubtract(VectorMultiply(V[Corner][B], E[Edge][C]), VectorMultiply(V[Corner][C], E[Edge][B]));
+			}
+			R = VectorMultiplyAdd(H[B], AbsE[Edge][C], VectorMultiply(H[C], AbsE[Edge][B]));
+			Separated = VectorBitwiseOr(Separated, SeparatedOnAxis(P[0], P[1], P[2], R));
+		}
+	}
+
+	return ~VectorMaskBits(Separated) & 0xF;
+}
+
+bool CPathGeometryRasterizer::SphereOverlapsBox(const FSphere& Sphere, const FVector3f& Center, const FVector3f& Extent)
+{
+	float DistanceSquared = 0.f;
+	for (int Axis = 0; Axis < 3; Axis++)
+	{
+		float Outside = FMath::Abs(Sphere.Center[Axis] - Center[Axis]) - Extent[Axis];
+		if (Outside > 0.f)
+			DistanceSquared += Outside * Outside;
+	}
+	return DistanceSquared <= Sphere.Radius * Sphere.Radius;
+}
+
+bool CPathGeometryRasterizer::IsInsideHull(const FVector4f* Planes, uint32 PlaneCount, const FVector3f& Point)
+{
+	for (uint32 PlaneIndex = 0; PlaneIndex < PlaneCount; PlaneIndex++)
+	{
+		const FVector4f& Plane = Planes[PlaneIndex];
+		if (Plane.X * Point.X + Plane.Y * Point.Y + Plane.Z * Point.Z > Plane.W)
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,113 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathLinearOctree.h"
+#include "CPathOctree.h"
+#include "Async/ParallelFor.h"
+
+CPathLinearOctree::CPathLinearOctree()
+{
+}
+
+void CPathLinearOctree::Build(TFunctionRef<const CPathOctree*(uint32 OuterIndex)> GetOuterTree, uint32 OuterNodeCount, uint32 InMaxDepth)
+{
+	Reset();
+	if (!OuterNodeCount)
+		return;
+
+	MaxDepth = InMaxDepth;
+	OuterData.SetNumZeroed(OuterNodeCount);
+	Subtrees.resize(OuterNodeCount);
+
+	// Outer trees dont share anything, so they can be built in parallel
+	ParallelFor(OuterNodeCount, [this, &GetOuterTree](int32 OuterIndex)
+	{
+		BuildOuterTree(GetOuterTree(OuterIndex), OuterIndex);
+	});
+}
+
+void CPathLinearOctree::Rebuild(TFunctionRef<const CPathOctree*(uint32 OuterIndex)> GetOuterTree, const std::vector<uint32>& OuterIndexes)
+{
+	checkf(IsBuilt(), TEXT("CPATH - Linear Octree:::Only a built linear octree can be rebuilt partially"));
+
+	ParallelFor(OuterIndexes.size(), [this, &GetOuterTree, &OuterIndexes](int32 Index)
+	{
+		BuildOuterTree(GetOuterTree(OuterIndexes[Index]), OuterIndexes[Index]);
+	});
+}
+
+void CPathLinearOctree::BuildOuterTree(const CPathOctree* Tree, uint32 OuterIndex)
+{
+	std::unique_ptr<Subtree>& TreeSubtree = Subtrees[OuterIndex];
+	if (TreeSubtree)
+		SubtreeBytes -= TreeSubtree->AllocatedSize;
+	TreeSubtree.reset();
+
+	OuterData[OuterIndex] = Tree->Data;
+	if (!Tree->Children || !MaxDepth)
+		return;
+
+	TreeSubtree = std::make_unique<Subtree>();
+	TreeSubtree->Levels.SetNum(MaxDepth);
+
+	// Nodes at the current depth in the order they will be stored.
+	// Children are appended in the order of their parents, so every depth stays sorted by locational code.
+	std::vector<const CPathOctree*> CurrentNodes;
+	std::vector<const CPathOctree*> NextNodes;
+	for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+	{
+		CurrentNodes.push_back(&Tree->Children[ChildIndex]);
+	}
+
+	uint64 AllocatedSize = sizeof(Subtree) + TreeSubtree->Levels.GetAllocatedSize();
+	for (uint32 Depth = 1; Depth <= MaxDepth; Depth++)
+	{
+		Level& CurrLevel = TreeSubtree->Levels[Depth - 1];
+		uint32 NodeCount = CurrentNodes.size();
+		uint32 WordCount = (NodeCount + 63) / 64;
+
+		CurrLevel.Data.SetNumUninitialized(NodeCount);
+		CurrLevel.ChildMask.SetNumZeroed(WordCount);
+		CurrLevel.Rank.SetNumUninitialized(WordCount);
+
+		NextNodes.clear();
+		for (uint32 Index = 0; Index < NodeCount; Index++)
+		{
+			const CPathOctree* Node = CurrentNodes[Index];
+			CurrLevel.Data[Index] = Node->Data;
+			if (Node->Children && Depth < MaxDepth)
+			{
+				CurrLevel.ChildMask[Index >> 6] |= uint64(1) << (Index & 63);
+				for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+				{
+					NextNodes.push_back(&Node->Children[ChildIndex]);
+				}
+			}
+		}
+
+		uint32 NodesWithChildren = 0;
+		for (uint32 Word = 0; Word < WordCount; Word++)
+		{
+			CurrLevel.Rank[Word] = NodesWithChildren;
+			NodesWithChildren += FMath::CountBits(CurrLevel.ChildMask[Word]);
+		}
+
+		AllocatedSize += CurrLevel.Data.GetAllocatedSize() + CurrLevel.ChildMask.GetAllocatedSize() + CurrLevel.Rank.GetAllocatedSize();
+		std::swap(CurrentNodes, NextNodes);
+	}
+
+	TreeSubtree->AllocatedSize = AllocatedSize;
+	SubtreeBytes += AllocatedSize;
+}
+
+void CPathLinearOctree::Reset()
+{
+	OuterData.Empty();
+	Subtrees.clear();
+	Subtrees.shrink_to_fit();
+	SubtreeBytes.store(0);
+}
+
+uint64 CPathLinearOctree::GetAllocatedSize() const
+{
+	return OuterData.GetAllocatedSize() + Subtrees.capacity() * sizeof(std::unique_ptr<Subtree>) + SubtreeBytes.load();
+}
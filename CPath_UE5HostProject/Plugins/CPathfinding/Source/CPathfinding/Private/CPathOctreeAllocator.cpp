@@ -0,0 +1,244 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#include "CPathOctreeAllocator.h"
+#include "CPathOctree.h"
+#include "CPathAttributeLayer.h"
+#include "Misc/ScopeLock.h"
+
+CPathOctreeAllocator::CPathOctreeAllocator()
+	:
+	BlockStride(8 * sizeof(CPathOctree))
+{
+	for (uint32 Depth = 0; Depth <= MAX_DEPTH; Depth++)
+	{
+		AllocatedBlocksAtDepth[Depth].store(0);
+	}
+}
+
+CPathOctreeAllocator::~CPathOctreeAllocator()
+{
+	ReleaseAll();
+}
+
+void CPathOctreeAllocator::ThreadCache::Flush()
+{
+	if (Allocator && FreeBlocks.size())
+	{
+		Allocator->ReturnToShared(*this, FreeBlocks.size());
+	}
+}
+
+CPathOctree* CPathOctreeAllocator::AllocateChildren(ThreadCache& Cache, uint32 Depth)
+{
+	if (Cache.FreeBlocks.empty() || Cache.Epoch != Epoch.load(std::memory_order_acquire))
+	{
+		RefillCache(Cache);
+	}
+
+	CPathOctree* Block = Cache.FreeBlocks.back();
+	Cache.FreeBlocks.pop_back();
+	AllocatedBlocks++;
+	AllocatedBlocksAtDepth[Depth].fetch_add(1, std::memory_order_relaxed);
+
+	// Node indexes belong to the slot, so they survive the block being freed and reused
+	uint32 BlockNodeIndex = Block->NodeIndex;
+	for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+	{
+		new (&Block[ChildIndex]) CPathOctree();
+		Block[ChildIndex].NodeIndex = BlockNodeIndex + ChildIndex;
+	}
+	if (PayloadSize)
+	{
+		FMemory::Memzero(GetBlockPayload<uint8>(Block), PayloadSize);
+	}
+	return Block;
+}
+
+CPathOctree* CPathOctreeAllocator::AllocateCopy(const CPathOctree* Block, ThreadCache& Cache, uint32 Depth)
+{
+	CPathOctree* Copy = AllocateChildren(Cache, Depth);
+	uint32 BlockNodeIndex = Copy->NodeIndex;
+	FMemory::Memcpy(Copy, Block, 8 * sizeof(CPathOctree) + PayloadSize);
+	for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+	{
+		Copy[ChildIndex].NodeIndex = BlockNodeIndex + ChildIndex;
+	}
+	return Copy;
+}
+
+void CPathOctreeAllocator::FreeChildren(CPathOctree* Tree, ThreadCache& Cache, uint32 Depth)
+{
+	if (!Tree->Children)
+		return;
+
+	if (!IsFrozen(Tree->Children))
+	{
+		FreeChildrenRec(Tree->Children, Cache, Depth);
+	}
+	Tree->Children = nullptr;
+
+	if (Cache.FreeBlocks.size() > MaxCachedBlocks)
+	{
+		ReturnToShared(Cache, MaxCachedBlocks / 2);
+	}
+}
+
+void CPathOctreeAllocator::FreeChildrenRec(CPathOctree* Block, ThreadCache& Cache, uint32 Depth)
+{
+	for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+	{
+		if (Block[ChildIndex].Children && !IsFrozen(Block[ChildIndex].Children))
+		{
+			FreeChildrenRec(Block[ChildIndex].Children, Cache, Depth + 1);
+		}
+	}
+
+	// Node indexes of the block are reused by whatever gets this slot next
+	if (AttributeLayers)
+	{
+		for (const std::unique_ptr<CPathAttributeLayer>& Layer : *AttributeLayers)
+		{
+			for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+			{
+				Layer->Clear(Block[ChildIndex].NodeIndex);
+			}
+		}
+	}
+
+	uint32 CurrentEpoch = Epoch.load(std::memory_order_acquire);
+	if (Cache.Epoch != CurrentEpoch)
+	{
+		Cache.FreeBlocks.clear();
+		Cache.Epoch = CurrentEpoch;
+	}
+	Cache.FreeBlocks.push_back(Block);
+	AllocatedBlocks--;
+	AllocatedBlocksAtDepth[Depth].fetch_sub(1, std::memory_order_relaxed);
+}
+
+void CPathOctreeAllocator::SetBlockPayloadSize(uint32 PayloadBytes)
+{
+	FScopeLock Lock(&SharedLock);
+	checkf(Slabs.empty(), TEXT("CPATH - Octree Allocator:::Payload size can only be changed before anything is allocated"));
+
+	// Keeping every block aligned for CPathOctree
+	PayloadSize = PayloadBytes;
+	BlockStride = 8 * sizeof(CPathOctree) + Align(PayloadBytes, alignof(CPathOctree));
+}
+
+void CPathOctreeAllocator::SetFirstNodeIndex(uint32 FirstIndex)
+{
+	FScopeLock Lock(&SharedLock);
+	checkf(Slabs.empty(), TEXT("CPATH - Octree Allocator:::First node index can only be changed before anything is allocated"));
+	FirstNodeIndex = FirstIndex;
+}
+
+void CPathOctreeAllocator::SetAttributeLayers(const std::vector<std::unique_ptr<CPathAttributeLayer>>* Layers)
+{
+	FScopeLock Lock(&SharedLock);
+	checkf(Slabs.empty(), TEXT("CPATH - Octree Allocator:::Attribute layers can only be changed before anything is allocated"));
+	AttributeLayers = Layers;
+}
+
+CPathOctree* CPathOctreeAllocator::AllocateFrozenBlocks(uint32 BlockCount)
+{
+	FScopeLock Lock(&SharedLock);
+	checkf(!FrozenArena, TEXT("CPATH - Octree Allocator:::There already is a frozen arena"));
+
+	SIZE_T Size = (SIZE_T)BlockCount * BlockStride;
+	FrozenArena = (uint8*)FMemory::Malloc(FMath::Max(Size, (SIZE_T)BlockStride), alignof(CPathOctree));
+	FMemory::Memzero(FrozenArena, Size);
+	FrozenArenaEnd = FrozenArena + Size;
+	FrozenBlockCount = BlockCount;
+	return (CPathOctree*)FrozenArena;
+}
+
+void CPathOctreeAllocator::ReleaseAll()
+{
+	{
+		FScopeLock Lock(&SharedLock);
+		FMemory::Free(FrozenArena);
+		FrozenArena = nullptr;
+		FrozenArenaEnd = nullptr;
+		FrozenBlockCount = 0;
+	}
+	ReleaseSlabs();
+}
+
+void CPathOctreeAllocator::ReleaseSlabs()
+{
+	FScopeLock Lock(&SharedLock);
+
+	for (uint8* Slab : Slabs)
+	{
+		FMemory::Free(Slab);
+	}
+	Slabs.clear();
+	SharedFreeBlocks.clear();
+	SharedFreeBlocks.shrink_to_fit();
+	NextBlockInSlab = BlocksPerSlab;
+	AllocatedBlocks.store(0);
+	for (uint32 Depth = 0; Depth <= MAX_DEPTH; Depth++)
+	{
+		AllocatedBlocksAtDepth[Depth].store(0);
+	}
+
+	// Any ThreadCache that still holds blocks will drop them instead of returning them
+	Epoch.fetch_add(1, std::memory_order_release);
+}
+
+uint64 CPathOctreeAllocator::GetReservedBytes() const
+{
+	FScopeLock Lock(&SharedLock);
+	return ((uint64)Slabs.size() * BlocksPerSlab + FrozenBlockCount) * BlockStride;
+}
+
+void CPathOctreeAllocator::RefillCache(ThreadCache& Cache)
+{
+	FScopeLock Lock(&SharedLock);
+
+	uint32 CurrentEpoch = Epoch.load(std::memory_order_acquire);
+	if (Cache.Epoch != CurrentEpoch)
+	{
+		Cache.FreeBlocks.clear();
+		Cache.Epoch = CurrentEpoch;
+	}
+
+	// Reusing freed blocks first
+	uint32 FromShared = FMath::Min((uint32)SharedFreeBlocks.size(), BatchSize);
+	Cache.FreeBlocks.insert(Cache.FreeBlocks.end(), SharedFreeBlocks.end() - FromShared, SharedFreeBlocks.end());
+	SharedFreeBlocks.resize(SharedFreeBlocks.size() - FromShared);
+
+	for (uint32 i = FromShared; i < BatchSize; i++)
+	{
+		if (NextBlockInSlab >= BlocksPerSlab)
+		{
+			Slabs.push_back((uint8*)FMemory::Malloc((SIZE_T)BlocksPerSlab * BlockStride, alignof(CPathOctree)));
+			NextBlockInSlab = 0;
+		}
+		CPathOctree* Block = (CPathOctree*)(Slabs.back() + (SIZE_T)NextBlockInSlab * BlockStride);
+		uint64 BlockNodeIndex = FirstNodeIndex + ((uint64)(Slabs.size() - 1) * BlocksPerSlab + NextBlockInSlab) * 8;
+		checkf(BlockNodeIndex + 8 <= CPATH_INVALID_NODEINDEX, TEXT("CPATH - Octree Allocator:::Ran out of node indexes"));
+		Block->NodeIndex = BlockNodeIndex;
+		Cache.FreeBlocks.push_back(Block);
+		NextBlockInSlab++;
+	}
+}
+
+void CPathOctreeAllocator::ReturnToShared(ThreadCache& Cache, uint32 Count)
+{
+	FScopeLock Lock(&SharedLock);
+
+	// These blocks belong to slabs that were already released
+	uint32 CurrentEpoch = Epoch.load(std::memory_order_acquire);
+	if (Cache.Epoch != CurrentEpoch)
+	{
+		Cache.FreeBlocks.clear();
+		Cache.Epoch = CurrentEpoch;
+		return;
+	}
+
+	Count = FMath::Min(Count, (uint32)Cache.FreeBlocks.size());
+	SharedFreeBlocks.insert(SharedFreeBlocks.end(), Cache.FreeBlocks.end() - Count, Cache.FreeBlocks.end());
+	Cache.FreeBlocks.resize(Cache.FreeBlocks.size() - Count);
+}
@@ -8,11 +8,26 @@
 #include <deque>
 #include <list>
 #include <unordered_set>
+#include <unordered_map>
+#include "Misc/Crc.h"
 #include "CPathDynamicObstacle.h"
 #include "CPathNode.h"
+#include "CPathGenerationPool.h"
 #include "TimerManager.h"
 #include "Engine/Selection.h"
 #include "GenericPlatform/GenericPlatformAtomics.h"
+#include "Async/ParallelFor.h"
+#include "GameFramework/PlayerController.h"
+#include "GameFramework/Pawn.h"
+#include "GameFramework/PlayerStart.h"
+#include "EngineUtils.h"
+#include <algorithm>
+
+
+DECLARE_STATS_GROUP(TEXT("CPathfinding"), STATGROUP_CPathfinding, STATCAT_Advanced);
+DECLARE_MEMORY_STAT(TEXT("Graph Memory"), STAT_CPathGraphMemory, STATGROUP_CPathfinding);
+DECLARE_MEMORY_STAT(TEXT("Linear Octree Memory"), STAT_CPathLinearOctreeMemory, STATGROUP_CPathfinding);
+DECLARE_MEMORY_STAT(TEXT("Pathfinding Scratch Memory"), STAT_CPathPathfindingScratchMemory, STATGROUP_CPathfinding);
 
 
 
@@ -30,7 +45,9 @@ ACPathVolume::ACPathVolume()
 
 
 #endif
-	DepthsToDraw = { true, true, true, true };
+	DepthsToDraw.Init(true, MAX_DEPTH + 1);
+	FreeOuterTree.SetIsFree(true);
+	OctreeCountAtDepth.Init(0, MAX_DEPTH + 1);
 
 
 	FVector Location = GetActorLocation() - VolumeBox->GetScaledBoxExtent() + VoxelSize;
@@ -40,7 +57,7 @@ ACPathVolume::ACPathVolume()
 
 void ACPathVolume::DebugDrawNeighbours(FVector WorldLocation)
 {
-	uint32 LeafID;
+	CPathTreeID LeafID;
 	if (FindLeafByWorldLocation(WorldLocation, LeafID))
 	{
 		DrawDebugBox(GetWorld(), WorldLocationFromTreeID(LeafID), FVector(GetVoxelSizeByDepth(ExtractDepth(LeafID)) / 2.f), FColor::Emerald, false, 5, 10, DebugBoxesThickness*1.3);
@@ -53,7 +70,7 @@ void ACPathVolume::DebugDrawNeighbours(FVector WorldLocation)
 	}
 }
 
-bool ACPathVolume::DrawDebugVoxel(uint32 TreeID, bool DrawIfNotLeaf, float Duration, FColor Color, CPathVoxelDrawData* OutDrawData)
+bool ACPathVolume::DrawDebugVoxel(CPathTreeID TreeID, bool DrawIfNotLeaf, float Duration, FColor Color, CPathVoxelDrawData* OutDrawData)
 {
 
 	uint32 Depth;
@@ -61,7 +78,7 @@ bool ACPathVolume::DrawDebugVoxel(uint32 TreeID, bool DrawIfNotLeaf, float Durat
 	auto Tree = FindTreeByID(TreeID, Depth);
 	if (Tree->Children && !DrawIfNotLeaf)
 		return false;
-	bool IsFree = Tree->GetIsFree();
+	bool IsFree = IsBrickVoxel(TreeID) ? IsBrickVoxelFree(TreeID) : Tree->GetIsFree();
 	if (IsFree)
 	{
 		if (!DrawFree)
@@ -85,9 +102,9 @@ bool ACPathVolume::DrawDebugVoxel(uint32 TreeID, bool DrawIfNotLeaf, float Durat
 
 	if (DepthsToDraw[Depth])
 	{
-		float Extent = GetVoxelSizeByDepth(ExtractDepth(TreeID)) / 2.f;
+		FVector Extent = GetVoxelSizeByDepth(ExtractDepth(TreeID)) / 2.f;
 		FVector Location = WorldLocationFromTreeID(TreeID);
-		DrawDebugBox(GetWorld(), Location, FVector(Extent), Color, Persistent, Duration, 0U, Thickness);
+		DrawDebugBox(GetWorld(), Location, Extent, Color, Persistent, Duration, 0U, Thickness);
 		if (OutDrawData)
 		{
 			OutDrawData->Extent = Extent;
@@ -115,7 +132,7 @@ void ACPathVolume::DrawDebugVoxel(const CPathVoxelDrawData& DrawData, float Dura
 	if (Duration < 0)
 		Persistent = true;
 
-	DrawDebugBox(GetWorld(), DrawData.Location, FVector(DrawData.Extent), Color, Persistent, Duration, 0U, Thickness);
+	DrawDebugBox(GetWorld(), DrawData.Location, DrawData.Extent, Color, Persistent, Duration, 0U, Thickness);
 }
 
 void ACPathVolume::DrawDebugNodesAroundLocation(FVector WorldLocation, int VoxelLimit, float Duration)
@@ -131,13 +148,13 @@ void ACPathVolume::DrawDebugNodesAroundLocation(FVector WorldLocation, int Voxel
 	}
 	PreviousDrawAroundLocationData.clear();
 
-	uint32 OriginTreeID = 0xFFFFFFFF;
+	CPathTreeID OriginTreeID = CPATH_INVALID_TREEID;
 	CPathOctree* OriginTree = FindLeafByWorldLocation(WorldLocation, OriginTreeID, false);
 	if (!OriginTree)
 		return;
 
-	std::list<uint32> IndexList;
-	std::unordered_set<uint32> VisitedIndexes;
+	std::list<CPathTreeID> IndexList;
+	std::unordered_set<CPathTreeID> VisitedIndexes;
 
 	CPathAStarNode StartNode(OriginTreeID);
 	StartNode.FitnessResult = 0;
@@ -150,7 +167,7 @@ void ACPathVolume::DrawDebugNodesAroundLocation(FVector WorldLocation, int Voxel
 
 	while (!IndexList.empty() && VoxelLimit > 0)
 	{
-		uint32 CurrID = IndexList.front();
+		CPathTreeID CurrID = IndexList.front();
 		IndexList.pop_front();
 		CPathVoxelDrawData DrawData;
 		if (DrawDebugVoxel(CurrID, true, Duration, FColor::Green, &DrawData))
@@ -160,8 +177,8 @@ void ACPathVolume::DrawDebugNodesAroundLocation(FVector WorldLocation, int Voxel
 		}
 
 
-		std::vector<uint32> Neighbours = FindNeighbourLeafs(CurrID, !DrawOccupied);
-		for (uint32 NewTreeID : Neighbours)
+		std::vector<CPathTreeID> Neighbours = FindNeighbourLeafs(CurrID, !DrawOccupied);
+		for (CPathTreeID NewTreeID : Neighbours)
 		{
 
 			// We dont want to redraw nodes
@@ -204,46 +221,160 @@ bool ACPathVolume::GenerateGraph()
 	UBoxComponent* tempBox = Cast<UBoxComponent>(GetRootComponent());
 	tempBox->UpdateOverlaps();
 
+	AttributeLayers.clear();
+	RegisterAttributeLayers();
+
+	ValidateGenerationSettings();
+	MemoryBudgetBytes = (uint64)(MemoryBudgetMB * 1024.0 * 1024.0);
+
+	StaticQueryParams = FCollisionQueryParams::DefaultQueryParam;
+	if (UseLayeredOccupancy)
+	{
+		IgnoreDynamicObstacleActors();
+	}
 
-	float Divider = VoxelSize * FMath::Pow(2.f, OctreeDepth);
+	FVector Divider = FVector(VoxelSize, VoxelSize, GetLeafVoxelHeight()) * FMath::Pow(2.f, OctreeDepth);
 
-	NodeCount[0] = FMath::CeilToInt(VolumeBox->GetScaledBoxExtent().X * 2.0 / Divider);
-	NodeCount[1] = FMath::CeilToInt(VolumeBox->GetScaledBoxExtent().Y * 2.0 / Divider);
-	NodeCount[2] = FMath::CeilToInt(VolumeBox->GetScaledBoxExtent().Z * 2.0 / Divider);
+	NodeCount[0] = FMath::CeilToInt(VolumeBox->GetScaledBoxExtent().X * 2.0 / Divider.X);
+	NodeCount[1] = FMath::CeilToInt(VolumeBox->GetScaledBoxExtent().Y * 2.0 / Divider.Y);
+	NodeCount[2] = FMath::CeilToInt(VolumeBox->GetScaledBoxExtent().Z * 2.0 / Divider.Z);
 
-	checkf(OctreeDepth <= MAX_DEPTH && OctreeDepth >= 0, TEXT("CPATH - Graph Generation:::OctreeDepth must be within 0 and MAX_DEPTH"));
 	//checkf(AgentShape == ECollisionShapeType::Capsule || AgentShape == ECollisionShapeType::Sphere || AgentShape == ECollisionShapeType::Box, TEXT("CPATH - Graph Generation:::Agent shape must be Capsule, Sphere or Box"));
 
+	// Sub-voxels of bricks are 2 depths below OctreeDepth, so they need sizes as well
+	for (int i = 0; i <= GetMaxTreeIDDepth(); i++)
+	{
+		LookupTable_VoxelSizeByDepth[i] = FVector(VoxelSize, VoxelSize, GetLeafVoxelHeight()) * FMath::Pow(2.f, OctreeDepth - i);
+	}
 
 	for (int i = 0; i <= OctreeDepth; i++)
 	{
-
-		LookupTable_VoxelSizeByDepth[i] = VoxelSize * FMath::Pow(2.f, OctreeDepth - i);
 		TraceShapesByDepth.emplace_back();
-		TraceShapesByDepth.back().push_back(FCollisionShape::MakeBox(FVector(GetVoxelSizeByDepth(i) / 2.f)));
+		AddTraceShapes(TraceShapesByDepth.back(), GetVoxelSizeByDepth(i));
+	}
+
+	if (UseLeafBricks)
+	{
+		AddTraceShapes(BrickTraceShapes, GetVoxelSizeByDepth(GetMaxTreeIDDepth()));
+		OctreeAllocator.SetBlockPayloadSize(8 * sizeof(uint64));
+	}
+
+	StartPosition = GetActorLocation() - VolumeBox->GetScaledBoxExtent() + GetVoxelSizeByDepth(0) / 2;
+
+	// Padding a thin axis to a whole tile can multiply the outer tree count, then the plain layout is cheaper than any locality it buys
+	uint64 UnpaddedCount = (uint64)NodeCount[0] * NodeCount[1] * NodeCount[2];
+	uint64 PaddedCount = 1;
+	for (int i = 0; i < 3; i++)
+	{
+		PaddedCount *= (NodeCount[i] + 3) / 4 * 4;
+	}
+	OuterTileBits = PaddedCount - UnpaddedCount <= UnpaddedCount / MaxOuterTilePadding && PaddedCount < DEPTH_0_LIMIT ? 2 : 0;
+
+	for (int i = 0; i < 3; i++)
+	{
+		OuterTileCount[i] = (NodeCount[i] + (1 << OuterTileBits) - 1) >> OuterTileBits;
+	}
+	uint64 OuterNodeCount64 = ((uint64)OuterTileCount[0] * OuterTileCount[1] * OuterTileCount[2]) << (3 * OuterTileBits);
+	checkf(OuterNodeCount64 < DEPTH_0_LIMIT && OuterNodeCount64 <= MAX_uint32, TEXT("CPATH - Graph Generation:::Depth 0 is too dense, increase OctreeDepth and/or voxel size, or decrease volume area."));
+	OuterNodeCount = OuterNodeCount64;
+
+	// Outer trees take the first node indexes, children of every block come after them
+	OctreeAllocator.SetFirstNodeIndex(OuterNodeCount);
+	OctreeAllocator.SetAttributeLayers(AttributeLayers.size() ? &AttributeLayers : nullptr);
+
+	TreesToRegenerate.Reset(OuterNodeCount);
+
+	// Footprints refer to voxels of the previous graph
+	for (auto& Tracked : TrackedDynamicObstacles)
+		Tracked.second = FCPathObstacleState();
 
-		float CurrSize = GetVoxelSizeByDepth(i);
-		if (AgentRadius * 2 > CurrSize || AgentHalfHeight * 2 > CurrSize)
+	// Initial generation goes over pages instead of single outer trees with sparse grid
+	uint32 WorkItemCount = OuterNodeCount;
+	if (UseSparseOuterGrid)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			OuterPageCountXYZ[i] = (NodeCount[i] + OuterPageSize - 1) / OuterPageSize;
+		}
+		OuterPageCount = OuterPageCountXYZ[0] * OuterPageCountXYZ[1] * OuterPageCountXYZ[2];
+		OuterPages.reset(new std::atomic<CPathOctree*>[OuterPageCount]);
+		for (uint32 PageIndex = 0; PageIndex < OuterPageCount; PageIndex++)
+		{
+			OuterPages[PageIndex].store(nullptr);
+		}
+		WorkItemCount = OuterPageCount;
+	}
+	else
+	{
+		Octrees = new CPathOctree[OuterNodeCount];
+		for (uint32 OuterIndex = 0; OuterIndex < OuterNodeCount; OuterIndex++)
 		{
-			switch (AgentShape)
+			Octrees[OuterIndex].NodeIndex = OuterIndex;
+		}
+	}
+	if (UseLeafBricks && OctreeDepth == 0)
+	{
+		OuterBrickMasks.assign(OuterNodeCount, 0);
+	}
+	OuterMaxDepths.clear();
+	if (DepthRegions.Num())
+	{
+		OuterMaxDepths.assign(OuterNodeCount, OctreeDepth);
+		for (const FCPathDepthRegion& Region : DepthRegions)
+		{
+			FVector RegionCenter = GetActorLocation() + Region.Center;
+			FVector Min = WorldLocationToLocalCoordsInt3(RegionCenter - Region.Extent);
+			FVector Max = WorldLocationToLocalCoordsInt3(RegionCenter + Region.Extent);
+			uint8 RegionDepth = FMath::Clamp(Region.MaxDepth, 0, OctreeDepth);
+			for (int X = FMath::Max((int)Min.X, 0); X <= FMath::Min((int)Max.X, (int)NodeCount[0] - 1); X++)
 			{
-			case Capsule:
-				TraceShapesByDepth.back().push_back(FCollisionShape::MakeCapsule(AgentRadius, AgentHalfHeight));
-			case Box:
-				TraceShapesByDepth.back().push_back(FCollisionShape::MakeBox(FVector(AgentRadius, AgentRadius, AgentHalfHeight)));
-			case Sphere:
-				TraceShapesByDepth.back().push_back(FCollisionShape::MakeSphere(AgentRadius));
-			default:
-				break;
+				for (int Y = FMath::Max((int)Min.Y, 0); Y <= FMath::Min((int)Max.Y, (int)NodeCount[1] - 1); Y++)
+				{
+					for (int Z = FMath::Max((int)Min.Z, 0); Z <= FMath::Min((int)Max.Z, (int)NodeCount[2] - 1); Z++)
+					{
+						uint8& OuterMaxDepth = OuterMaxDepths[OuterIndexFromCoords(X, Y, Z)];
+						OuterMaxDepth = FMath::Min(OuterMaxDepth, RegionDepth);
+					}
+				}
 			}
 		}
 	}
-
-	StartPosition = GetActorLocation() - VolumeBox->GetScaledBoxExtent() + GetVoxelSizeByDepth(0) / 2;
-
-	uint32 OuterNodeCount = NodeCount[0] * NodeCount[1] * NodeCount[2];
-	checkf(OuterNodeCount < DEPTH_0_LIMIT, TEXT("CPATH - Graph Generation:::Depth 0 is too dense, increase OctreeDepth and/or voxel size, or decrease volume area."));
-	Octrees = new CPathOctree[OuterNodeCount];
+	ProbedOuterDepths.reset();
+	if (UseDensityProbe)
+	{
+		ProbedOuterDepths.reset(new std::atomic<uint8>[OuterNodeCount]);
+		for (uint32 OuterIndex = 0; OuterIndex < OuterNodeCount; OuterIndex++)
+		{
+			ProbedOuterDepths[OuterIndex].store(CPATH_UNPROBED_DEPTH);
+		}
+	}
+	if (UseLazyGeneration)
+	{
+		LazyTreeStates.reset(new std::atomic<uint8>[OuterNodeCount]);
+		LazyLastTouched.reset(new std::atomic<uint32>[OuterNodeCount]);
+		for (uint32 OuterIndex = 0; OuterIndex < OuterNodeCount; OuterIndex++)
+		{
+			LazyTreeStates[OuterIndex].store(LazyCoarse);
+			LazyLastTouched[OuterIndex].store(0);
+		}
+	}
+	if (RegenerationBudgetMs > 0)
+	{
+		PathLastUsed.reset(new std::atomic<uint32>[OuterNodeCount]);
+		for (uint32 OuterIndex = 0; OuterIndex < OuterNodeCount; OuterIndex++)
+		{
+			PathLastUsed[OuterIndex].store(0);
+		}
+	}
+	OuterDirtySince.clear();
+	if (UseProgressiveGeneration)
+	{
+		OuterTreeGenerated.reset(new std::atomic<bool>[OuterNodeCount]);
+		for (uint32 OuterIndex = 0; OuterIndex < OuterNodeCount; OuterIndex++)
+		{
+			OuterTreeGenerated[OuterIndex].store(false);
+		}
+	}
 
 	// If we use all logical threads in the system, the rest of the game
 	// will have no computing power to work with. From my small test sample
@@ -257,41 +388,141 @@ bool ACPathVolume::GenerateGraph()
 
 	MaxGenerationThreads = FMath::Min(MaxGenerationThreads, 31);
 
-	uint32 NodesPerThread = OuterNodeCount / MaxGenerationThreads;
-
-	for (int i = 0; i < 64; i++)
+	if (UseGeometryRasterizer)
 	{
-		ThreadIDs[1] = false;
+		BuildGeometryRasterizer();
 	}
 
-
-	for (int CurrentThread = 0; CurrentThread < MaxGenerationThreads; CurrentThread++)
+	if (UseAsyncOverlapQueries)
 	{
-		uint32 LastIndex = NodesPerThread * (CurrentThread + 1);
-		if (CurrentThread == MaxGenerationThreads - 1)
-			LastIndex += OuterNodeCount % MaxGenerationThreads;
-
-		int ThreadID = GetFreeThreadID();
-		FString ThreadName = "CPathGenerator Initial, ID: ";
-		ThreadName.AppendInt(ThreadID);
-		GeneratorThreads.push_back(std::make_unique<FCPathAsyncVolumeGenerator>(this, NodesPerThread * CurrentThread, LastIndex, ThreadID, ThreadName));
-		GeneratorThreads.back()->ThreadRef = FRunnableThread::Create(GeneratorThreads.back().get(), *ThreadName);
-		if (GeneratorThreads.back()->ThreadRef)
+		// The game thread drives the whole batch from InitialGenerationUpdate, counted as a single generator
+		BatchGeneratorsLeft = 1;
+		AsyncQueryGenerator = std::make_unique<FCPathAsyncQueryGenerator>(this);
+		AsyncQueryGenerator->Start();
+	}
+	else
+	{
+		if (UseProgressiveGeneration)
 		{
-			ThreadIDs[ThreadID] = true;
+			OrderGenerationFromSeeds();
+			WorkItemCount = GenerationBatchItems.size();
 		}
-		else
+
+		StartGenerationBatch(WorkItemCount, MaxGenerationThreads);
+		BatchGeneratorsLeft = MaxGenerationThreads;
+
+		for (int CurrentThread = 0; CurrentThread < MaxGenerationThreads; CurrentThread++)
 		{
-			GeneratorThreads.pop_back();
+			QueueGenerator(CurrentThread, "CPathGenerator Initial, ID: ", false);
 		}
-
 	}
-	OuterIndexesPerThread = 5 * (5 + OctreeDepth) * FMath::Pow(8.f, MAX_DEPTH - OctreeDepth);
+	// Tuned at depth 3, and scaled by the node count of a full outer tree (8 times more per depth) on both sides of it,
+	// so that deep trees of 64 bit TreeIDs dont put dozens of them on a single thread
+	OuterIndexesPerThread = FMath::Max(FMath::RoundToInt(5 * (5 + OctreeDepth) * FMath::Pow(8.f, 3 - OctreeDepth)), 1);
 	// Setting timer for dynamic generation and garbage collection
 	GetWorld()->GetTimerManager().SetTimer(GenerationTimerHandle, this, &ACPathVolume::InitialGenerationUpdate, 1.f / 60.f, true);
 	return true;
 }
 
+void ACPathVolume::ValidateGenerationSettings()
+{
+	if (OctreeDepth < 0 || OctreeDepth > MAX_DEPTH)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CPATH - Graph Generation:::OctreeDepth must be within 0 and %d, it was clamped"), MAX_DEPTH);
+		OctreeDepth = FMath::Clamp(OctreeDepth, 0, MAX_DEPTH);
+	}
+
+	if (UseLeafBricks && OctreeDepth + 2 > MAX_DEPTH)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CPATH - Graph Generation:::Leaf bricks need OctreeDepth of at most %d, bricks are disabled"), MAX_DEPTH - 2);
+		UseLeafBricks = false;
+	}
+
+	if (UseLeafBricks && UseLinearOctree)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CPATH - Graph Generation:::Linear octree doesnt store leaf bricks, linear octree is disabled"));
+		UseLinearOctree = false;
+	}
+
+	if (UseLazyGeneration && OctreeDepth == 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CPATH - Graph Generation:::Lazy generation needs OctreeDepth above 0, lazy generation is disabled"));
+		UseLazyGeneration = false;
+	}
+
+	if (UseLazyGeneration && DynamicObstaclesUpdateRate <= 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CPATH - Graph Generation:::Lazy generation subdivides trees with dynamic obstacles updates, DynamicObstaclesUpdateRate is set to 3"));
+		DynamicObstaclesUpdateRate = 3;
+	}
+
+	if (UseLazyGeneration && UseLinearOctree)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CPATH - Graph Generation:::Linear octree isnt updated when trees are subdivided lazily, linear octree is disabled"));
+		UseLinearOctree = false;
+	}
+
+	if (AttributeLayers.size() && UseLinearOctree)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CPATH - Graph Generation:::Linear octree nodes have no NodeIndex for attribute layers, linear octree is disabled"));
+		UseLinearOctree = false;
+	}
+
+	if (AttributeLayers.size() && UseSubtreeDeduplication)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CPATH - Graph Generation:::Shared subtrees cant have attributes of their own, subtree deduplication is disabled"));
+		UseSubtreeDeduplication = false;
+	}
+
+	if (UseAsyncOverlapQueries && (UseLeafBricks || UseSparseOuterGrid || UseGeometryRasterizer))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CPATH - Graph Generation:::Async overlap queries cant be used with leaf bricks, sparse outer grid or the geometry rasterizer, async overlap queries are disabled"));
+		UseAsyncOverlapQueries = false;
+	}
+
+	if (UseLayeredOccupancy && (UseLeafBricks || UseLazyGeneration || AttributeLayers.size()))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CPATH - Graph Generation:::Layered occupancy cant be used with leaf bricks, lazy generation or attribute layers, layered occupancy is disabled"));
+		UseLayeredOccupancy = false;
+	}
+
+	if (UseProgressiveGeneration && (UseSparseOuterGrid || UseAsyncOverlapQueries || UseLazyGeneration || UseSubtreeDeduplication || UseFreeSpaceBoxes || UseLinearOctree))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("CPATH - Graph Generation:::Progressive generation cant be used with sparse outer grid, async overlap queries, lazy generation, subtree deduplication, free space boxes or linear octree, progressive generation is disabled"));
+		UseProgressiveGeneration = false;
+	}
+}
+
+FVector ACPathVolume::GetAgentExtent() const
+{
+	return FVector(AgentRadius, AgentRadius, AgentShape == Sphere ? AgentRadius : AgentHalfHeight);
+}
+
+float ACPathVolume::GetLeafVoxelHeight() const
+{
+	return VoxelHeight > 0 ? VoxelHeight : VoxelSize;
+}
+
+void ACPathVolume::AddTraceShapes(std::vector<FCollisionShape>& Shapes, FVector Size) const
+{
+	Shapes.push_back(FCollisionShape::MakeBox(Size / 2.f));
+
+	if (AgentRadius * 2 > Size.X || AgentHalfHeight * 2 > Size.Z)
+	{
+		switch (AgentShape)
+		{
+		case Capsule:
+			Shapes.push_back(FCollisionShape::MakeCapsule(AgentRadius, AgentHalfHeight));
+		case Box:
+			Shapes.push_back(FCollisionShape::MakeBox(FVector(AgentRadius, AgentRadius, AgentHalfHeight)));
+		case Sphere:
+			Shapes.push_back(FCollisionShape::MakeSphere(AgentRadius));
+		default:
+			break;
+		}
+	}
+}
+
 void ACPathVolume::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
@@ -301,8 +532,41 @@ void ACPathVolume::BeginDestroy()
 {
 	Super::BeginDestroy();
 
+	// Stopping all generators first, so that none of them waits for another one that is about to be destroyed
+	for (std::unique_ptr<FCPathAsyncVolumeGenerator>& Generator : GeneratorThreads)
+	{
+		Generator->bStop = true;
+	}
 	GeneratorThreads.clear();
+	GenerationTasks.clear();
+	AsyncQueryGenerator.reset();
+
+	// Trees dont free their children, so this doesnt walk the graph. All child blocks are released at once below.
 	delete[] Octrees;
+	Octrees = nullptr;
+	for (uint32 PageIndex = 0; OuterPages && PageIndex < OuterPageCount; PageIndex++)
+	{
+		delete[] OuterPages[PageIndex].load();
+	}
+	OuterPages.reset();
+	OctreeAllocator.ReleaseAll();
+	LinearOctree.Reset();
+	StaticLayer.Reset();
+	DynamicObstacleShapes.clear();
+	GeometryRasterizer.reset();
+	OuterBrickMasks.clear();
+	LazyTreeStates.reset();
+	LazyLastTouched.reset();
+	ProbedOuterDepths.reset();
+	PathLastUsed.reset();
+	OuterDirtySince.clear();
+	OuterTreeGenerated.reset();
+	AttributeLayers.clear();
+
+	DEC_MEMORY_STAT_BY(STAT_CPathGraphMemory, ReportedStatBytes[0]);
+	DEC_MEMORY_STAT_BY(STAT_CPathLinearOctreeMemory, ReportedStatBytes[1]);
+	DEC_MEMORY_STAT_BY(STAT_CPathPathfindingScratchMemory, ReportedStatBytes[2]);
+	FMemory::Memzero(ReportedStatBytes, sizeof(ReportedStatBytes));
 }
 
 
@@ -336,143 +600,209 @@ inline bool ACPathVolume::IsInBounds(FVector XYZ) const
 	return true;
 }
 
-inline float ACPathVolume::LocalCoordsInt3ToIndex(FVector V) const
+inline uint32 ACPathVolume::LocalCoordsInt3ToIndex(FVector V) const
 {
-	return (V.X * (NodeCount[1] * NodeCount[2])) + (V.Y * NodeCount[2]) + V.Z;
+	return OuterIndexFromCoords(V.X, V.Y, V.Z);
 }
 
-inline float ACPathVolume::GetVoxelSizeByDepth(int Depth) const
+inline FVector ACPathVolume::GetVoxelSizeByDepth(int Depth) const
 {
 #if WITH_EDITOR
-	checkf(Depth <= OctreeDepth, TEXT("CPATH - Graph Generation:::DEPTH was higher than OctreeDepth"));
+	checkf(Depth <= GetMaxTreeIDDepth(), TEXT("CPATH - Graph Generation:::DEPTH was higher than OctreeDepth"));
 #endif
 
 	return LookupTable_VoxelSizeByDepth[Depth];
 }
 
-inline uint32 ACPathVolume::CreateTreeID(uint32 Index, uint32 Depth) const
+inline int ACPathVolume::GetMaxTreeIDDepth() const
+{
+	return UseLeafBricks ? OctreeDepth + 2 : OctreeDepth;
+}
+
+inline CPathTreeID ACPathVolume::CreateTreeID(uint32 Index, uint32 Depth) const
 {
 #if WITH_EDITOR
 	checkf(Depth <= MAX_DEPTH, TEXT("CPATH - Graph Generation:::DEPTH can be up to MAX_DEPTH"));
 #endif		
-	Index |= Depth << DEPTH_0_BITS;
+	return CPathTreeIDCodec::Create(Index, Depth);
+}
 
-	return Index;
+CPathTreeID ACPathVolume::TreeIDFromLocalCoords(uint32 X, uint32 Y, uint32 Z, uint32 Depth) const
+{
+	CPathTreeID TreeID = CreateTreeID(OuterIndexFromCoords(X >> Depth, Y >> Depth, Z >> Depth), Depth);
+	for (uint32 CurrDepth = 1; CurrDepth <= Depth; CurrDepth++)
+	{
+		// Child index bits are X, Z, Y from the most significant one
+		uint32 Shift = Depth - CurrDepth;
+		uint32 ChildIndex = (((X >> Shift) & 1) << 2) | (((Z >> Shift) & 1) << 1) | ((Y >> Shift) & 1);
+		AddChildIndex(TreeID, CurrDepth, ChildIndex);
+	}
+	return TreeID;
 }
 
-inline uint32 ACPathVolume::ExtractOuterIndex(uint32 TreeID) const
+inline uint32 ACPathVolume::ExtractOuterIndex(CPathTreeID TreeID) const
 {
-	return TreeID & DEPTH_0_MASK;
+	return CPathTreeIDCodec::ExtractOuterIndex(TreeID);
 }
 
-inline void ACPathVolume::ReplaceDepth(uint32& TreeID, uint32 NewDepth)
+inline void ACPathVolume::ReplaceDepth(CPathTreeID& TreeID, uint32 NewDepth)
 {
 #if WITH_EDITOR
 	checkf(NewDepth <= MAX_DEPTH, TEXT("CPATH - Graph Generation:::DEPTH can be up to MAX_DEPTH"));
 #endif
 
-	TreeID &= ~DEPTH_MASK;
-	TreeID |= NewDepth << DEPTH_0_BITS;
+	// This also clears child indexes below NewDepth, so that every tree has exactly one TreeID
+	CPathTreeIDCodec::ReplaceDepth(TreeID, NewDepth);
 }
 
-inline uint32 ACPathVolume::ExtractDepth(uint32 TreeID) const
+inline uint32 ACPathVolume::ExtractDepth(CPathTreeID TreeID) const
 {
-	return (TreeID & DEPTH_MASK) >> DEPTH_0_BITS;
+	return CPathTreeIDCodec::ExtractDepth(TreeID);
 }
 
-inline uint32 ACPathVolume::ExtractChildIndex(uint32 TreeID, uint32 Depth) const
+inline uint32 ACPathVolume::ExtractChildIndex(CPathTreeID TreeID, uint32 Depth) const
 {
 #if WITH_EDITOR
 	checkf(Depth <= MAX_DEPTH && Depth > 0, TEXT("CPATH - Graph Generation:::DEPTH can be up to MAX_DEPTH"));
 #endif
-	uint32 DepthOffset = (Depth - 1) * 3 + DEPTH_0_BITS + 2;
-	uint32 Mask = 0x00000007 << DepthOffset;
-
-	return (TreeID & Mask) >> DepthOffset;
+	return CPathTreeIDCodec::ExtractChildIndex(TreeID, Depth);
 }
 
-inline void ACPathVolume::AddChildIndex(uint32& TreeID, uint32 Depth, uint32 ChildIndex)
+inline void ACPathVolume::AddChildIndex(CPathTreeID& TreeID, uint32 Depth, uint32 ChildIndex)
 {
 #if WITH_EDITOR
 	checkf(Depth <= MAX_DEPTH && Depth > 0, TEXT("CPATH - Graph Generation:::DEPTH can be up to MAX_DEPTH"));
 	checkf(ChildIndex < 8, TEXT("CPATH - Graph Generation:::Child Index can be up to 7"));
 #endif
 
-	ChildIndex <<= (Depth - 1) * 3 + DEPTH_0_BITS + 2;
-
-	TreeID |= ChildIndex;
+	TreeID |= (CPathTreeID)ChildIndex << CPathTreeIDCodec::ChildIndexOffset(Depth);
 }
 
-inline FVector ACPathVolume::WorldLocationFromTreeID(uint32 TreeID) const
+inline FVector ACPathVolume::WorldLocationFromTreeID(CPathTreeID TreeID) const
 {
 	uint32 OuterIndex = ExtractOuterIndex(TreeID);
 	uint32 Depth = ExtractDepth(TreeID);
 
 	FVector CurrPosition = StartPosition + GetVoxelSizeByDepth(0) * LocalCoordsInt3FromOuterIndex(OuterIndex);
 
-	for (uint32 CurrDepth = 1; CurrDepth <= Depth; CurrDepth++)
+	CPathTreeIDCodec::ForEachDepth(Depth, [&](uint32 CurrDepth)
 	{
-		CurrPosition += GetVoxelSizeByDepth(CurrDepth) * 0.5f * LookupTable_ChildPositionOffsetMaskByIndex[ExtractChildIndex(TreeID, CurrDepth)];
-	}
+		CurrPosition += GetVoxelSizeByDepth(CurrDepth) * 0.5f * LookupTable_ChildPositionOffsetMaskByIndex[CPathTreeIDCodec::ExtractChildIndex(TreeID, CurrDepth)];
+		return true;
+	});
 
 	return CurrPosition;
 }
 
 inline FVector ACPathVolume::LocalCoordsInt3FromOuterIndex(uint32 OuterIndex) const
 {
-	uint32 X = OuterIndex / (NodeCount[1] * NodeCount[2]);
-	OuterIndex -= X * NodeCount[1] * NodeCount[2];
-	return FVector(X, OuterIndex / NodeCount[2], OuterIndex % NodeCount[2]);
+	uint32 X, Y, Z;
+	CoordsFromOuterIndex(OuterIndex, X, Y, Z);
+	return FVector(X, Y, Z);
 }
 
-inline void ACPathVolume::ReplaceChildIndex(uint32& TreeID, uint32 Depth, uint32 ChildIndex)
+bool ACPathVolume::IsOuterIndexInVolume(uint32 OuterIndex) const
 {
-#if WITH_EDITOR
-	checkf(Depth <= MAX_DEPTH && Depth > 0, TEXT("CPATH - Graph Generation:::DEPTH can be up to MAX_DEPTH"));
-	checkf(ChildIndex < 8, TEXT("CPATH - Graph Generation:::Child Index can be up to 7"));
-#endif
+	uint32 X, Y, Z;
+	CoordsFromOuterIndex(OuterIndex, X, Y, Z);
+	return X < NodeCount[0] && Y < NodeCount[1] && Z < NodeCount[2];
+}
+
+static thread_local bool ThreadReachedUngenerated = false;
+
+// Coarse outer trees reached since the last ConsumeThreadReachedUngenerated, only with UseLazyGeneration
+static thread_local std::vector<uint32> ThreadReachedCoarseTrees;
+
+inline bool ACPathVolume::IsOuterTreeGenerated(uint32 OuterIndex) const
+{
+	if (!OuterTreeGenerated || OuterTreeGenerated[OuterIndex].load(std::memory_order_acquire))
+		return true;
+
+	ThreadReachedUngenerated = true;
+	return false;
+}
+
+bool ACPathVolume::ConsumeThreadReachedUngenerated(std::vector<uint32>* OutCoarseTrees)
+{
+	bool Reached = ThreadReachedUngenerated;
+	ThreadReachedUngenerated = false;
+	if (OutCoarseTrees)
+	{
+		std::sort(ThreadReachedCoarseTrees.begin(), ThreadReachedCoarseTrees.end());
+		ThreadReachedCoarseTrees.erase(std::unique(ThreadReachedCoarseTrees.begin(), ThreadReachedCoarseTrees.end()), ThreadReachedCoarseTrees.end());
+		OutCoarseTrees->swap(ThreadReachedCoarseTrees);
+	}
+	ThreadReachedCoarseTrees.clear();
+	return Reached;
+}
+
+bool ACPathVolume::IsAnyOuterTreeAwaitingRefinement(const std::vector<uint32>& OuterIndexes) const
+{
+	if (!LazyTreeStates)
+		return false;
 
-	uint32 DepthOffset = (Depth - 1) * 3 + DEPTH_0_BITS + 2;
+	// Trees that were evicted back to LazyCoarse meanwhile are not waited for, the next search touches them again
+	for (uint32 OuterIndex : OuterIndexes)
+	{
+		if (LazyTreeStates[OuterIndex].load(std::memory_order_acquire) == LazyTouched)
+			return true;
+	}
+	return false;
+}
+
+bool ACPathVolume::IsGeneratedAt(FVector WorldLocation) const
+{
+	if (InitialGenerationCompleteAtom.load())
+		return true;
+	if (!OuterTreeGenerated)
+		return false;
 
-	// Clearing previous child index
-	TreeID &= ~(0x00000007 << DepthOffset);
+	FVector XYZ = WorldLocationToLocalCoordsInt3(WorldLocation);
+	return !IsInBounds(XYZ) || OuterTreeGenerated[LocalCoordsInt3ToIndex(XYZ)].load(std::memory_order_acquire);
+}
 
-	ChildIndex <<= DepthOffset;
-	TreeID |= ChildIndex;
+void ACPathVolume::MarkOuterTreeGenerated(uint32 OuterIndex)
+{
+	if (OuterTreeGenerated)
+		OuterTreeGenerated[OuterIndex].store(true, std::memory_order_release);
 }
 
-inline void ACPathVolume::ReplaceChildIndexAndDepth(uint32& TreeID, uint32 Depth, uint32 ChildIndex)
+inline void ACPathVolume::ReplaceChildIndex(CPathTreeID& TreeID, uint32 Depth, uint32 ChildIndex)
 {
 #if WITH_EDITOR
 	checkf(Depth <= MAX_DEPTH && Depth > 0, TEXT("CPATH - Graph Generation:::DEPTH can be up to MAX_DEPTH"));
 	checkf(ChildIndex < 8, TEXT("CPATH - Graph Generation:::Child Index can be up to 7"));
 #endif
 
-	uint32 DepthOffset = (Depth - 1) * 3 + DEPTH_0_BITS + 2;
+	CPathTreeIDCodec::ReplaceChildIndex(TreeID, Depth, ChildIndex);
+}
 
-	// Clearing previous child index
-	TreeID &= ~(0x00000007 << DepthOffset);
+inline void ACPathVolume::ReplaceChildIndexAndDepth(CPathTreeID& TreeID, uint32 Depth, uint32 ChildIndex)
+{
+#if WITH_EDITOR
+	checkf(Depth <= MAX_DEPTH && Depth > 0, TEXT("CPATH - Graph Generation:::DEPTH can be up to MAX_DEPTH"));
+	checkf(ChildIndex < 8, TEXT("CPATH - Graph Generation:::Child Index can be up to 7"));
+#endif
 
-	ChildIndex <<= DepthOffset;
-	TreeID |= ChildIndex;
-	ReplaceDepth(TreeID, Depth);
+	CPathTreeIDCodec::ReplaceChildIndex(TreeID, Depth, ChildIndex);
+	CPathTreeIDCodec::ReplaceDepth(TreeID, Depth);
 }
 
-inline void ACPathVolume::GetAllSubtrees(uint32 TreeID, std::vector<uint32>& Container)
+inline void ACPathVolume::GetAllSubtrees(CPathTreeID TreeID, std::vector<CPathTreeID>& Container)
 {
 	uint32 Depth = 0;
 	CPathOctree* Tree = FindTreeByID(TreeID, Depth);
 	GetAllSubtreesRec(TreeID, Tree, Container, Depth);
 }
 
-void ACPathVolume::GetAllSubtreesRec(uint32 TreeID, CPathOctree* Tree, std::vector<uint32>& Container, uint32 Depth)
+void ACPathVolume::GetAllSubtreesRec(CPathTreeID TreeID, CPathOctree* Tree, std::vector<CPathTreeID>& Container, uint32 Depth)
 {
 	if (Tree->Children)
 	{
 		Depth++;
 		for (uint32 ChildID = 0; ChildID < 8; ChildID++)
 		{
-			uint32 ID = TreeID;
+			CPathTreeID ID = TreeID;
 			ReplaceChildIndexAndDepth(ID, Depth, ChildID);
 			GetAllSubtreesRec(ID, &Tree->Children[ChildID], Container, Depth);
 			Container.push_back(ID);
@@ -480,61 +810,136 @@ void ACPathVolume::GetAllSubtreesRec(uint32 TreeID, CPathOctree* Tree, std::vect
 	}
 }
 
-inline CPathOctree* ACPathVolume::FindTreeByID(uint32 TreeID)
+inline CPathOctree* ACPathVolume::GetOuterTree(uint32 OuterIndex)
 {
-	uint32 Depth = ExtractDepth(TreeID);
-	CPathOctree* CurrTree = &Octrees[ExtractOuterIndex(TreeID)];
+	if (!UseSparseOuterGrid)
+		return &Octrees[OuterIndex];
 
+	uint32 PageIndex, IndexInPage;
+	OuterPageFromIndex(OuterIndex, PageIndex, IndexInPage);
+	CPathOctree* Page = OuterPages[PageIndex].load(std::memory_order_acquire);
+	return Page ? &Page[IndexInPage] : &FreeOuterTree;
+}
 
-	for (uint32 CurrDepth = 1; CurrDepth <= Depth; CurrDepth++)
+CPathOctree* ACPathVolume::GetOrCreateOuterTree(uint32 OuterIndex)
+{
+	if (!UseSparseOuterGrid)
+		return &Octrees[OuterIndex];
+
+	uint32 PageIndex, IndexInPage;
+	OuterPageFromIndex(OuterIndex, PageIndex, IndexInPage);
+	CPathOctree* Page = OuterPages[PageIndex].load(std::memory_order_acquire);
+	if (!Page)
 	{
-		// Child not found, returning the deepest found parent
-		if (!CurrTree->Children)
+		// Multiple generators can need the same page at once
+		FScopeLock Lock(&OuterPagesLock);
+		Page = OuterPages[PageIndex].load(std::memory_order_acquire);
+		if (!Page)
 		{
-			break;
+			// Until they are generated, trees of a new page are free, same as when the page didnt exist
+			Page = new CPathOctree[OuterPageSize * OuterPageSize * OuterPageSize];
+			for (uint32 i = 0; i < OuterPageSize * OuterPageSize * OuterPageSize; i++)
+			{
+				Page[i].SetIsFree(true);
+			}
+
+			// Cells of the page outside of the volume keep an invalid NodeIndex
+			FIntVector FirstCoords, CellCount;
+			GetOuterPageCells(PageIndex, FirstCoords, CellCount);
+			for (int X = 0; X < CellCount.X; X++)
+			{
+				for (int Y = 0; Y < CellCount.Y; Y++)
+				{
+					for (int Z = 0; Z < CellCount.Z; Z++)
+					{
+						Page[(X * OuterPageSize + Y) * OuterPageSize + Z].NodeIndex = OuterIndexFromCoords(FirstCoords.X + X, FirstCoords.Y + Y, FirstCoords.Z + Z);
+					}
+				}
+			}
+			OuterPages[PageIndex].store(Page, std::memory_order_release);
+			OuterPagesAllocated++;
 		}
+	}
+	return &Page[IndexInPage];
+}
+
+inline void ACPathVolume::OuterPageFromIndex(uint32 OuterIndex, uint32& PageIndex, uint32& IndexInPage) const
+{
+	uint32 X, Y, Z;
+	CoordsFromOuterIndex(OuterIndex, X, Y, Z);
 
-		CurrTree = &CurrTree->Children[ExtractChildIndex(TreeID, CurrDepth)];
+	PageIndex = ((X / OuterPageSize) * OuterPageCountXYZ[1] + Y / OuterPageSize) * OuterPageCountXYZ[2] + Z / OuterPageSize;
+	IndexInPage = ((X % OuterPageSize) * OuterPageSize + Y % OuterPageSize) * OuterPageSize + Z % OuterPageSize;
+}
+
+void ACPathVolume::GetOuterPageCells(uint32 PageIndex, FIntVector& FirstCoords, FIntVector& CellCount) const
+{
+	uint32 PageX = PageIndex / (OuterPageCountXYZ[1] * OuterPageCountXYZ[2]);
+	PageIndex -= PageX * OuterPageCountXYZ[1] * OuterPageCountXYZ[2];
+	FirstCoords = FIntVector(PageX, PageIndex / OuterPageCountXYZ[2], PageIndex % OuterPageCountXYZ[2]) * OuterPageSize;
+	for (int i = 0; i < 3; i++)
+	{
+		CellCount[i] = FMath::Min(OuterPageSize, NodeCount[i] - FirstCoords[i]);
 	}
+}
+
+inline CPathOctree* ACPathVolume::FindTreeByID(CPathTreeID TreeID)
+{
+	uint32 Depth = ExtractDepth(TreeID);
+	CPathOctree* CurrTree = GetOuterTree(ExtractOuterIndex(TreeID));
+
+	CPathTreeIDCodec::ForEachDepth(Depth, [&](uint32 CurrDepth)
+	{
+		// Child not found, returning the deepest found parent
+		if (!CurrTree->Children)
+			return false;
+
+		CurrTree = &CurrTree->Children[CPathTreeIDCodec::ExtractChildIndex(TreeID, CurrDepth)];
+		return true;
+	});
 	return CurrTree;
 }
 
-CPathOctree* ACPathVolume::FindTreeByID(uint32 TreeID, uint32& DepthReached)
+CPathOctree* ACPathVolume::FindTreeByID(CPathTreeID TreeID, uint32& DepthReached)
 {
 	uint32 Depth = ExtractDepth(TreeID);
-	CPathOctree* CurrTree = &Octrees[ExtractOuterIndex(TreeID)];
+	CPathOctree* CurrTree = GetOuterTree(ExtractOuterIndex(TreeID));
 	DepthReached = 0;
 
-	for (uint32 CurrDepth = 1; CurrDepth <= Depth; CurrDepth++)
+	CPathTreeIDCodec::ForEachDepth(Depth, [&](uint32 CurrDepth)
 	{
 		// Child not found, returning the deepest found parent
 		if (!CurrTree->Children)
-		{
-			break;
-		}
+			return false;
 
-		CurrTree = &CurrTree->Children[ExtractChildIndex(TreeID, CurrDepth)];
+		CurrTree = &CurrTree->Children[CPathTreeIDCodec::ExtractChildIndex(TreeID, CurrDepth)];
 		DepthReached = CurrDepth;
-	}
+		return true;
+	});
 	return CurrTree;
 }
 
-CPathOctree* ACPathVolume::FindTreeByWorldLocation(FVector WorldLocation, uint32& TreeID)
+CPathOctree* ACPathVolume::FindTreeByWorldLocation(FVector WorldLocation, CPathTreeID& TreeID)
 {
 	FVector LocalCoords = WorldLocationToLocalCoordsInt3(WorldLocation);
 	if (!IsInBounds(LocalCoords))
 		return nullptr;
 
 	TreeID = LocalCoordsInt3ToIndex(LocalCoords);
-	return &Octrees[TreeID];
+	if (!IsOuterTreeGenerated(TreeID))
+		return nullptr;
+	return GetOuterTree(TreeID);
 }
 
-inline CPathOctree* ACPathVolume::FindLeafByWorldLocation(FVector WorldLocation, uint32& TreeID, bool MustBeFree)
+inline CPathOctree* ACPathVolume::FindLeafByWorldLocation(FVector WorldLocation, CPathTreeID& TreeID, bool MustBeFree)
 {
 	CPathOctree* CurrentTree = FindTreeByWorldLocation(WorldLocation, TreeID);
 	CPathOctree* FoundLeaf = nullptr;
 	if (CurrentTree)
 	{
+		if (UseLazyGeneration)
+			TouchOuterTree(ExtractOuterIndex(TreeID));
+
 		FVector RelativeLocation = WorldLocation - GetOuterTreeWorldLocation(TreeID);
 
 		if (CurrentTree->Children)
@@ -543,8 +948,28 @@ inline CPathOctree* ACPathVolume::FindLeafByWorldLocation(FVector WorldLocation,
 			FoundLeaf = CurrentTree;
 	}
 
+	bool IsFree = FoundLeaf && FoundLeaf->GetIsFree();
+
+	// Going into the brick of an occupied leaf, TreeID becomes the sub-voxel that contains WorldLocation
+	if (FoundLeaf && !IsFree && UseLeafBricks && ExtractDepth(TreeID) == (uint32)OctreeDepth)
+	{
+		uint64* BrickMask = FindBrickMask(TreeID);
+		if (BrickMask && *BrickMask)
+		{
+			FVector SubVoxelSize = GetVoxelSizeByDepth(GetMaxTreeIDDepth());
+			FVector BrickCorner = WorldLocationFromTreeID(TreeID) - GetVoxelSizeByDepth(OctreeDepth) / 2.f;
+			FVector Coords = (WorldLocation - BrickCorner) / SubVoxelSize;
+			uint32 Bit = BrickBitFromCoords(FMath::Clamp(FMath::FloorToInt(Coords.X), 0, 3),
+				FMath::Clamp(FMath::FloorToInt(Coords.Y), 0, 3),
+				FMath::Clamp(FMath::FloorToInt(Coords.Z), 0, 3));
+
+			TreeID = CreateBrickVoxelID(TreeID, Bit);
+			IsFree = (*BrickMask >> Bit) & 1;
+		}
+	}
+
 	// Checking if the found leaf is free, and if not returning its free neighbour
-	if (MustBeFree && FoundLeaf && !FoundLeaf->GetIsFree())
+	if (MustBeFree && FoundLeaf && !IsFree)
 	{
 		/*CurrentTree = GetParentTree(TreeID);
 		if (CurrentTree)
@@ -563,14 +988,14 @@ inline CPathOctree* ACPathVolume::FindLeafByWorldLocation(FVector WorldLocation,
 	return FoundLeaf;
 }
 
-CPathOctree* ACPathVolume::FindClosestFreeLeaf(FVector WorldLocation, uint32& TreeID, float SearchRange)
+CPathOctree* ACPathVolume::FindClosestFreeLeaf(FVector WorldLocation, CPathTreeID& TreeID, float SearchRange)
 {
-	uint32 OriginTreeID = 0xFFFFFFFF;
+	CPathTreeID OriginTreeID = CPATH_INVALID_TREEID;
 	CPathOctree* OriginTree = FindLeafByWorldLocation(WorldLocation, OriginTreeID, false);
 	if (!OriginTree)
 		return nullptr;
 
-	if (OriginTree->GetIsFree())
+	if (IsNodeFree(OriginTreeID))
 	{
 		TreeID = OriginTreeID;
 		return OriginTree;
@@ -580,7 +1005,7 @@ CPathOctree* ACPathVolume::FindClosestFreeLeaf(FVector WorldLocation, uint32& Tr
 	{
 		uint32 Depth = FMath::Max((uint32)1, ExtractDepth(OriginTreeID) - 1);
 		Depth = FMath::Min(Depth, (uint32)OctreeDepth);
-		SearchRange = GetVoxelSizeByDepth(Depth);
+		SearchRange = GetVoxelSizeByDepth(Depth).GetMax();
 	}
 
 	// Nodes visited OR added to priority queue
@@ -600,10 +1025,10 @@ CPathOctree* ACPathVolume::FindClosestFreeLeaf(FVector WorldLocation, uint32& Tr
 	std::vector<CPathAStarNode> StartNeighbours = FindFreeNeighbourLeafs(StartNode);
 	for (CPathAStarNode NewNode : StartNeighbours)
 	{		
-		NewNode.WorldLocation = WorldLocationFromTreeID(NewNode.TreeID);
+		NewNode.WorldLocation = GetSearchNodeLocation(NewNode.TreeID, WorldLocation);
 
 		// Fitness function here is distance from WorldLocation - The voxel extent, cause we want distance to the border of the voxel, not to it's center
-		NewNode.FitnessResult = FVector::Distance(NewNode.WorldLocation, WorldLocation) - GetVoxelSizeByDepth(ExtractDepth(NewNode.TreeID)) / 2.f;
+		NewNode.FitnessResult = FVector::Distance(NewNode.WorldLocation, WorldLocation) - GetVoxelSizeByDepth(ExtractDepth(NewNode.TreeID)).GetMin() / 2.f;
 
 		VisitedNodes.insert(NewNode);
 		PqNeighbours.push(NewNode);
@@ -614,7 +1039,7 @@ CPathOctree* ACPathVolume::FindClosestFreeLeaf(FVector WorldLocation, uint32& Tr
 		CPathAStarNode CurrentNode = PqNeighbours.top();
 		PqNeighbours.pop();
 		CPathOctree* Tree = FindTreeByID(CurrentNode.TreeID);
-		if (Tree->GetIsFree())
+		if (IsNodeFree(CurrentNode.TreeID))
 		{
 			if (!GetWorld()->LineTraceTestByChannel(WorldLocation, CurrentNode.WorldLocation, TraceChannel))
 			{
@@ -631,9 +1056,9 @@ CPathOctree* ACPathVolume::FindClosestFreeLeaf(FVector WorldLocation, uint32& Tr
 			// We dont want to revisit nodes
 			if (!VisitedNodes.count(NewNode))
 			{
-				NewNode.WorldLocation = WorldLocationFromTreeID(NewNode.TreeID);
+				NewNode.WorldLocation = GetSearchNodeLocation(NewNode.TreeID, WorldLocation);
 				// Fitness function here is distance from WorldLocation - The voxel extent, cause we want distance to the border of the voxel, not to it's center
-				NewNode.FitnessResult = FVector::Distance(NewNode.WorldLocation, WorldLocation) - GetVoxelSizeByDepth(ExtractDepth(NewNode.TreeID)) / 2.f;
+				NewNode.FitnessResult = FVector::Distance(NewNode.WorldLocation, WorldLocation) - GetVoxelSizeByDepth(ExtractDepth(NewNode.TreeID)).GetMin() / 2.f;
 
 				VisitedNodes.insert(NewNode);
 				// Search range condition
@@ -653,7 +1078,7 @@ CPathOctree* ACPathVolume::FindClosestFreeLeaf(FVector WorldLocation, uint32& Tr
 		CPathAStarNode CurrentNode = Pq.top();
 		Pq.pop();
 		CPathOctree* Tree = FindTreeByID(CurrentNode.TreeID);
-		if (Tree->GetIsFree())
+		if (IsNodeFree(CurrentNode.TreeID))
 		{
 			if (!GetWorld()->LineTraceTestByChannel(WorldLocation, CurrentNode.WorldLocation, TraceChannel))
 			{
@@ -671,9 +1096,9 @@ CPathOctree* ACPathVolume::FindClosestFreeLeaf(FVector WorldLocation, uint32& Tr
 			// We dont want to revisit nodes
 			if (!VisitedNodes.count(NewNode))
 			{
-				NewNode.WorldLocation = WorldLocationFromTreeID(NewNode.TreeID);
+				NewNode.WorldLocation = GetSearchNodeLocation(NewNode.TreeID, WorldLocation);
 				// Fitness function here is distance from WorldLocation - The voxel extent, cause we want distance to the border of the voxel, not to it's center
-				NewNode.FitnessResult = FVector::Distance(NewNode.WorldLocation, WorldLocation) - GetVoxelSizeByDepth(ExtractDepth(NewNode.TreeID)) / 2.f;
+				NewNode.FitnessResult = FVector::Distance(NewNode.WorldLocation, WorldLocation) - GetVoxelSizeByDepth(ExtractDepth(NewNode.TreeID)).GetMin() / 2.f;
 
 				VisitedNodes.insert(NewNode);
 				// Search range condition
@@ -687,7 +1112,7 @@ CPathOctree* ACPathVolume::FindClosestFreeLeaf(FVector WorldLocation, uint32& Tr
 	return nullptr;
 }
 
-CPathOctree* ACPathVolume::FindLeafRecursive(FVector RelativeLocation, uint32& TreeID, uint32 CurrentDepth, CPathOctree* CurrentTree)
+CPathOctree* ACPathVolume::FindLeafRecursive(FVector RelativeLocation, CPathTreeID& TreeID, uint32 CurrentDepth, CPathOctree* CurrentTree)
 {
 	CurrentDepth += 1;
 
@@ -718,14 +1143,14 @@ CPathOctree* ACPathVolume::FindLeafRecursive(FVector RelativeLocation, uint32& T
 	return nullptr;
 }
 
-FVector ACPathVolume::GetOuterTreeWorldLocation(uint32 TreeID) const
+FVector ACPathVolume::GetOuterTreeWorldLocation(CPathTreeID TreeID) const
 {
 	FVector LocalCoords = LocalCoordsInt3FromOuterIndex(ExtractOuterIndex(TreeID));
 	LocalCoords *= GetVoxelSizeByDepth(0);
 	return StartPosition + LocalCoords;
 }
 
-inline CPathOctree* ACPathVolume::GetParentTree(uint32 TreeId)
+inline CPathOctree* ACPathVolume::GetParentTree(CPathTreeID TreeId)
 {
 	uint32 Depth = ExtractDepth(TreeId);
 	if (Depth)
@@ -738,7 +1163,7 @@ inline CPathOctree* ACPathVolume::GetParentTree(uint32 TreeId)
 
 
 
-CPathOctree* ACPathVolume::FindNeighbourByID(uint32 TreeID, ENeighbourDirection Direction, uint32& NeighbourID)
+CPathOctree* ACPathVolume::FindNeighbourByID(CPathTreeID TreeID, ENeighbourDirection Direction, CPathTreeID& NeighbourID)
 {
 
 	// Depth 0, getting neighbour from Octrees
@@ -751,8 +1176,11 @@ CPathOctree* ACPathVolume::FindNeighbourByID(uint32 TreeID, ENeighbourDirection
 		if (!IsInBounds(NeighbourLocalCoords))
 			return nullptr;
 
+		// Initial generators may still be writing it with UseProgressiveGeneration, so its treated as if it was outside of the volume
 		NeighbourID = LocalCoordsInt3ToIndex(NeighbourLocalCoords);
-		return &Octrees[NeighbourID];
+		if (!IsOuterTreeGenerated(NeighbourID))
+			return nullptr;
+		return GetOuterTree(NeighbourID);
 	}
 
 	uint8 ChildIndex = ExtractChildIndex(TreeID, Depth);
@@ -792,13 +1220,33 @@ CPathOctree* ACPathVolume::FindNeighbourByID(uint32 TreeID, ENeighbourDirection
 	return nullptr;
 }
 
-std::vector<uint32> ACPathVolume::FindNeighbourLeafs(uint32 TreeID, bool MustBeFree)
+std::vector<CPathTreeID> ACPathVolume::FindNeighbourLeafs(CPathTreeID TreeID, bool MustBeFree)
 {
-	std::vector<uint32> FreeNeighbours;
+	std::vector<CPathTreeID> FreeNeighbours;
+
+	if (UseLeafBricks)
+	{
+		if (MustBeFree)
+		{
+			CPathAStarNode Node(TreeID);
+			for (const CPathAStarNode& Neighbour : FindFreeNeighbourLeafs(Node))
+			{
+				FreeNeighbours.push_back(Neighbour.TreeID);
+			}
+			return FreeNeighbours;
+		}
+
+		// Occupied leafs are returned whole, sub-voxels only neighbour other sub-voxels
+		if (IsBrickVoxel(TreeID))
+		{
+			FindBrickNeighbours(TreeID, &FreeNeighbours);
+			return FreeNeighbours;
+		}
+	}
 
 	for (int Direction = 0; Direction < 6; Direction++)
 	{
-		uint32 NeighbourID = 0;
+		CPathTreeID NeighbourID = 0;
 		CPathOctree* Neighbour = FindNeighbourByID(TreeID, (ENeighbourDirection)Direction, NeighbourID);
 		if (Neighbour)
 		{
@@ -820,206 +1268,1726 @@ std::vector<CPathAStarNode> ACPathVolume::FindFreeNeighbourLeafs(CPathAStarNode&
 {
 	std::vector<CPathAStarNode> FreeNeighbours;
 
-	for (int Direction = 0; Direction < 6; Direction++)
+	uint32 BoxIndex = FindFreeBox(Node.TreeID);
+	if (BoxIndex)
 	{
-		uint32 NeighbourID = 0;
-		CPathOctree* Neighbour = FindNeighbourByID(Node.TreeID, (ENeighbourDirection)Direction, NeighbourID);
-		if (Neighbour)
+		FindFreeBoxNeighbours(BoxIndex - 1, &FreeNeighbours);
+	}
+	else if (UseLinearOctree && LinearOctree.IsBuilt())
+	{
+		FreeNeighbours = FindFreeNeighbourLeafsLinear(Node);
+	}
+	else if (IsBrickVoxel(Node.TreeID))
+	{
+		FindFreeBrickNeighbours(Node.TreeID, &FreeNeighbours);
+	}
+	else
+	{
+		if (UseLazyGeneration)
+			TouchOuterTree(ExtractOuterIndex(Node.TreeID));
+
+		for (int Direction = 0; Direction < 6; Direction++)
 		{
-			if (Neighbour->GetIsFree())
-				FreeNeighbours.push_back(CPathAStarNode(NeighbourID, Neighbour->Data));
-			else if (Neighbour->Children)
-			{
-				FindLeafsOnSide(Neighbour, NeighbourID, (ENeighbourDirection)LookupTable_OppositeSide[Direction], &FreeNeighbours);
-			}
+			AddFreeNeighboursOnSide(Node.TreeID, (ENeighbourDirection)Direction, &FreeNeighbours);
 		}
 	}
 
+	// Trees in a box are replaced by the box, a box can be adjacent through many trees but is returned once
+	if (FreeBoxes.size())
+	{
+		for (CPathAStarNode& Neighbour : FreeNeighbours)
+		{
+			Neighbour.TreeID = GetSearchNodeID(Neighbour.TreeID);
+		}
+
+		// A big box can have hundreds of trees on its faces, so duplicates are removed by sorting
+		std::sort(FreeNeighbours.begin(), FreeNeighbours.end(), [](const CPathAStarNode& A, const CPathAStarNode& B) { return A.TreeID < B.TreeID; });
+		FreeNeighbours.erase(std::unique(FreeNeighbours.begin(), FreeNeighbours.end()), FreeNeighbours.end());
+	}
 
 	return FreeNeighbours;
 }
 
+void ACPathVolume::AddFreeNeighboursOnSide(CPathTreeID TreeID, ENeighbourDirection Direction, std::vector<CPathAStarNode>* Vector)
+{
+	CPathTreeID NeighbourID = 0;
+	CPathOctree* Neighbour = FindNeighbourByID(TreeID, Direction, NeighbourID);
+	if (!Neighbour)
+		return;
+
+	// Only queues a coarse outer tree to be subdivided, Neighbour stays as it is
+	if (UseLazyGeneration && ExtractDepth(NeighbourID) == 0)
+		TouchOuterTree(ExtractOuterIndex(NeighbourID));
+
+	if (Neighbour->GetIsFree())
+		Vector->push_back(CPathAStarNode(NeighbourID, *Neighbour));
+	else if (Neighbour->Children)
+	{
+		FindLeafsOnSide(Neighbour, NeighbourID, (ENeighbourDirection)LookupTable_OppositeSide[Direction], Vector);
+	}
+	else if (UseLeafBricks && ExtractDepth(NeighbourID) == (uint32)OctreeDepth)
+	{
+		uint64* BrickMask = FindBrickMask(NeighbourID);
+		if (BrickMask)
+			AddFreeBrickVoxelsOnSide(NeighbourID, *BrickMask, *Neighbour, (ENeighbourDirection)LookupTable_OppositeSide[Direction], Vector);
+	}
+}
+
+void ACPathVolume::FindLeafsOnSide(CPathTreeID TreeID, ENeighbourDirection Side, std::vector<CPathTreeID>* Vector, bool MustBeFree)
+{
+	uint32 TempDepthReached;
+	FindLeafsOnSide(FindTreeByID(TreeID, TempDepthReached), TreeID, Side, Vector, MustBeFree);
+}
+
+void ACPathVolume::FindLeafsOnSide(CPathOctree* Tree, CPathTreeID TreeID, ENeighbourDirection Side, std::vector<CPathTreeID>* Vector, bool MustBeFree)
+{
+#if WITH_EDITOR
+	checkf(Tree->Children, TEXT("CPATH - FindAllLeafsOnSide, requested tree has no children"));
+#endif
+	uint8 NewDepth = ExtractDepth(TreeID) + 1;
+	for (uint8 i = 0; i < 4; i++)
+	{
+		uint8 ChildIndex = LookupTable_ChildrenOnSide[Side][i];
+		CPathOctree* Child = &Tree->Children[ChildIndex];
+		CPathTreeID ChildTreeID = TreeID;
+		ReplaceChildIndexAndDepth(ChildTreeID, NewDepth, ChildIndex);
+		if (Child->Children)
+			FindLeafsOnSide(Child, ChildTreeID, Side, Vector, MustBeFree);
+		else
+		{
+			if (Child->GetIsFree() || !MustBeFree)
+				Vector->push_back(ChildTreeID);
+		}
+	}
+}
+
+void ACPathVolume::FindLeafsOnSide(CPathOctree* Tree, CPathTreeID TreeID, ENeighbourDirection Side, std::vector<CPathAStarNode>* Vector, bool MustBeFree)
+{
+#if WITH_EDITOR
+	checkf(Tree->Children, TEXT("CPATH - FindAllLeafsOnSide, requested tree has no children"));
+#endif
+	uint8 NewDepth = ExtractDepth(TreeID) + 1;
+	for (uint8 i = 0; i < 4; i++)
+	{
+		uint8 ChildIndex = LookupTable_ChildrenOnSide[Side][i];
+		CPathOctree* Child = &Tree->Children[ChildIndex];
+		CPathTreeID ChildTreeID = TreeID;
+		ReplaceChildIndexAndDepth(ChildTreeID, NewDepth, ChildIndex);
+		if (Child->Children)
+			FindLeafsOnSide(Child, ChildTreeID, Side, Vector, MustBeFree);
+		else
+		{
+			if (Child->GetIsFree() || !MustBeFree)
+				Vector->push_back(CPathAStarNode(ChildTreeID, *Child));
+			else if (UseLeafBricks && NewDepth == OctreeDepth)
+			{
+				uint64 BrickMask = CPathOctreeAllocator::GetBlockPayload<uint64>(Tree->Children)[ChildIndex];
+				AddFreeBrickVoxelsOnSide(ChildTreeID, BrickMask, *Child, Side, Vector);
+			}
+		}
+	}
+}
+
+inline bool ACPathVolume::IsBrickVoxel(CPathTreeID TreeID) const
+{
+	return UseLeafBricks && ExtractDepth(TreeID) > (uint32)OctreeDepth;
+}
+
+uint64* ACPathVolume::FindBrickMask(CPathTreeID LeafID)
+{
+	if (!UseLeafBricks)
+		return nullptr;
+
+	if (OctreeDepth == 0)
+		return &OuterBrickMasks[ExtractOuterIndex(LeafID)];
+
+	// Masks are stored after the block of children that the leaf belongs to
+	CPathTreeID ParentID = LeafID;
+	ReplaceDepth(ParentID, OctreeDepth - 1);
+	uint32 DepthReached;
+	CPathOctree* Parent = FindTreeByID(ParentID, DepthReached);
+	if (DepthReached != (uint32)OctreeDepth - 1 || !Parent->Children)
+		return nullptr;
+
+	return CPathOctreeAllocator::GetBlockPayload<uint64>(Parent->Children) + ExtractChildIndex(LeafID, OctreeDepth);
+}
+
+bool ACPathVolume::IsBrickVoxelFree(CPathTreeID TreeID)
+{
+	CPathTreeID LeafID = TreeID;
+	ReplaceDepth(LeafID, OctreeDepth);
+	uint64* BrickMask = FindBrickMask(LeafID);
+	return BrickMask && ((*BrickMask >> ExtractBrickBit(TreeID)) & 1);
+}
+
+bool ACPathVolume::IsNodeFree(CPathTreeID TreeID)
+{
+	if (IsBrickVoxel(TreeID))
+		return IsBrickVoxelFree(TreeID);
+
+	return FindTreeByID(TreeID)->GetIsFree();
+}
+
+inline CPathTreeID ACPathVolume::CreateBrickVoxelID(CPathTreeID LeafID, uint32 Bit)
+{
+	ReplaceChildIndexAndDepth(LeafID, OctreeDepth + 1, Bit >> 3);
+	ReplaceChildIndexAndDepth(LeafID, OctreeDepth + 2, Bit & 7);
+	return LeafID;
+}
+
+inline uint32 ACPathVolume::ExtractBrickBit(CPathTreeID TreeID) const
+{
+	return ExtractChildIndex(TreeID, OctreeDepth + 1) * 8 + ExtractChildIndex(TreeID, OctreeDepth + 2);
+}
+
+// Child indexes use X as the 3rd bit, Z as the 2nd and Y as the 1st. The first child index picks the half of the brick, the second one picks the sub-voxel in that half.
+inline uint32 ACPathVolume::BrickBitFromCoords(uint32 X, uint32 Y, uint32 Z)
+{
+	uint32 FirstIndex = ((X >> 1) << 2) | ((Z >> 1) << 1) | (Y >> 1);
+	uint32 SecondIndex = ((X & 1) << 2) | ((Z & 1) << 1) | (Y & 1);
+	return FirstIndex * 8 + SecondIndex;
+}
+
+inline void ACPathVolume::BrickCoordsFromBit(uint32 Bit, uint32& X, uint32& Y, uint32& Z)
+{
+	uint32 FirstIndex = Bit >> 3;
+	uint32 SecondIndex = Bit & 7;
+	X = ((FirstIndex >> 2) & 1) * 2 + ((SecondIndex >> 2) & 1);
+	Z = ((FirstIndex >> 1) & 1) * 2 + ((SecondIndex >> 1) & 1);
+	Y = (FirstIndex & 1) * 2 + (SecondIndex & 1);
+}
+
+void ACPathVolume::AddFreeBrickVoxelsOnSide(CPathTreeID LeafID, uint64 BrickMask, const CPathOctree& Leaf, ENeighbourDirection Side, std::vector<CPathAStarNode>* Vector)
+{
+	BrickMask &= LookupTable_BrickSideMask[Side];
+	while (BrickMask)
+	{
+		uint32 Bit = FMath::CountTrailingZeros64(BrickMask);
+		BrickMask &= BrickMask - 1;
+		Vector->push_back(CPathAStarNode(CreateBrickVoxelID(LeafID, Bit), Leaf));
+	}
+}
+
+void ACPathVolume::FindFreeBrickNeighbours(CPathTreeID TreeID, std::vector<CPathAStarNode>* Vector)
+{
+	CPathTreeID LeafID = TreeID;
+	ReplaceDepth(LeafID, OctreeDepth);
+	uint64* BrickMask = FindBrickMask(LeafID);
+	if (!BrickMask)
+		return;
+
+	const CPathOctree& Leaf = *FindTreeByID(LeafID);
+	uint32 X, Y, Z;
+	BrickCoordsFromBit(ExtractBrickBit(TreeID), X, Y, Z);
+
+	for (int Direction = 0; Direction < 6; Direction++)
+	{
+		const FVector& Offset = LookupTable_NeighbourOffsetByDirection[Direction];
+		int NX = X + Offset.X;
+		int NY = Y + Offset.Y;
+		int NZ = Z + Offset.Z;
+
+		// Neighbour in the same brick
+		if (NX >= 0 && NX < 4 && NY >= 0 && NY < 4 && NZ >= 0 && NZ < 4)
+		{
+			uint32 Bit = BrickBitFromCoords(NX, NY, NZ);
+			if ((*BrickMask >> Bit) & 1)
+				Vector->push_back(CPathAStarNode(CreateBrickVoxelID(LeafID, Bit), Leaf));
+			continue;
+		}
+
+		// Neighbour of the whole leaf, it can be larger than the leaf but never smaller
+		CPathTreeID NeighbourID = 0;
+		CPathOctree* Neighbour = FindNeighbourByID(LeafID, (ENeighbourDirection)Direction, NeighbourID);
+		if (!Neighbour)
+			continue;
+
+		if (Neighbour->GetIsFree())
+		{
+			Vector->push_back(CPathAStarNode(NeighbourID, *Neighbour));
+		}
+		else if (ExtractDepth(NeighbourID) == (uint32)OctreeDepth)
+		{
+			uint64* NeighbourMask = FindBrickMask(NeighbourID);
+			uint32 Bit = BrickBitFromCoords((NX + 4) % 4, (NY + 4) % 4, (NZ + 4) % 4);
+			if (NeighbourMask && ((*NeighbourMask >> Bit) & 1))
+				Vector->push_back(CPathAStarNode(CreateBrickVoxelID(NeighbourID, Bit), *Neighbour));
+		}
+	}
+}
+
+void ACPathVolume::FindBrickNeighbours(CPathTreeID TreeID, std::vector<CPathTreeID>* Vector)
+{
+	CPathTreeID LeafID = TreeID;
+	ReplaceDepth(LeafID, OctreeDepth);
+	uint32 X, Y, Z;
+	BrickCoordsFromBit(ExtractBrickBit(TreeID), X, Y, Z);
+
+	for (int Direction = 0; Direction < 6; Direction++)
+	{
+		const FVector& Offset = LookupTable_NeighbourOffsetByDirection[Direction];
+		int NX = X + Offset.X;
+		int NY = Y + Offset.Y;
+		int NZ = Z + Offset.Z;
+
+		if (NX >= 0 && NX < 4 && NY >= 0 && NY < 4 && NZ >= 0 && NZ < 4)
+		{
+			Vector->push_back(CreateBrickVoxelID(LeafID, BrickBitFromCoords(NX, NY, NZ)));
+			continue;
+		}
+
+		CPathTreeID NeighbourID = 0;
+		CPathOctree* Neighbour = FindNeighbourByID(LeafID, (ENeighbourDirection)Direction, NeighbourID);
+		if (!Neighbour)
+			continue;
+
+		// Only occupied leafs at OctreeDepth have bricks, anything else is a single node
+		if (!Neighbour->GetIsFree() && ExtractDepth(NeighbourID) == (uint32)OctreeDepth && FindBrickMask(NeighbourID))
+			Vector->push_back(CreateBrickVoxelID(NeighbourID, BrickBitFromCoords((NX + 4) % 4, (NY + 4) % 4, (NZ + 4) % 4)));
+		else
+			Vector->push_back(NeighbourID);
+	}
+}
+
+uint64 ACPathVolume::RecheckBrick(FVector LeafLocation)
+{
+	FVector LeafExtent = GetVoxelSizeByDepth(OctreeDepth) / 2.f;
+	FVector SubVoxelSize = GetVoxelSizeByDepth(GetMaxTreeIDDepth());
+
+	FVector FirstVoxelLocation = LeafLocation - LeafExtent + SubVoxelSize / 2.f;
+	uint64 FreeMask = 0;
+	if (GeometryRasterizer)
+	{
+		for (uint32 Bit = 0; Bit < 64; Bit++)
+		{
+			uint32 X, Y, Z;
+			BrickCoordsFromBit(Bit, X, Y, Z);
+			if (!IsRasterizedNodeOccupied(FirstVoxelLocation + FVector(X, Y, Z) * SubVoxelSize, SubVoxelSize / 2.f, BrickTraceShapes))
+				FreeMask |= uint64(1) << Bit;
+		}
+		return FreeMask;
+	}
+
+	// Candidates of the outer tree already contain everything that can overlap the leaf, otherwise they are gathered just for it.
+	// Agent shapes of sub-voxels on the border reach outside of the leaf.
+	std::shared_ptr<const FCPathCandidateList> LeafCandidates;
+	const FCPathCandidateList* Candidates = GetThreadCandidates();
+	if (!Candidates)
+	{
+		LeafCandidates = GatherCandidates(LeafLocation, LeafExtent);
+		Candidates = LeafCandidates.get();
+	}
+	if (Candidates && Candidates->empty())
+		return ~uint64(0);
+
+	// Without candidates the leaf has a component that isnt Static, so the scene is queried
+	for (uint32 Bit = 0; Bit < 64; Bit++)
+	{
+		uint32 X, Y, Z;
+		BrickCoordsFromBit(Bit, X, Y, Z);
+		FVector Location = FirstVoxelLocation + FVector(X, Y, Z) * SubVoxelSize;
+
+		bool IsFree = true;
+		for (const FCollisionShape& Shape : BrickTraceShapes)
+		{
+			if (Candidates ? OverlapsAnyCandidate(*Candidates, Location, Shape) : GetWorld()->OverlapAnyTestByChannel(Location, FQuat::Identity, TraceChannel, Shape, StaticQueryParams))
+			{
+				IsFree = false;
+				break;
+			}
+		}
+
+		if (IsFree)
+			FreeMask |= uint64(1) << Bit;
+	}
+	return FreeMask;
+}
+
+uint32 ACPathVolume::RegisterAttributeLayer(FName Name, uint32 ElementSize)
+{
+	checkf(OuterNodeCount == 0, TEXT("CPATH - Graph Generation:::Attribute layers can only be registered in RegisterAttributeLayers"));
+	checkf(FindAttributeLayer(Name) < 0, TEXT("CPATH - Graph Generation:::Attribute layer %s is already registered"), *Name.ToString());
+
+	AttributeLayers.push_back(std::make_unique<CPathAttributeLayer>(Name, ElementSize));
+	return AttributeLayers.size() - 1;
+}
+
+int32 ACPathVolume::FindAttributeLayer(FName Name) const
+{
+	for (uint32 Layer = 0; Layer < AttributeLayers.size(); Layer++)
+	{
+		if (AttributeLayers[Layer]->GetName() == Name)
+			return Layer;
+	}
+	return -1;
+}
+
+bool ACPathVolume::HaveSameAttributes(uint32 NodeIndexA, uint32 NodeIndexB) const
+{
+	for (const std::unique_ptr<CPathAttributeLayer>& Layer : AttributeLayers)
+	{
+		if (!Layer->IsEqual(NodeIndexA, NodeIndexB))
+			return false;
+	}
+	return true;
+}
+
+uint32 ACPathVolume::GetNodeIndex(CPathTreeID TreeID)
+{
+	if (IsBrickVoxel(TreeID))
+		ReplaceDepth(TreeID, OctreeDepth);
+
+	uint32 DepthReached;
+	CPathOctree* Tree = FindTreeByID(TreeID, DepthReached);
+	return Tree && DepthReached == ExtractDepth(TreeID) ? Tree->NodeIndex : CPATH_INVALID_NODEINDEX;
+}
+
+void ACPathVolume::BuildFreeBoxes()
+{
+	FreeBoxes.clear();
+	FreeBoxSlots.clear();
+	OuterFreeBox.assign(OuterNodeCount, 0);
+
+	for (int X = 0; X < (int)NodeCount[0]; X++)
+	{
+		for (int Y = 0; Y < (int)NodeCount[1]; Y++)
+		{
+			for (int Z = 0; Z < (int)NodeCount[2]; Z++)
+			{
+				MergeFreeBoxAt(FIntVector(X, Y, Z));
+			}
+		}
+	}
+}
+
+void ACPathVolume::UpdateFreeBoxes(const std::vector<uint32>& OuterIndexes)
+{
+	std::vector<FIntVector> Seeds;
+	for (uint32 OuterIndex : OuterIndexes)
+	{
+		uint32 X, Y, Z;
+		CoordsFromOuterIndex(OuterIndex, X, Y, Z);
+		Seeds.push_back(FIntVector(X, Y, Z));
+
+		uint32 BoxIndex = OuterFreeBox[OuterIndex];
+		if (!BoxIndex)
+			continue;
+
+		// Every tree of a removed box is a seed, its free part can form boxes again
+		CPathFreeBox& Box = FreeBoxes[BoxIndex - 1];
+		for (int BoxX = Box.Min.X; BoxX <= Box.Max.X; BoxX++)
+		{
+			for (int BoxY = Box.Min.Y; BoxY <= Box.Max.Y; BoxY++)
+			{
+				for (int BoxZ = Box.Min.Z; BoxZ <= Box.Max.Z; BoxZ++)
+				{
+					OuterFreeBox[OuterIndexFromCoords(BoxX, BoxY, BoxZ)] = 0;
+					Seeds.push_back(FIntVector(BoxX, BoxY, BoxZ));
+				}
+			}
+		}
+		Box.Min = FIntVector(0);
+		Box.Max = FIntVector(-1);
+		FreeBoxSlots.push_back(BoxIndex - 1);
+	}
+
+	// Same order as a full build, so boxes grow the same way
+	std::sort(Seeds.begin(), Seeds.end(), [](const FIntVector& A, const FIntVector& B)
+	{
+		return A.X != B.X ? A.X < B.X : (A.Y != B.Y ? A.Y < B.Y : A.Z < B.Z);
+	});
+	Seeds.erase(std::unique(Seeds.begin(), Seeds.end()), Seeds.end());
+	for (const FIntVector& Coords : Seeds)
+	{
+		MergeFreeBoxAt(Coords);
+	}
+}
+
+void ACPathVolume::MergeFreeBoxAt(FIntVector Coords)
+{
+	uint32 OuterIndex = OuterIndexFromCoords(Coords.X, Coords.Y, Coords.Z);
+	const CPathOctree* Tree = GetOuterTree(OuterIndex);
+	if (OuterFreeBox[OuterIndex] || Tree->Children || !Tree->GetIsFree())
+		return;
+
+	// True if every outer tree between Min and Max is a free leaf with Data and the same attributes as the first tree, that isnt in a box yet
+	auto CanMerge = [this, Tree](FIntVector Min, FIntVector Max)
+	{
+		for (int X = Min.X; X <= Max.X; X++)
+		{
+			for (int Y = Min.Y; Y <= Max.Y; Y++)
+			{
+				for (int Z = Min.Z; Z <= Max.Z; Z++)
+				{
+					uint32 OtherIndex = OuterIndexFromCoords(X, Y, Z);
+					const CPathOctree* Other = GetOuterTree(OtherIndex);
+					if (OuterFreeBox[OtherIndex] || Other->Children || Other->Data != Tree->Data || !HaveSameAttributes(Other->NodeIndex, Tree->NodeIndex))
+						return false;
+				}
+			}
+		}
+		return true;
+	};
+
+	CPathFreeBox Box;
+	Box.Min = Coords;
+	Box.Max = Coords;
+	FIntVector Limit(FMath::Min(Coords.X + MaxFreeBoxSize, (int)NodeCount[0]), FMath::Min(Coords.Y + MaxFreeBoxSize, (int)NodeCount[1]), FMath::Min(Coords.Z + MaxFreeBoxSize, (int)NodeCount[2]));
+
+	while (Box.Max.Z + 1 < Limit.Z && CanMerge(FIntVector(Coords.X, Coords.Y, Box.Max.Z + 1), FIntVector(Coords.X, Coords.Y, Box.Max.Z + 1)))
+		Box.Max.Z++;
+
+	while (Box.Max.Y + 1 < Limit.Y && CanMerge(FIntVector(Coords.X, Box.Max.Y + 1, Coords.Z), FIntVector(Coords.X, Box.Max.Y + 1, Box.Max.Z)))
+		Box.Max.Y++;
+
+	while (Box.Max.X + 1 < Limit.X && CanMerge(FIntVector(Box.Max.X + 1, Coords.Y, Coords.Z), FIntVector(Box.Max.X + 1, Box.Max.Y, Box.Max.Z)))
+		Box.Max.X++;
+
+	// A single tree is searched the same way without a box
+	if (Box.Max == Box.Min)
+		return;
+
+	uint32 BoxIndex;
+	if (FreeBoxSlots.size())
+	{
+		BoxIndex = FreeBoxSlots.back();
+		FreeBoxSlots.pop_back();
+		FreeBoxes[BoxIndex] = Box;
+	}
+	else
+	{
+		BoxIndex = FreeBoxes.size();
+		FreeBoxes.push_back(Box);
+	}
+
+	for (int BoxX = Box.Min.X; BoxX <= Box.Max.X; BoxX++)
+	{
+		for (int BoxY = Box.Min.Y; BoxY <= Box.Max.Y; BoxY++)
+		{
+			for (int BoxZ = Box.Min.Z; BoxZ <= Box.Max.Z; BoxZ++)
+			{
+				OuterFreeBox[OuterIndexFromCoords(BoxX, BoxY, BoxZ)] = BoxIndex + 1;
+			}
+		}
+	}
+}
+
+void ACPathVolume::GetBatchOuterIndexes(std::vector<uint32>& OutOuterIndexes) const
+{
+	OutOuterIndexes.clear();
+	OutOuterIndexes.reserve(GenerationBatchItems.size());
+	for (CPathTreeID TreeID : GenerationBatchItems)
+	{
+		OutOuterIndexes.push_back(ExtractOuterIndex(TreeID));
+	}
+	std::sort(OutOuterIndexes.begin(), OutOuterIndexes.end());
+	OutOuterIndexes.erase(std::unique(OutOuterIndexes.begin(), OutOuterIndexes.end()), OutOuterIndexes.end());
+}
+
+inline uint32 ACPathVolume::FindFreeBox(CPathTreeID TreeID) const
+{
+	if (OuterFreeBox.empty() || ExtractDepth(TreeID) != 0)
+		return 0;
+	return OuterFreeBox[ExtractOuterIndex(TreeID)];
+}
+
+CPathTreeID ACPathVolume::GetSearchNodeID(CPathTreeID TreeID) const
+{
+	uint32 BoxIndex = FindFreeBox(TreeID);
+	if (!BoxIndex)
+		return TreeID;
+
+	const CPathFreeBox& Box = FreeBoxes[BoxIndex - 1];
+	return CreateTreeID(OuterIndexFromCoords(Box.Min.X, Box.Min.Y, Box.Min.Z), 0);
+}
+
+FBox ACPathVolume::GetSearchNodeBounds(CPathTreeID TreeID) const
+{
+	uint32 BoxIndex = FindFreeBox(TreeID);
+	if (!BoxIndex)
+		return FBox::BuildAABB(WorldLocationFromTreeID(TreeID), GetVoxelSizeByDepth(ExtractDepth(TreeID)) / 2.f);
+
+	// StartPosition is the center of the first outer tree
+	const CPathFreeBox& Box = FreeBoxes[BoxIndex - 1];
+	FVector OuterSize = GetVoxelSizeByDepth(0);
+	return FBox(StartPosition + FVector(Box.Min) * OuterSize - OuterSize / 2.f, StartPosition + FVector(Box.Max) * OuterSize + OuterSize / 2.f);
+}
+
+FVector ACPathVolume::GetSearchNodeLocation(CPathTreeID TreeID, FVector FromLocation) const
+{
+	if (!FindFreeBox(TreeID))
+		return WorldLocationFromTreeID(TreeID);
+
+	FBox Bounds = GetSearchNodeBounds(TreeID);
+	return FVector(FMath::Clamp(FromLocation.X, Bounds.Min.X, Bounds.Max.X), FMath::Clamp(FromLocation.Y, Bounds.Min.Y, Bounds.Max.Y), FMath::Clamp(FromLocation.Z, Bounds.Min.Z, Bounds.Max.Z));
+}
+
+FVector ACPathVolume::GetSearchNodeExit(CPathTreeID FromTreeID, FVector FromLocation, CPathTreeID ToTreeID) const
+{
+	if (!FindFreeBox(FromTreeID))
+		return FromLocation;
+
+	// Neighbours touch, so the overlap of their bounds is the face they share
+	FBox Face = GetSearchNodeBounds(FromTreeID).Overlap(GetSearchNodeBounds(ToTreeID));
+	return FVector(FMath::Clamp(FromLocation.X, Face.Min.X, Face.Max.X), FMath::Clamp(FromLocation.Y, Face.Min.Y, Face.Max.Y), FMath::Clamp(FromLocation.Z, Face.Min.Z, Face.Max.Z));
+}
+
+void ACPathVolume::FindFreeBoxNeighbours(uint32 BoxIndex, std::vector<CPathAStarNode>* Vector)
+{
+	const CPathFreeBox& Box = FreeBoxes[BoxIndex];
+	for (int Direction = 0; Direction < 6; Direction++)
+	{
+		// Only trees on the box's face in this direction can have neighbours outside of it
+		FVector Offset = LookupTable_NeighbourOffsetByDirection[Direction];
+		FIntVector FaceMin = Box.Min;
+		FIntVector FaceMax = Box.Max;
+		for (int Axis = 0; Axis < 3; Axis++)
+		{
+			if (Offset[Axis] > 0)
+				FaceMin[Axis] = Box.Max[Axis];
+			else if (Offset[Axis] < 0)
+				FaceMax[Axis] = Box.Min[Axis];
+		}
+
+		for (int X = FaceMin.X; X <= FaceMax.X; X++)
+		{
+			for (int Y = FaceMin.Y; Y <= FaceMax.Y; Y++)
+			{
+				for (int Z = FaceMin.Z; Z <= FaceMax.Z; Z++)
+				{
+					AddFreeNeighboursOnSide(CreateTreeID(OuterIndexFromCoords(X, Y, Z), 0), (ENeighbourDirection)Direction, Vector);
+				}
+			}
+		}
+	}
+}
+
+
+uint32 ACPathVolume::FindLinearNodeByID(CPathTreeID TreeID, uint32& DepthReached)
+{
+	uint32 Depth = ExtractDepth(TreeID);
+	uint32 OuterIndex = ExtractOuterIndex(TreeID);
+	uint32 NodeIndex = OuterIndex;
+	DepthReached = 0;
+
+	for (uint32 CurrDepth = 1; CurrDepth <= Depth; CurrDepth++)
+	{
+		// Child not found, returning the deepest found parent
+		if (!LinearOctree.HasChildren(OuterIndex, CurrDepth - 1, NodeIndex))
+		{
+			break;
+		}
+
+		NodeIndex = LinearOctree.GetChild(OuterIndex, CurrDepth - 1, NodeIndex, ExtractChildIndex(TreeID, CurrDepth));
+		DepthReached = CurrDepth;
+	}
+	return NodeIndex;
+}
+
+bool ACPathVolume::FindNeighbourLinear(CPathTreeID TreeID, ENeighbourDirection Direction, CPathTreeID& NeighbourID, uint32& NeighbourIndex)
+{
+	// Depth 0, outer index is the index in LinearOctree
+	uint32 Depth = ExtractDepth(TreeID);
+	if (Depth == 0)
+	{
+		FVector NeighbourLocalCoords = LocalCoordsInt3FromOuterIndex(ExtractOuterIndex(TreeID)) + LookupTable_NeighbourOffsetByDirection[Direction];
+
+		if (!IsInBounds(NeighbourLocalCoords))
+			return false;
+
+		NeighbourID = LocalCoordsInt3ToIndex(NeighbourLocalCoords);
+		NeighbourIndex = NeighbourID;
+		return true;
+	}
+
+	uint8 ChildIndex = ExtractChildIndex(TreeID, Depth);
+	int8 NeighbourChildIndex = LookupTable_NeighbourChildIndex[ChildIndex][Direction];
+
+	// The neighbour a is child of the same octree
+	if (NeighbourChildIndex >= 0)
+	{
+		NeighbourID = TreeID;
+		ReplaceChildIndex(NeighbourID, Depth, NeighbourChildIndex);
+		NeighbourIndex = FindLinearNodeByID(NeighbourID, Depth);
+		ReplaceDepth(NeighbourID, Depth);
+		return true;
+	}
+
+	// Getting the neighbour of parent Octree and then its correct child
+	ReplaceDepth(TreeID, Depth - 1);
+	if (FindNeighbourLinear(TreeID, Direction, NeighbourID, NeighbourIndex))
+	{
+		uint32 NeighbourDepth = ExtractDepth(NeighbourID);
+		uint32 NeighbourOuterIndex = ExtractOuterIndex(NeighbourID);
+		if (LinearOctree.HasChildren(NeighbourOuterIndex, NeighbourDepth, NeighbourIndex))
+		{
+			// Look at the description of LookupTable_NeighbourChildIndex
+			NeighbourChildIndex = -1 * NeighbourChildIndex - 1;
+			NeighbourIndex = LinearOctree.GetChild(NeighbourOuterIndex, NeighbourDepth, NeighbourIndex, NeighbourChildIndex);
+			ReplaceDepth(NeighbourID, Depth);
+			ReplaceChildIndex(NeighbourID, Depth, NeighbourChildIndex);
+		}
+		// Otherwise NeighbourID is already correct from calling FindNeighbourLinear
+		return true;
+	}
+
+	return false;
+}
+
+std::vector<CPathAStarNode> ACPathVolume::FindFreeNeighbourLeafsLinear(CPathAStarNode& Node)
+{
+	std::vector<CPathAStarNode> FreeNeighbours;
+
+	for (int Direction = 0; Direction < 6; Direction++)
+	{
+		CPathTreeID NeighbourID = 0;
+		uint32 NeighbourIndex = 0;
+		if (FindNeighbourLinear(Node.TreeID, (ENeighbourDirection)Direction, NeighbourID, NeighbourIndex))
+		{
+			uint32 NeighbourDepth = ExtractDepth(NeighbourID);
+			uint32 NeighbourOuterIndex = ExtractOuterIndex(NeighbourID);
+			uint32 Data = LinearOctree.GetData(NeighbourOuterIndex, NeighbourDepth, NeighbourIndex);
+			if (Data & 1)
+				FreeNeighbours.push_back(CPathAStarNode(NeighbourID, Data));
+			else if (LinearOctree.HasChildren(NeighbourOuterIndex, NeighbourDepth, NeighbourIndex))
+			{
+				FindLeafsOnSideLinear(NeighbourIndex, NeighbourID, (ENeighbourDirection)LookupTable_OppositeSide[Direction], &FreeNeighbours);
+			}
+		}
+	}
+
+	return FreeNeighbours;
+}
+
+void ACPathVolume::FindLeafsOnSideLinear(uint32 NodeIndex, CPathTreeID TreeID, ENeighbourDirection Side, std::vector<CPathAStarNode>* Vector)
+{
+	uint8 Depth = ExtractDepth(TreeID);
+	uint8 NewDepth = Depth + 1;
+	uint32 OuterIndex = ExtractOuterIndex(TreeID);
+	for (uint8 i = 0; i < 4; i++)
+	{
+		uint8 ChildIndex = LookupTable_ChildrenOnSide[Side][i];
+		uint32 ChildNodeIndex = LinearOctree.GetChild(OuterIndex, Depth, NodeIndex, ChildIndex);
+		CPathTreeID ChildTreeID = TreeID;
+		ReplaceChildIndexAndDepth(ChildTreeID, NewDepth, ChildIndex);
+		if (LinearOctree.HasChildren(OuterIndex, NewDepth, ChildNodeIndex))
+			FindLeafsOnSideLinear(ChildNodeIndex, ChildTreeID, Side, Vector);
+		else
+		{
+			uint32 Data = LinearOctree.GetData(OuterIndex, NewDepth, ChildNodeIndex);
+			if (Data & 1)
+				Vector->push_back(CPathAStarNode(ChildTreeID, Data));
+		}
+	}
+}
+
+
+void ACPathVolume::QueueGenerator(uint8 GeneratorID, FString Name, bool Obstacles)
+{
+	// The pool lives as long as the module, a volume can only generate while it's loaded
+	FCPathGenerationPool* Pool = FCPathGenerationPool::Get();
+	checkf(Pool, TEXT("CPATH - Graph Generation:::No generation pool, the CPathfinding module is not loaded"));
+
+	Name.AppendInt(GeneratorID);
+	GeneratorThreads.push_back(std::make_unique<FCPathAsyncVolumeGenerator>(this, GeneratorID, Name, Obstacles));
+	Pool->Enqueue(GeneratorThreads.back().get());
+}
+
+void ACPathVolume::CleanFinishedGenerators()
+{
+	for (auto Generator = GeneratorThreads.begin(); Generator != GeneratorThreads.end();)
+	{
+		if ((*Generator)->PoolState.load() == FCPathAsyncVolumeGenerator::PoolFinished)
+			Generator = GeneratorThreads.erase(Generator);
+		else
+			Generator++;
+	}
+}
+
+void ACPathVolume::InitialGenerationUpdate()
+{
+	if (AsyncQueryGenerator && AsyncQueryGenerator->Update())
+	{
+		AsyncQueryGenerator.reset();
+		OnGenerationBatchFinished();
+		BatchGeneratorsLeft--;
+	}
+
+	// Generators increase GeneratorsRunning only once they start running, so BatchGeneratorsLeft is also checked
+	if (GeneratorsRunning.load() <= 0 && BatchGeneratorsLeft.load() <= 0)
+	{
+		InitialGenerationCompleteAtom.store(true);
+		InitialGenerationFinished = true;
+
+		FCPathMemoryStats Stats;
+		UpdateMemoryStats(Stats);
+		if (Stats.MemoryBudgetReached)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("CPATH - Graph Generation:::Memory budget of %f MB was reached, some trees were not subdivided"), MemoryBudgetMB);
+		}
+
+
+		CleanFinishedGenerators();
+		GetWorld()->GetTimerManager().ClearTimer(GenerationTimerHandle);
+		if (DynamicObstaclesUpdateRate > 0)
+			GetWorld()->GetTimerManager().SetTimer(GenerationTimerHandle, this, &ACPathVolume::GenerationUpdate, 1.f / DynamicObstaclesUpdateRate, true);
+	}
+
+}
+
+void ACPathVolume::GenerationUpdate()
+{
+#if WITH_EDITOR
+	checkf(GeneratorsRunning.load() >= 0, TEXT("CPATH - Graph Generation:::GenerationUpdate - GeneratorsRunning was negative!!!!!"));
+#endif
+	// Garbage collecting generators that finished their job
+	CleanFinishedGenerators();
+
+	FCPathMemoryStats Stats;
+	UpdateMemoryStats(Stats);
+
+	RegenerationClock++;
+
+	if (UseLazyGeneration)
+	{
+		LazyClock++;
+		if (LazyResidentMemoryMB > 0 && GeneratorsRunning.load() == 0 && BatchGeneratorsLeft.load() <= 0)
+			EvictLazySubtrees();
+
+		FScopeLock Lock(&LazyTreesTouchedLock);
+		LazyTreesRequested.insert(LazyTreesTouched.begin(), LazyTreesTouched.end());
+		LazyTreesTouched.clear();
+	}
+
+
+	// We skip this update if generation from previous update is still running
+	// This can be the cause if we set DynamicObstaclesUpdateRate too high, or when it's initial generation, 
+	// or if there were a lot of pathfinding requests and generators are waiting for them to finish.
+	if (GeneratorsRunning.load() == 0 && BatchGeneratorsLeft.load() <= 0 && (TrackedDynamicObstacles.size() || LazyTreesRequested.size() || !TreesToRegenerate.IsEmpty()))
+	{
+
+		//Drawing previously updated trees
+		/*for (auto TreeID : TreesToRegenerate)
+		{
+			std::vector<CPathTreeID> Subtrees;
+			Subtrees.push_back(TreeID);
+			GetAllSubtrees(TreeID, Subtrees);
+			for (auto SubID : Subtrees)
+			{
+				DrawDebugVoxel(SubID, false, 1.f / DynamicObstaclesUpdateRate);
+			}
+		}*/
+
+		// Adding trees requested by RequestLazyGeneration or reached by queries
+		TreesToRefine.clear();
+		std::swap(TreesToRefine, LazyTreesRequested);
+		for (int32 OuterIndex : TreesToRefine)
+		{
+			TreesToRegenerate.Add(CreateTreeID(OuterIndex, 0));
+		}
+
+		// Adding indexes of obstacles that moved, both where they were and where they are now
+		MarkMovedObstacles();
+
+		// Creating threads
+		// In case there is a lot of trees to update, we split the work into multiple threads to make it faster
+		if (!TreesToRegenerate.IsEmpty())
+		{
+			if (UseLayeredOccupancy)
+			{
+				GatherDynamicObstacleShapes();
+			}
+
+			ResolveDirtySubtrees();
+			TreesToRegenerate.Clear();
+			if (RegenerationBudgetMs > 0)
+			{
+				ScheduleDirtySubtrees();
+			}
+
+			// Subtrees are never larger than outer trees, so this doesnt start more generators than before
+			uint32 ThreadCount = FMath::Min(FMath::Min(FPlatformMisc::NumberOfCores(), (int)GenerationBatchItems.size() / OuterIndexesPerThread), MaxGenerationThreads);
+			ThreadCount = FMath::Max(ThreadCount, (uint32)1);
+			StartGenerationBatch(GenerationBatchItems.size(), ThreadCount);
+			BatchGeneratorsLeft = ThreadCount;
+
+			// Starting generation
+			for (uint32 CurrentThread = 0; CurrentThread < ThreadCount; CurrentThread++)
+			{
+				QueueGenerator(CurrentThread, "CPathGenerator Dynamic, ID: ", true);
+			}
+			//UE_LOG(LogTemp, Warning, TEXT("GENERATION UPDATE Tracked - %d, Indexes - %d, Threads - %d"), TrackedDynamicObstacles.size(), TreesToRegenerate.Num(), ThreadCount);
+		}
+	}
+}
+
+void ACPathVolume::TrackDynamicObstacle(UCPathDynamicObstacle* Obstacle)
+{
+	TrackedDynamicObstacles.emplace(Obstacle, FCPathObstacleState());
+}
+
+void ACPathVolume::UntrackDynamicObstacle(UCPathDynamicObstacle* Obstacle)
+{
+	auto Found = TrackedDynamicObstacles.find(Obstacle);
+	if (Found == TrackedDynamicObstacles.end())
+		return;
+
+	for (CPathTreeID TreeID : Found->second.FootprintTreeIDs)
+		TreesToRegenerate.Add(TreeID);
+	TrackedDynamicObstacles.erase(Found);
+}
+
+void ACPathVolume::MarkMovedObstacles()
+{
+	struct FMovedObstacle
+	{
+		FCPathObstacleState* State;
+		std::vector<FCPathObstacleShape> Shapes;
+		std::vector<CPathTreeID> TreeIDs;
+	};
+
+	// Components, their transforms and body setups are only read here, on the game thread
+	std::vector<FMovedObstacle> Moved;
+	for (auto& Tracked : TrackedDynamicObstacles)
+	{
+		UCPathDynamicObstacle* Obstacle = Tracked.first;
+		FCPathObstacleState& State = Tracked.second;
+
+		// Nothing about the actor's transform changed, so there's no reason to even look at its bounds
+		if (!IsValid(Obstacle) || (State.Bounds.IsValid && Obstacle->GetTransformChangeCount() == State.TransformChangeCount))
+			continue;
+		State.TransformChangeCount = Obstacle->GetTransformChangeCount();
+
+		FBox Bounds = Obstacle->GetObstacleBounds();
+		FTransform Transform = Obstacle->GetOwner() ? Obstacle->GetOwner()->GetActorTransform() : FTransform::Identity;
+		if (State.Bounds.IsValid)
+		{
+			float Distance = FMath::Max((Bounds.Min - State.Bounds.Min).GetAbsMax(), (Bounds.Max - State.Bounds.Max).GetAbsMax());
+			Distance = FMath::Max(Distance, (Transform.GetLocation() - State.Transform.GetLocation()).GetAbsMax());
+			float Angle = FMath::RadiansToDegrees(Transform.GetRotation().AngularDistance(State.Transform.GetRotation()));
+			if (Distance <= Obstacle->MovementThreshold && Angle <= Obstacle->RotationThreshold)
+				continue;
+		}
+
+		// Movement below the thresholds isnt lost, its compared against the state the graph was last regenerated for
+		State.Bounds = Bounds;
+		State.Transform = Transform;
+		Moved.push_back({ &State });
+		Obstacle->GetObstacleShapes(Moved.back().Shapes);
+	}
+
+	// Rasterizing shapes is the expensive part, everything here only touches its own element
+	ParallelFor(Moved.size(), [this, &Moved](int32 Index)
+	{
+		FMovedObstacle& Item = Moved[Index];
+		for (const FCPathObstacleShape& Shape : Item.Shapes)
+			GetFootprintTreeIDs(Shape, Item.TreeIDs);
+
+		// Shapes of one actor usually touch the same voxels
+		std::sort(Item.TreeIDs.begin(), Item.TreeIDs.end());
+		Item.TreeIDs.erase(std::unique(Item.TreeIDs.begin(), Item.TreeIDs.end()), Item.TreeIDs.end());
+	}, Moved.size() < ParallelObstacleThreshold);
+
+	for (FMovedObstacle& Item : Moved)
+	{
+		for (CPathTreeID TreeID : Item.State->FootprintTreeIDs)
+			TreesToRegenerate.Add(TreeID);
+		for (CPathTreeID TreeID : Item.TreeIDs)
+			TreesToRegenerate.Add(TreeID);
+		Item.State->FootprintTreeIDs = std::move(Item.TreeIDs);
+	}
+}
+
+void ACPathVolume::GetFootprintTreeIDs(const FCPathObstacleShape& Shape, std::vector<CPathTreeID>& TreeIDs) const
+{
+	// Nodes are tested with agent shapes at their centers, so nodes that dont touch the grown shape cant be affected
+	FVector AgentExtent = GetAgentExtent();
+	FBox Box = Shape.GetBounds().ExpandBy(AgentExtent);
+	FVector BoxSize = Box.GetSize();
+
+	// Deepest depth at which the box fits in one voxel, the footprint is never coarser than that
+	int Depth = OctreeDepth;
+	while (Depth > 0)
+	{
+		FVector Size = GetVoxelSizeByDepth(Depth);
+		if (BoxSize.X <= Size.X && BoxSize.Y <= Size.Y && BoxSize.Z <= Size.Z)
+			break;
+		Depth--;
+	}
+
+	FIntVector Min, Max;
+	if (!GetVoxelRange(Box, Depth, Min, Max))
+		return;
+
+	// Going deeper as long as there arent too many voxels to test, thin and rotated shapes benefit the most
+	while (Depth < OctreeDepth)
+	{
+		FIntVector DeeperMin, DeeperMax;
+		GetVoxelRange(Box, Depth + 1, DeeperMin, DeeperMax);
+		FIntVector Count = DeeperMax - DeeperMin + FIntVector(1);
+		if ((int64)Count.X * Count.Y * Count.Z > MaxFootprintVoxels)
+			break;
+		Depth++;
+		Min = DeeperMin;
+		Max = DeeperMax;
+	}
+
+	FVector VoxelSizeAtDepth = GetVoxelSizeByDepth(Depth);
+	FVector VoxelExtent = VoxelSizeAtDepth / 2.f + AgentExtent;
+	FVector VolumeMin = StartPosition - GetVoxelSizeByDepth(0) / 2.f;
+	for (int X = Min.X; X <= Max.X; X++)
+	{
+		for (int Y = Min.Y; Y <= Max.Y; Y++)
+		{
+			for (int Z = Min.Z; Z <= Max.Z; Z++)
+			{
+				FVector VoxelCenter = VolumeMin + (FVector(X, Y, Z) + 0.5f) * VoxelSizeAtDepth;
+				if (Shape.OverlapsBox(VoxelCenter, VoxelExtent))
+					TreeIDs.push_back(TreeIDFromLocalCoords(X, Y, Z, Depth));
+			}
+		}
+	}
+}
+
+bool ACPathVolume::GetVoxelRange(FBox Box, int Depth, FIntVector& Min, FIntVector& Max) const
+{
+	FVector VoxelSizeAtDepth = GetVoxelSizeByDepth(Depth);
+	FVector VolumeMin = StartPosition - GetVoxelSizeByDepth(0) / 2.f;
+	for (int i = 0; i < 3; i++)
+	{
+		int CellCount = NodeCount[i] << Depth;
+		Min[i] = FMath::FloorToInt((Box.Min[i] - VolumeMin[i]) / VoxelSizeAtDepth[i]);
+		Max[i] = FMath::FloorToInt((Box.Max[i] - VolumeMin[i]) / VoxelSizeAtDepth[i]);
+		if (Max[i] < 0 || Min[i] >= CellCount)
+			return false;
+
+		Min[i] = FMath::Max(Min[i], 0);
+		Max[i] = FMath::Min(Max[i], CellCount - 1);
+	}
+	return true;
+}
+
+void ACPathVolume::ResolveDirtySubtrees()
+{
+	TreesToRegenerate.Compact();
+	std::vector<CPathTreeID> Resolved;
+	Resolved.reserve(TreesToRegenerate.Num());
+	CPathOctreeAllocator::ThreadCache Cache(&OctreeAllocator);
+	for (CPathTreeID TreeID : TreesToRegenerate.GetRegions())
+	{
+		uint32 Depth = ExtractDepth(TreeID);
+		uint32 DepthReached = 0;
+		CPathOctree* CurrTree = GetOuterTree(ExtractOuterIndex(TreeID));
+		while (DepthReached < Depth && CurrTree->Children)
+		{
+			// Dirty subtrees can share a parent block, so shared blocks on the way are copied here instead of by generators.
+			// Pathfinders may be reading it, but the copy is identical.
+			if (OctreeAllocator.IsFrozen(CurrTree->Children))
+				CurrTree->Children = OctreeAllocator.AllocateCopy(CurrTree->Children, Cache, DepthReached + 1);
+
+			DepthReached++;
+			CurrTree = &CurrTree->Children[ExtractChildIndex(TreeID, DepthReached)];
+		}
+		ReplaceDepth(TreeID, DepthReached);
+		Resolved.push_back(TreeID);
+	}
+	std::sort(Resolved.begin(), Resolved.end());
+	Resolved.erase(std::unique(Resolved.begin(), Resolved.end()), Resolved.end());
+
+	GenerationBatchItems.clear();
+	for (CPathTreeID TreeID : Resolved)
+	{
+		bool HasDirtyParent = false;
+		for (uint32 ParentDepth = ExtractDepth(TreeID); ParentDepth-- > 0 && !HasDirtyParent;)
+		{
+			CPathTreeID ParentID = TreeID;
+			ReplaceDepth(ParentID, ParentDepth);
+			HasDirtyParent = std::binary_search(Resolved.begin(), Resolved.end(), ParentID);
+		}
+		if (!HasDirtyParent)
+			GenerationBatchItems.push_back(TreeID);
+	}
+}
+
+void ACPathVolume::OrderGenerationFromSeeds()
+{
+	TArray<FVector> Seeds;
+	for (const FVector& Seed : GenerationSeeds)
+		Seeds.Add(GetActorLocation() + Seed);
+	for (TActorIterator<APlayerStart> PlayerStart(GetWorld()); PlayerStart; ++PlayerStart)
+		Seeds.Add(PlayerStart->GetActorLocation());
+
+	// Without seeds, generation keeps the tiled order of outer indexes
+	std::vector<std::pair<float, uint32>> Ordered;
+	Ordered.reserve(OuterNodeCount);
+	for (uint32 OuterIndex = 0; OuterIndex < OuterNodeCount; OuterIndex++)
+	{
+		if (!IsOuterIndexInVolume(OuterIndex))
+			continue;
+
+		FVector TreeLocation = WorldLocationFromTreeID(OuterIndex);
+		float ClosestSquared = 0.f;
+		if (Seeds.Num())
+		{
+			ClosestSquared = MAX_flt;
+			for (const FVector& Seed : Seeds)
+				ClosestSquared = FMath::Min(ClosestSquared, (float)FVector::DistSquared(TreeLocation, Seed));
+		}
+		Ordered.emplace_back(ClosestSquared, OuterIndex);
+	}
+	std::stable_sort(Ordered.begin(), Ordered.end(), [](const std::pair<float, uint32>& A, const std::pair<float, uint32>& B) { return A.first < B.first; });
+
+	GenerationBatchItems.clear();
+	GenerationBatchItems.reserve(Ordered.size());
+	for (const std::pair<float, uint32>& Item : Ordered)
+		GenerationBatchItems.push_back(Item.second);
+}
+
+void ACPathVolume::ScheduleDirtySubtrees()
+{
+	TArray<FVector> PlayerLocations;
+	for (FConstPlayerControllerIterator Iterator = GetWorld()->GetPlayerControllerIterator(); Iterator; ++Iterator)
+	{
+		APlayerController* Controller = Iterator->Get();
+		if (Controller && Controller->GetPawn())
+			PlayerLocations.Add(Controller->GetPawn()->GetActorLocation());
+	}
+
+	uint32 Clock = RegenerationClock.load();
+	float UpdatesPerSecond = DynamicObstaclesUpdateRate;
+	float RecentPathUpdates = FMath::Max(RecentPathSeconds * UpdatesPerSecond, 1.f);
+	float OuterTreeSize = GetVoxelSizeByDepth(0).GetMax();
+
+	std::vector<std::pair<float, CPathTreeID>> Scheduled;
+	Scheduled.reserve(GenerationBatchItems.size());
+	for (CPathTreeID TreeID : GenerationBatchItems)
+	{
+		uint32 OuterIndex = ExtractOuterIndex(TreeID);
+		float Urgency = 0.f;
+
+		uint32 PathUsed = PathLastUsed[OuterIndex].load(std::memory_order_relaxed);
+		if (PathUsed && Clock - PathUsed < RecentPathUpdates)
+			Urgency += PathUrgency * (1.f - (Clock - PathUsed) / RecentPathUpdates);
+
+		if (PlayerLocations.Num())
+		{
+			FVector Location = WorldLocationFromTreeID(TreeID);
+			float ClosestSquared = MAX_flt;
+			for (const FVector& PlayerLocation : PlayerLocations)
+				ClosestSquared = FMath::Min(ClosestSquared, (float)FVector::DistSquared(Location, PlayerLocation));
+			Urgency += PlayerUrgency / (1.f + FMath::Sqrt(ClosestSquared) / OuterTreeSize);
+		}
+
+		auto DirtySince = OuterDirtySince.find(OuterIndex);
+		if (DirtySince != OuterDirtySince.end())
+			Urgency += WaitingUrgencyPerSecond * (Clock - DirtySince->second) / UpdatesPerSecond;
+
+		Scheduled.emplace_back(Urgency, TreeID);
+	}
+	std::stable_sort(Scheduled.begin(), Scheduled.end(), [](const std::pair<float, CPathTreeID>& A, const std::pair<float, CPathTreeID>& B) { return A.first > B.first; });
+
+	// At least one subtree is always taken, so that a budget smaller than any subtree still makes progress
+	GenerationBatchItems.clear();
+	BatchRegenerationWeight = 0.0;
+	uint32 Taken = 0;
+	for (; Taken < Scheduled.size(); Taken++)
+	{
+		double Weight = GetRegenerationWeight(ExtractDepth(Scheduled[Taken].second));
+		if (Taken > 0 && (BatchRegenerationWeight + Weight) * RegenerationMsPerWeight > RegenerationBudgetMs)
+			break;
+		BatchRegenerationWeight += Weight;
+		GenerationBatchItems.push_back(Scheduled[Taken].second);
+	}
+	BatchStartSeconds = FPlatformTime::Seconds();
+
+	std::unordered_set<uint32> LeftoverOuterTrees;
+	for (uint32 Index = Taken; Index < Scheduled.size(); Index++)
+	{
+		CPathTreeID TreeID = Scheduled[Index].second;
+		uint32 OuterIndex = ExtractOuterIndex(TreeID);
+		LeftoverOuterTrees.insert(OuterIndex);
+		OuterDirtySince.emplace(OuterIndex, Clock);
+
+		// Lazy refinement is requested again, so that the next update still refines the tree instead of refreshing it
+		if (ExtractDepth(TreeID) == 0 && TreesToRefine.erase(OuterIndex))
+			LazyTreesRequested.insert(OuterIndex);
+		else
+			TreesToRegenerate.Add(TreeID);
+	}
+	for (CPathTreeID TreeID : GenerationBatchItems)
+	{
+		if (!LeftoverOuterTrees.count(ExtractOuterIndex(TreeID)))
+			OuterDirtySince.erase(ExtractOuterIndex(TreeID));
+	}
+}
+
+double ACPathVolume::GetRegenerationWeight(uint32 Depth) const
+{
+	return (double)(1ull << (2 * (OctreeDepth - FMath::Min(Depth, (uint32)OctreeDepth))));
+}
+
+void ACPathVolume::NotePathUsage(FVector WorldLocation)
+{
+	if (!PathLastUsed)
+		return;
+
+	FVector XYZ = WorldLocationToLocalCoordsInt3(WorldLocation);
+	if (IsInBounds(XYZ))
+		PathLastUsed[LocalCoordsInt3ToIndex(XYZ)].store(RegenerationClock.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void ACPathVolume::NotePathUsage(const TArray<FCPathNode>& Path)
+{
+	if (!PathLastUsed)
+		return;
+
+	// Smoothed segments can be long, so they are walked in steps of half an outer tree
+	float Step = GetVoxelSizeByDepth(0).GetMin() / 2.f;
+	for (int32 Index = 0; Index < Path.Num(); Index++)
+	{
+		NotePathUsage(Path[Index].WorldLocation);
+		if (Index == 0)
+			continue;
+
+		FVector From = Path[Index - 1].WorldLocation;
+		FVector To = Path[Index].WorldLocation;
+		int32 Steps = FMath::FloorToInt(FVector::Dist(From, To) / Step);
+		for (int32 CurrStep = 1; CurrStep <= Steps; CurrStep++)
+			NotePathUsage(FMath::Lerp(From, To, (float)CurrStep / (Steps + 1)));
+	}
+}
+
+void ACPathVolume::CollapseDirtySubtreeParents()
+{
+	auto HasFreeChild = [this](CPathOctree* Tree, uint32 ChildDepth)
+	{
+		uint64* BrickMasks = UseLeafBricks && ChildDepth == (uint32)OctreeDepth ? CPathOctreeAllocator::GetBlockPayload<uint64>(Tree->Children) : nullptr;
+		for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+		{
+			// Trees only keep children if some of them are free
+			const CPathOctree& Child = Tree->Children[ChildIndex];
+			if (Child.GetIsFree() || Child.Children || (BrickMasks && BrickMasks[ChildIndex]))
+				return true;
+		}
+		return false;
+	};
+
+	auto HasOnlyFreeLeafs = [](CPathOctree* Tree)
+	{
+		for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
+		{
+			const CPathOctree& Child = Tree->Children[ChildIndex];
+			if (!Child.GetIsFree() || Child.Children)
+				return false;
+		}
+		return true;
+	};
+
+	bool Layered = StaticLayer.IsBuilt();
+	CPathOctreeAllocator::ThreadCache Cache(&OctreeAllocator);
+	CPathOctree* Parents[MAX_DEPTH + 1];
+	uint32 StaticIndexes[MAX_DEPTH + 1];
+	for (CPathTreeID TreeID : GenerationBatchItems)
+	{
+		uint32 Depth = ExtractDepth(TreeID);
+		uint32 OuterIndex = ExtractOuterIndex(TreeID);
+		Parents[0] = GetOuterTree(OuterIndex);
+		StaticIndexes[0] = Layered ? OuterIndex : CPATH_INVALID_NODEINDEX;
+		uint32 ParentCount = 1;
+		while (ParentCount < Depth && Parents[ParentCount - 1]->Children)
+		{
+			uint32 ChildIndex = ExtractChildIndex(TreeID, ParentCount);
+			uint32 StaticIndex = StaticIndexes[ParentCount - 1];
+			Parents[ParentCount] = &Parents[ParentCount - 1]->Children[ChildIndex];
+			StaticIndexes[ParentCount] = StaticIndex != CPATH_INVALID_NODEINDEX && StaticLayer.HasChildren(OuterIndex, ParentCount - 1, StaticIndex) ? StaticLayer.GetChild(OuterIndex, ParentCount - 1, StaticIndex, ChildIndex) : CPATH_INVALID_NODEINDEX;
+			ParentCount++;
+		}
+
+		// Already collapsed together with another dirty subtree
+		if (Depth == 0 || !Parents[ParentCount - 1]->Children)
+			continue;
+
+		for (int32 ParentDepth = ParentCount - 1; ParentDepth >= 0; ParentDepth--)
+		{
+			CPathOctree* Parent = Parents[ParentDepth];
+			if (!HasFreeChild(Parent, ParentDepth + 1))
+			{
+				OctreeAllocator.FreeChildren(Parent, Cache, ParentDepth + 1);
+				continue;
+			}
+
+			// Parent was only subdivided because of what the dirty subtree used to contain, so it can be free at its own depth again.
+			// Tested the same way generation tested it, children that are free on their own dont make the parent free.
+			CPathTreeID ParentID = TreeID;
+			ReplaceDepth(ParentID, ParentDepth);
+			if (!HasOnlyFreeLeafs(Parent) || !RecheckDirtySubtreeParent(Parent, ParentID, StaticIndexes[ParentDepth]))
+				break;
+
+			OctreeAllocator.FreeChildren(Parent, Cache, ParentDepth + 1);
+		}
+	}
+}
+
+bool ACPathVolume::RecheckDirtySubtreeParent(CPathOctree* OctreeRef, CPathTreeID TreeID, uint32 StaticIndex)
+{
+	uint32 Depth = ExtractDepth(TreeID);
+	uint32 OuterIndex = ExtractOuterIndex(TreeID);
+	FVector TreeLocation = WorldLocationFromTreeID(TreeID);
+	if (!StaticLayer.IsBuilt())
+		return RecheckOctreeAtDepth(OctreeRef, TreeLocation, Depth);
+
+	// Same as composing, static geometry at this depth is never cleared by obstacles moving away
+	if (StaticIndex != CPATH_INVALID_NODEINDEX && !StaticLayer.GetIsFree(OuterIndex, Depth, StaticIndex))
+		return false;
+
+	FCPathObstacleShapeList Obstacles = GatherDynamicCandidates(TreeLocation, GetVoxelSizeByDepth(Depth) / 2.f);
+	if (Obstacles.size())
+	{
+		for (const FCollisionShape& Shape : TraceShapesByDepth[Depth])
+		{
+			if (OverlapsAnyObstacleShape(Obstacles, TreeLocation, Shape))
+				return false;
+		}
+	}
+
+	if (StaticIndex != CPATH_INVALID_NODEINDEX)
+		OctreeRef->Data = StaticLayer.GetData(OuterIndex, Depth, StaticIndex);
+	else
+		OctreeRef->SetIsFree(true);
+	return true;
+}
+
+void ACPathVolume::StartGenerationBatch(uint32 ItemCount, uint32 GeneratorCount)
+{
+	GenerationBatchItemCount = ItemCount;
+	GenerationBatchGeneratorCount = FMath::Max(GeneratorCount, (uint32)1);
+	NextGenerationBatchItem.store(0);
+	GenerationWorkLeft.store(0);
+	IdleGenerators.store(0);
+	GenerationTasks.clear();
+	QueuedGenerationTasks.store(0);
+}
+
+bool ACPathVolume::TakeGenerationChunk(uint32& First, uint32& Last)
+{
+	// Counted before taking a chunk, so that a generator that sees no chunks left and no work left can be sure the batch is done
+	GenerationWorkLeft++;
+
+	uint32 Taken = NextGenerationBatchItem.load();
+	if (Taken < GenerationBatchItemCount)
+	{
+		// Chunks get smaller towards the end of the batch, so that generators finish at about the same time
+		uint32 ChunkSize = FMath::Clamp((GenerationBatchItemCount - Taken) / (GenerationBatchGeneratorCount * 4), (uint32)1, MaxGenerationChunkSize);
+		First = NextGenerationBatchItem.fetch_add(ChunkSize);
+		if (First < GenerationBatchItemCount)
+		{
+			Last = FMath::Min(First + ChunkSize, GenerationBatchItemCount);
+			return true;
+		}
+	}
+
+	GenerationWorkLeft--;
+	return false;
+}
+
+void ACPathVolume::PushGenerationTasks(FCPathGenerationTask* Tasks, uint32 Count)
+{
+	GenerationWorkLeft += Count;
+
+	FScopeLock Lock(&GenerationTasksLock);
+	for (uint32 i = 0; i < Count; i++)
+	{
+		GenerationTasks.push_back(std::move(Tasks[i]));
+	}
+	QueuedGenerationTasks += Count;
+}
+
+bool ACPathVolume::PopGenerationTask(FCPathGenerationTask& Task)
+{
+	if (!HasQueuedGenerationTasks())
+		return false;
+
+	FScopeLock Lock(&GenerationTasksLock);
+	if (GenerationTasks.empty())
+		return false;
+
+	Task = std::move(GenerationTasks.front());
+	GenerationTasks.pop_front();
+	QueuedGenerationTasks--;
+	return true;
+}
+
+void ACPathVolume::OnGenerationBatchFinished()
+{
+	// Rasterized geometry is a snapshot from when generation started, later batches query the scene
+	GeometryRasterizer.reset();
+
+	// Every batch after the initial one comes from dynamic obstacles
+	if (InitialGenerationCompleteAtom.load())
+	{
+		CollapseDirtySubtreeParents();
+	}
+
+	// Generators can also wait for pathfinders, so this overestimates their time, which only makes the budget stricter
+	if (BatchRegenerationWeight > 0.0)
+	{
+		double BatchMs = (FPlatformTime::Seconds() - BatchStartSeconds) * 1000.0 * GenerationBatchGeneratorCount;
+		double Sample = BatchMs / BatchRegenerationWeight;
+		RegenerationMsPerWeight = RegenerationMsPerWeight > 0.0 ? FMath::Lerp(RegenerationMsPerWeight, Sample, 0.25) : Sample;
+		BatchRegenerationWeight = 0.0;
+	}
+
+	// Only the initial graph is deduplicated, dynamic updates copy shared blocks on write
+	if (UseSubtreeDeduplication && !InitialGenerationCompleteAtom.load())
+	{
+		DeduplicateSubtrees();
+	}
+
+	// The initial graph has no dynamic obstacles yet, so it is the static layer
+	if (UseLayeredOccupancy && !InitialGenerationCompleteAtom.load())
+	{
+		StaticLayer.Build([this](uint32 OuterIndex) { return GetOuterTree(OuterIndex); }, OuterNodeCount, OctreeDepth);
+		StaticLayerBytes.store(StaticLayer.GetAllocatedSize());
+	}
 
-void ACPathVolume::FindLeafsOnSide(uint32 TreeID, ENeighbourDirection Side, std::vector<uint32>* Vector, bool MustBeFree)
-{
-	uint32 TempDepthReached;
-	FindLeafsOnSide(FindTreeByID(TreeID, TempDepthReached), TreeID, Side, Vector, MustBeFree);
-}
+	// Dynamic batches only change the outer trees of their items, boxes and the linear octree are only updated around them
+	std::vector<uint32> BatchOuterIndexes;
+	bool DynamicBatch = InitialGenerationCompleteAtom.load();
+	if (DynamicBatch && (UseFreeSpaceBoxes || UseLinearOctree))
+	{
+		GetBatchOuterIndexes(BatchOuterIndexes);
+	}
 
-void ACPathVolume::FindLeafsOnSide(CPathOctree* Tree, uint32 TreeID, ENeighbourDirection Side, std::vector<uint32>* Vector, bool MustBeFree)
-{
-#if WITH_EDITOR
-	checkf(Tree->Children, TEXT("CPATH - FindAllLeafsOnSide, requested tree has no children"));
-#endif
-	uint8 NewDepth = ExtractDepth(TreeID) + 1;
-	for (uint8 i = 0; i < 4; i++)
+	if (UseFreeSpaceBoxes)
 	{
-		uint8 ChildIndex = LookupTable_ChildrenOnSide[Side][i];
-		CPathOctree* Child = &Tree->Children[ChildIndex];
-		uint32 ChildTreeID = TreeID;
-		ReplaceChildIndexAndDepth(ChildTreeID, NewDepth, ChildIndex);
-		if (Child->Children)
-			FindLeafsOnSide(Child, ChildTreeID, Side, Vector);
+		if (DynamicBatch && OuterFreeBox.size())
+			UpdateFreeBoxes(BatchOuterIndexes);
 		else
-		{
-			if (Child->GetIsFree() || !MustBeFree)
-				Vector->push_back(ChildTreeID);
-		}
+			BuildFreeBoxes();
 	}
-}
 
-void ACPathVolume::FindLeafsOnSide(CPathOctree* Tree, uint32 TreeID, ENeighbourDirection Side, std::vector<CPathAStarNode>* Vector, bool MustBeFree)
-{
-#if WITH_EDITOR
-	checkf(Tree->Children, TEXT("CPATH - FindAllLeafsOnSide, requested tree has no children"));
-#endif
-	uint8 NewDepth = ExtractDepth(TreeID) + 1;
-	for (uint8 i = 0; i < 4; i++)
+	if (UseLinearOctree)
 	{
-		uint8 ChildIndex = LookupTable_ChildrenOnSide[Side][i];
-		CPathOctree* Child = &Tree->Children[ChildIndex];
-		uint32 ChildTreeID = TreeID;
-		ReplaceChildIndexAndDepth(ChildTreeID, NewDepth, ChildIndex);
-		if (Child->Children)
-			FindLeafsOnSide(Child, ChildTreeID, Side, Vector);
+		auto GetTree = [this](uint32 OuterIndex) { return GetOuterTree(OuterIndex); };
+		if (DynamicBatch && LinearOctree.IsBuilt())
+		{
+			LinearOctree.Rebuild(GetTree, BatchOuterIndexes);
+		}
 		else
 		{
-			if (Child->GetIsFree() || !MustBeFree)
-				Vector->push_back(CPathAStarNode(ChildTreeID, Child->Data));
+			LinearOctree.Build(GetTree, OuterNodeCount, OctreeDepth);
 		}
+		LinearOctreeBytes.store(LinearOctree.GetAllocatedSize());
 	}
 }
 
+// Contents of a block of 8 children, with children replaced by indexes of unique blocks
+struct FCPathDedupBlockKey
+{
+	uint32 Data[8];
+
+	// Index of the unique block + 1, 0 if there are no children
+	uint32 Children[8];
+
+	uint64 BrickMasks[8];
+
+	bool operator==(const FCPathDedupBlockKey& Rhs) const
+	{
+		return FMemory::Memcmp(this, &Rhs, sizeof(FCPathDedupBlockKey)) == 0;
+	}
 
+	struct Hash
+	{
+		size_t operator()(const FCPathDedupBlockKey& Key) const
+		{
+			return FCrc::MemCrc32(&Key, sizeof(FCPathDedupBlockKey));
+		}
+	};
+};
 
-inline uint32 ACPathVolume::GetFreeThreadID() const
+// Returns the index of a unique block with the same contents as Block, adding it to UniqueBlocks if its new
+static uint32 DeduplicateBlockRec(const CPathOctree* Block, bool HasBrickMasks, std::vector<FCPathDedupBlockKey>& UniqueBlocks,
+	std::unordered_map<FCPathDedupBlockKey, uint32, FCPathDedupBlockKey::Hash>& IndexByKey)
 {
-	for (int ID = 0; ID < 64; ID++)
+	FCPathDedupBlockKey Key;
+	FMemory::Memzero(&Key, sizeof(FCPathDedupBlockKey));
+	for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
 	{
-		if (!ThreadIDs[ID])
-			return ID;
+		Key.Data[ChildIndex] = Block[ChildIndex].Data;
+		if (Block[ChildIndex].Children)
+			Key.Children[ChildIndex] = DeduplicateBlockRec(Block[ChildIndex].Children, HasBrickMasks, UniqueBlocks, IndexByKey) + 1;
+		if (HasBrickMasks)
+			Key.BrickMasks[ChildIndex] = CPathOctreeAllocator::GetBlockPayload<uint64>(const_cast<CPathOctree*>(Block))[ChildIndex];
 	}
 
-	// This will never return as max number of generation threads is always less than 64
-	return 0;
+	auto Found = IndexByKey.find(Key);
+	if (Found != IndexByKey.end())
+		return Found->second;
+
+	uint32 Index = UniqueBlocks.size();
+	IndexByKey.emplace(Key, Index);
+	UniqueBlocks.push_back(Key);
+	return Index;
 }
 
-void ACPathVolume::CleanFinishedGenerators()
+void ACPathVolume::DeduplicateSubtrees()
 {
-	for (auto Generator = GeneratorThreads.begin(); Generator != GeneratorThreads.end(); Generator++)
+	if (OctreeAllocator.GetFrozenBlockCount())
+		return;
+
+	int64 BlocksBefore = OctreeAllocator.GetAllocatedBlockCount();
+
+	// Children are always added before their parents, so the unique blocks are sorted bottom-up
+	std::vector<FCPathDedupBlockKey> UniqueBlocks;
+	std::unordered_map<FCPathDedupBlockKey, uint32, FCPathDedupBlockKey::Hash> IndexByKey;
+	std::vector<uint32> OuterBlockIndexes(OuterNodeCount, 0);
+	for (uint32 OuterIndex = 0; OuterIndex < OuterNodeCount; OuterIndex++)
+	{
+		CPathOctree* OuterTree = GetOuterTree(OuterIndex);
+		if (OuterTree->Children)
+			OuterBlockIndexes[OuterIndex] = DeduplicateBlockRec(OuterTree->Children, UseLeafBricks, UniqueBlocks, IndexByKey) + 1;
+	}
+	IndexByKey.clear();
+
+	OctreeAllocator.AllocateFrozenBlocks(UniqueBlocks.size());
+	for (uint32 BlockIndex = 0; BlockIndex < UniqueBlocks.size(); BlockIndex++)
 	{
-		ThreadIDs[(*Generator)->GenThreadID] = false;
-		if (!(*Generator)->ThreadRef)
+		const FCPathDedupBlockKey& Key = UniqueBlocks[BlockIndex];
+		CPathOctree* Block = OctreeAllocator.GetFrozenBlock(BlockIndex);
+		for (uint32 ChildIndex = 0; ChildIndex < 8; ChildIndex++)
 		{
-			Generator = GeneratorThreads.erase(Generator);
+			Block[ChildIndex].Data = Key.Data[ChildIndex];
+			Block[ChildIndex].Children = Key.Children[ChildIndex] ? OctreeAllocator.GetFrozenBlock(Key.Children[ChildIndex] - 1) : nullptr;
+			if (UseLeafBricks)
+				CPathOctreeAllocator::GetBlockPayload<uint64>(Block)[ChildIndex] = Key.BrickMasks[ChildIndex];
 		}
 	}
 
+	// Every block that is not frozen is unreachable from now on
+	for (uint32 OuterIndex = 0; OuterIndex < OuterNodeCount; OuterIndex++)
+	{
+		if (OuterBlockIndexes[OuterIndex])
+			GetOuterTree(OuterIndex)->Children = OctreeAllocator.GetFrozenBlock(OuterBlockIndexes[OuterIndex] - 1);
+	}
+	OctreeAllocator.ReleaseSlabs();
+
+	UE_LOG(LogTemp, Log, TEXT("CPATH - Graph Generation:::Deduplicated %lld child blocks into %d"), BlocksBefore, (int)UniqueBlocks.size());
 }
 
-void ACPathVolume::InitialGenerationUpdate()
+void ACPathVolume::RequestLazyGeneration(FVector WorldLocation, float Radius)
 {
-	if (GeneratorsRunning.load() <= 0)
-	{
-		InitialGenerationCompleteAtom.store(true);
-		InitialGenerationFinished = true;
+	if (!UseLazyGeneration || !LazyTreeStates)
+		return;
 
-		for (auto Generator = GeneratorThreads.begin(); Generator != GeneratorThreads.end(); Generator++)
+	FVector Min = WorldLocationToLocalCoordsInt3(WorldLocation - FVector(Radius));
+	FVector Max = WorldLocationToLocalCoordsInt3(WorldLocation + FVector(Radius));
+	for (int X = FMath::Max((int)Min.X, 0); X <= FMath::Min((int)Max.X, (int)NodeCount[0] - 1); X++)
+	{
+		for (int Y = FMath::Max((int)Min.Y, 0); Y <= FMath::Min((int)Max.Y, (int)NodeCount[1] - 1); Y++)
 		{
-			for (int Depth = 0; Depth <= OctreeDepth; Depth++)
+			for (int Z = FMath::Max((int)Min.Z, 0); Z <= FMath::Min((int)Max.Z, (int)NodeCount[2] - 1); Z++)
 			{
-				OctreeCountAtDepth[Depth] += Generator->get()->OctreeCountAtDepth[Depth];
-
+				uint32 OuterIndex = OuterIndexFromCoords(X, Y, Z);
+				if (LazyTreeStates[OuterIndex].load() == LazyCoarse)
+					LazyTreesRequested.insert(OuterIndex);
 			}
 		}
-		for (int Depth = 0; Depth <= OctreeDepth; Depth++)
-		{
-			TotalNodeCount += OctreeCountAtDepth[Depth];
-		}
+	}
+}
 
+void ACPathVolume::TouchOuterTree(uint32 OuterIndex)
+{
+	if (!LazyTreeStates)
+		return;
 
-		CleanFinishedGenerators();
-		GetWorld()->GetTimerManager().ClearTimer(GenerationTimerHandle);
-		if (DynamicObstaclesUpdateRate > 0)
-			GetWorld()->GetTimerManager().SetTimer(GenerationTimerHandle, this, &ACPathVolume::GenerationUpdate, 1.f / DynamicObstaclesUpdateRate, true);
-	}
+	LazyLastTouched[OuterIndex].store(LazyClock.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	std::atomic<uint8>& State = LazyTreeStates[OuterIndex];
+	if (State.load(std::memory_order_acquire) == LazyRefined)
+		return;
 
+	// Free outer trees have no detail to add. Generators are the only ones that change the graph, so the query keeps the tree coarse
+	// and the next update subdivides it, same as with RequestLazyGeneration.
+	if (GetOuterTree(OuterIndex)->GetIsFree())
+		return;
+
+	// Until then the query sees the whole tree as occupied, so it's reported the same way as an ungenerated one
+	ThreadReachedUngenerated = true;
+	if (ThreadReachedCoarseTrees.empty() || ThreadReachedCoarseTrees.back() != OuterIndex)
+		ThreadReachedCoarseTrees.push_back(OuterIndex);
+
+	uint8 Expected = LazyCoarse;
+	if (State.compare_exchange_strong(Expected, LazyTouched))
+	{
+		FScopeLock Lock(&LazyTreesTouchedLock);
+		LazyTreesTouched.push_back(OuterIndex);
+	}
 }
 
-void ACPathVolume::GenerationUpdate()
+uint32 ACPathVolume::GetOuterTreeGenerationDepth(uint32 OuterIndex, std::shared_ptr<const FCPathCandidateList>* OutProbedCandidates)
 {
-#if WITH_EDITOR
-	checkf(GeneratorsRunning.load() >= 0, TEXT("CPATH - Graph Generation:::GenerationUpdate - GeneratorsRunning was negative!!!!!"));
-#endif
-	// Garbage collecting generators that finished their job
-	CleanFinishedGenerators();
+	if (!UseLazyGeneration)
+		return GetOuterTreeMaxDepth(OuterIndex, OutProbedCandidates);
 
+	// Generators never run together with queries, so the state can be changed without a CAS here
+	uint8 State = LazyTreeStates[OuterIndex].load();
+	if (State != LazyRefined && TreesToRefine.count(OuterIndex))
+	{
+		State = LazyRefined;
+		LazyTreeStates[OuterIndex].store(State);
+	}
+	return State == LazyRefined ? GetOuterTreeMaxDepth(OuterIndex, OutProbedCandidates) : 0;
+}
 
+uint32 ACPathVolume::GetOuterTreeMaxDepth(uint32 OuterIndex, std::shared_ptr<const FCPathCandidateList>* OutProbedCandidates)
+{
+	int MaxDepth = OuterMaxDepths.size() ? OuterMaxDepths[OuterIndex] : OctreeDepth;
 
-	// We skip this update if generation from previous update is still running
-	// This can be the cause if we set DynamicObstaclesUpdateRate too high, or when it's initial generation, 
-	// or if there were a lot of pathfinding requests and generators are waiting for them to finish.
-	if (GeneratorsRunning.load() == 0 && TrackedDynamicObstacles.size())
+	// No need to probe if the tree cant go deeper than open space anyway.
+	// Dirty subtrees of one outer tree can be generated at the same time, they would only probe the same thing twice.
+	if (UseDensityProbe && MaxDepth > OpenSpaceMaxDepth)
 	{
-
-		//Drawing previously updated trees
-		/*for (auto TreeID : TreesToRegenerate)
+		uint8 ProbedDepth = ProbedOuterDepths[OuterIndex].load(std::memory_order_relaxed);
+		if (ProbedDepth == CPATH_UNPROBED_DEPTH)
 		{
-			std::vector<uint32> Subtrees;
-			Subtrees.push_back(TreeID);
-			GetAllSubtrees(TreeID, Subtrees);
-			for (auto SubID : Subtrees)
-			{
-				DrawDebugVoxel(SubID, false, 1.f / DynamicObstaclesUpdateRate);
-			}
-		}*/
+			FVector TreeLocation = WorldLocationFromTreeID(OuterIndex);
+			FVector TreeExtent = GetVoxelSizeByDepth(0) / 2.f;
+			std::shared_ptr<const FCPathCandidateList> Components = GatherCandidates(TreeLocation, TreeExtent);
+			ProbedDepth = Components ? FMath::Clamp(ProbeOuterTreeDepth(TreeLocation, TreeExtent, *Components), 0, OctreeDepth) : OctreeDepth;
+			ProbedOuterDepths[OuterIndex].store(ProbedDepth, std::memory_order_relaxed);
+			if (OutProbedCandidates)
+				*OutProbedCandidates = std::move(Components);
+		}
+		MaxDepth = FMath::Min(MaxDepth, (int)ProbedDepth);
+	}
+	return FMath::Clamp(MaxDepth, 0, OctreeDepth);
+}
 
-		// Adding indexes from previous update
-		TreesToRegenerate = TreesToRegeneratePreviousUpdate;
-		TreesToRegeneratePreviousUpdate.clear();
+void ACPathVolume::EvictLazySubtrees()
+{
+	uint64 ResidentLimit = (uint64)(LazyResidentMemoryMB * 1024.0 * 1024.0);
+	if (GetOuterTreeBytes() + OctreeAllocator.GetUsedBytes() <= ResidentLimit)
+		return;
 
-		// Adding new indexes
-		for (auto Obstacle : TrackedDynamicObstacles)
+	// Same handshake as generators, except the game thread cant wait for pathfinders, so this is retried with the next update
+	GeneratorsRunning++;
+	if (PathfindersRunning.load() == 0)
+	{
+		// Last touch and outer index of every tree that can be collapsed, oldest first
+		std::vector<std::pair<uint32, uint32>> Candidates;
+		for (uint32 OuterIndex = 0; OuterIndex < OuterNodeCount; OuterIndex++)
 		{
-			if (IsValid(Obstacle))
-			{
-				Obstacle->AddIndexesToUpdate(this);
-			}
+			CPathOctree* Tree = GetOuterTree(OuterIndex);
+			if (LazyTreeStates[OuterIndex].load() == LazyRefined && Tree->Children && !OctreeAllocator.IsFrozen(Tree->Children))
+				Candidates.emplace_back(LazyLastTouched[OuterIndex].load(), OuterIndex);
 		}
+		std::sort(Candidates.begin(), Candidates.end());
 
-		// Creating threads
-		// In case there is a lot of trees to update, we split the work into multiple threads to make it faster
-		if (TreesToRegenerate.size())
+		// Going a bit below the limit, so that this doesnt have to run with every update
+		uint64 TargetBytes = ResidentLimit / 4 * 3;
+		uint32 Evicted = 0;
+		CPathOctreeAllocator::ThreadCache Cache(&OctreeAllocator);
+		for (const auto& Candidate : Candidates)
 		{
+			if (GetOuterTreeBytes() + OctreeAllocator.GetUsedBytes() <= TargetBytes)
+				break;
 
-			uint32 ThreadCount = FMath::Min(FMath::Min(FPlatformMisc::NumberOfCores(), (int)TreesToRegenerate.size() / OuterIndexesPerThread), MaxGenerationThreads);
-			ThreadCount = FMath::Max(ThreadCount, (uint32)1);
-			uint32 NodesPerThread = (uint32)TreesToRegenerate.size() / ThreadCount;
+			// The outer tree keeps its own Data, which is occupied since it had children
+			OctreeAllocator.FreeChildren(GetOuterTree(Candidate.second), Cache, 1);
+			LazyTreeStates[Candidate.second].store(LazyCoarse);
+			Evicted++;
+		}
+		UE_LOG(LogTemp, Log, TEXT("CPATH - Graph Generation:::Collapsed %d least recently used outer trees"), Evicted);
+	}
+	GeneratorsRunning--;
+}
 
-			// Starting generation
-			for (uint32 CurrentThread = 0; CurrentThread < ThreadCount; CurrentThread++)
-			{
-				uint32 LastIndex = NodesPerThread * (CurrentThread + 1);
-				if (CurrentThread == ThreadCount - 1)
-					LastIndex += TreesToRegenerate.size() % ThreadCount;
-
-				int ThreadID = GetFreeThreadID();
-				FString ThreadName = "CPathGenerator Dynamic, ID: ";
-				ThreadName.AppendInt(ThreadID);
-				GeneratorThreads.push_back(std::make_unique<FCPathAsyncVolumeGenerator>(this, NodesPerThread * CurrentThread, LastIndex, ThreadID, ThreadName, true));
-				GeneratorThreads.back()->ThreadRef = FRunnableThread::Create(GeneratorThreads.back().get(), *ThreadName);
-				if (GeneratorThreads.back()->ThreadRef)
-				{
-					ThreadIDs[ThreadID] = true;
-				}
-				else
-				{
-					GeneratorThreads.pop_back();
-				}
-			}
-			//UE_LOG(LogTemp, Warning, TEXT("GENERATION UPDATE Tracked - %d, Indexes - %d, Threads - %d"), TrackedDynamicObstacles.size(), TreesToRegenerate.size(), ThreadCount);
+FCPathMemoryStats ACPathVolume::GetMemoryStats()
+{
+	FCPathMemoryStats Stats;
+	UpdateMemoryStats(Stats);
+	return Stats;
+}
+
+uint64 ACPathVolume::GetOuterTreeBytes() const
+{
+	uint64 Bytes = OuterBrickMasks.size() * sizeof(uint64);
+	Bytes += OuterFreeBox.size() * sizeof(uint32) + FreeBoxes.size() * sizeof(CPathFreeBox) + FreeBoxSlots.size() * sizeof(uint32);
+	if (LazyTreeStates)
+	{
+		Bytes += (uint64)OuterNodeCount * (sizeof(std::atomic<uint8>) + sizeof(std::atomic<uint32>));
+	}
+	if (UseSparseOuterGrid)
+	{
+		Bytes += (uint64)OuterPageCount * sizeof(std::atomic<CPathOctree*>);
+		Bytes += (uint64)OuterPagesAllocated.load() * OuterPageSize * OuterPageSize * OuterPageSize * sizeof(CPathOctree);
+	}
+	else if (Octrees)
+	{
+		Bytes += (uint64)OuterNodeCount * sizeof(CPathOctree);
+	}
+	return Bytes;
+}
+
+bool ACPathVolume::IsOverMemoryBudget() const
+{
+	return MemoryBudgetBytes && GetOuterTreeBytes() + OctreeAllocator.GetUsedBytes() >= MemoryBudgetBytes;
+}
+
+void ACPathVolume::FillMemoryStats(FCPathMemoryStats& Stats) const
+{
+	int32 MaxDepth = GenerationStarted ? OctreeDepth : -1;
+	Stats.NodeCountAtDepth.SetNumZeroed(MaxDepth + 1);
+	Stats.BytesAtDepth.SetNumZeroed(MaxDepth + 1);
+	if (MaxDepth >= 0)
+	{
+		uint64 OuterBytes = GetOuterTreeBytes();
+		Stats.NodeCountAtDepth[0] = UseSparseOuterGrid ? (int64)OuterPagesAllocated.load() * OuterPageSize * OuterPageSize * OuterPageSize : OuterNodeCount;
+		Stats.BytesAtDepth[0] = OuterBytes;
+		for (int32 Depth = 1; Depth <= MaxDepth; Depth++)
+		{
+			int64 Blocks = OctreeAllocator.GetAllocatedBlockCount(Depth);
+			Stats.NodeCountAtDepth[Depth] = Blocks * 8;
+			Stats.BytesAtDepth[Depth] = Blocks * OctreeAllocator.GetBlockStride();
 		}
+		Stats.TotalBytes += OuterBytes;
+	}
+
+	Stats.ChildBlockCount = OctreeAllocator.GetAllocatedBlockCount();
+	Stats.SharedChildBlockCount = OctreeAllocator.GetFrozenBlockCount();
+	Stats.ReservedChildBlockBytes = OctreeAllocator.GetReservedBytes();
+	Stats.LinearOctreeBytes = LinearOctreeBytes.load();
+	Stats.StaticLayerBytes = StaticLayerBytes.load();
+	for (const std::unique_ptr<CPathAttributeLayer>& Layer : AttributeLayers)
+	{
+		Stats.AttributeLayerBytes += Layer->GetAllocatedSize();
+	}
+	Stats.PathfindingScratchBytes = PathfindingScratchBytes.load();
+	Stats.SearchesInFlight = SearchesInFlight.load();
+	Stats.TotalBytes += Stats.ReservedChildBlockBytes + Stats.LinearOctreeBytes + Stats.StaticLayerBytes + Stats.AttributeLayerBytes + Stats.PathfindingScratchBytes;
+	Stats.PeakTotalBytes = FMath::Max(PeakMemoryBytes.load(), Stats.TotalBytes);
+	Stats.MemoryBudgetReached = MemoryBudgetReached.load();
+}
+
+void ACPathVolume::UpdateMemoryStats(FCPathMemoryStats& Stats)
+{
+	FillMemoryStats(Stats);
+
+	int64 PrevPeak = PeakMemoryBytes.load();
+	while (PrevPeak < Stats.TotalBytes && !PeakMemoryBytes.compare_exchange_weak(PrevPeak, Stats.TotalBytes));
+
+	TotalNodeCount = 0;
+	for (int32 Depth = 0; Depth < Stats.NodeCountAtDepth.Num(); Depth++)
+	{
+		OctreeCountAtDepth[Depth] = Stats.NodeCountAtDepth[Depth];
+		TotalNodeCount += Stats.NodeCountAtDepth[Depth];
 	}
+
+	// Stats are shared by all volumes, so every volume only adds its own difference
+	int64 StatBytes[3] = { Stats.TotalBytes - Stats.LinearOctreeBytes - Stats.PathfindingScratchBytes, Stats.LinearOctreeBytes, Stats.PathfindingScratchBytes };
+	INC_MEMORY_STAT_BY(STAT_CPathGraphMemory, StatBytes[0] - ReportedStatBytes[0]);
+	INC_MEMORY_STAT_BY(STAT_CPathLinearOctreeMemory, StatBytes[1] - ReportedStatBytes[1]);
+	INC_MEMORY_STAT_BY(STAT_CPathPathfindingScratchMemory, StatBytes[2] - ReportedStatBytes[2]);
+	FMemory::Memcpy(ReportedStatBytes, StatBytes, sizeof(StatBytes));
 }
 
 void ACPathVolume::CalcFitness(CPathAStarNode& Node, FVector TargetLocation, int32 UserData)
@@ -1035,12 +3003,25 @@ void ACPathVolume::CalcFitness(CPathAStarNode& Node, FVector TargetLocation, int
 bool ACPathVolume::RecheckOctreeAtDepth(CPathOctree* OctreeRef, FVector TreeLocation, uint32 Depth)
 {
 	bool IsFree = true;
-	for (auto Shape : TraceShapesByDepth[Depth])
+	TOptional<bool> PrefetchedOverlap = GetThreadPrefetchedOverlap();
+	if (PrefetchedOverlap.IsSet())
+	{
+		IsFree = !PrefetchedOverlap.GetValue();
+	}
+	else if (GeometryRasterizer)
+	{
+		IsFree = !IsRasterizedNodeOccupied(TreeLocation, GetVoxelSizeByDepth(Depth) / 2.f, TraceShapesByDepth[Depth]);
+	}
+	else
 	{
-		if (GetWorld()->OverlapAnyTestByChannel(TreeLocation, FQuat(FRotator(0)), TraceChannel, Shape))
+		const FCPathCandidateList* Candidates = GetThreadCandidates();
+		for (const FCollisionShape& Shape : TraceShapesByDepth[Depth])
 		{
-			IsFree = false;
-			break;
+			if (Candidates ? OverlapsAnyCandidate(*Candidates, TreeLocation, Shape) : GetWorld()->OverlapAnyTestByChannel(TreeLocation, FQuat(FRotator(0)), TraceChannel, Shape, StaticQueryParams))
+			{
+				IsFree = false;
+				break;
+			}
 		}
 	}
 
@@ -1049,6 +3030,197 @@ bool ACPathVolume::RecheckOctreeAtDepth(CPathOctree* OctreeRef, FVector TreeLoca
 	return IsFree;
 }
 
+bool ACPathVolume::IsOuterPageEmpty(FVector PageCenter, FVector PageExtent)
+{
+	// Agent shapes of outer trees on the border reach outside of the page
+	FCollisionShape PageShape = FCollisionShape::MakeBox(PageExtent + GetAgentExtent());
+	return !GetWorld()->OverlapAnyTestByChannel(PageCenter, FQuat::Identity, TraceChannel, PageShape, StaticQueryParams);
+}
+
+static thread_local const FCPathCandidateList* ThreadCandidates = nullptr;
+
+const FCPathCandidateList* ACPathVolume::GetThreadCandidates()
+{
+	return ThreadCandidates;
+}
+
+void ACPathVolume::SetThreadCandidates(const FCPathCandidateList* Candidates)
+{
+	ThreadCandidates = Candidates;
+}
+
+static thread_local TOptional<bool> ThreadPrefetchedOverlap;
+
+TOptional<bool> ACPathVolume::GetThreadPrefetchedOverlap()
+{
+	return ThreadPrefetchedOverlap;
+}
+
+void ACPathVolume::SetThreadPrefetchedOverlap(TOptional<bool> Overlap)
+{
+	ThreadPrefetchedOverlap = Overlap;
+}
+
+void ACPathVolume::OnAsyncOverlapCompleted(const FTraceHandle& Handle, FOverlapDatum& Datum)
+{
+	if (AsyncQueryGenerator)
+		AsyncQueryGenerator->OnOverlapCompleted(Handle, Datum);
+}
+
+std::shared_ptr<const FCPathCandidateList> ACPathVolume::GatherCandidates(FVector TreeLocation, FVector TreeExtent) const
+{
+	TArray<FOverlapResult> Overlaps;
+	FCollisionShape TreeShape = FCollisionShape::MakeBox(TreeExtent + GetAgentExtent());
+	GetWorld()->OverlapMultiByChannel(Overlaps, TreeLocation, FQuat::Identity, TraceChannel, TreeShape, StaticQueryParams);
+
+	std::shared_ptr<FCPathCandidateList> Candidates = std::make_shared<FCPathCandidateList>();
+	Candidates->reserve(Overlaps.Num());
+	for (const FOverlapResult& Overlap : Overlaps)
+	{
+		UPrimitiveComponent* Component = Overlap.GetComponent();
+		if (!Component)
+			continue;
+
+		// The game thread can move it while its tested, only the physics scene can be queried for it safely
+		if (Component->Mobility != EComponentMobility::Static)
+			return nullptr;
+		Candidates->emplace_back(Component, Component->Bounds.GetBox());
+	}
+	return Candidates;
+}
+
+bool ACPathVolume::OverlapsAnyCandidate(const FCPathCandidateList& Candidates, FVector Location, const FCollisionShape& Shape) const
+{
+	for (const auto& Candidate : Candidates)
+	{
+		// Destroyed since the candidates were gathered, it cant block anything anymore
+		UPrimitiveComponent* Component = Candidate.first.Get();
+		if (Component && Component->OverlapComponent(Location, FQuat::Identity, Shape))
+			return true;
+	}
+	return false;
+}
+
+void ACPathVolume::IgnoreDynamicObstacleActors()
+{
+	StaticQueryParams = FCollisionQueryParams(SCENE_QUERY_STAT(CPathStaticGeometry));
+
+	// Obstacles that are not active yet are ignored as well, they will be added by dynamic updates once they are tracked
+	TArray<AActor*> Actors;
+	VolumeBox->GetOverlappingActors(Actors);
+	for (AActor* Actor : Actors)
+	{
+		if (Actor && Actor->FindComponentByClass<UCPathDynamicObstacle>())
+			StaticQueryParams.AddIgnoredActor(Actor);
+	}
+	for (auto& Tracked : TrackedDynamicObstacles)
+	{
+		UCPathDynamicObstacle* Obstacle = Tracked.first;
+		if (IsValid(Obstacle) && Obstacle->GetOwner())
+			StaticQueryParams.AddIgnoredActor(Obstacle->GetOwner());
+	}
+}
+
+void ACPathVolume::GatherDynamicObstacleShapes()
+{
+	DynamicObstacleShapes.clear();
+	TArray<UPrimitiveComponent*> Components;
+	std::vector<FCPathObstacleShape> Shapes;
+	for (auto& Tracked : TrackedDynamicObstacles)
+	{
+		UCPathDynamicObstacle* Obstacle = Tracked.first;
+		if (!IsValid(Obstacle) || !Obstacle->GetOwner())
+			continue;
+
+		Obstacle->GetOwner()->GetComponents<UPrimitiveComponent>(Components);
+		for (UPrimitiveComponent* Component : Components)
+		{
+			// Scene queries of the static layer return overlapping components as well as blocking ones, so both make a node occupied here too
+			if (!Component->IsQueryCollisionEnabled() || Component->GetCollisionResponseToChannel(TraceChannel) == ECR_Ignore)
+				continue;
+
+			Shapes.clear();
+			UCPathDynamicObstacle::GetComponentShapes(Component, Shapes);
+			for (const FCPathObstacleShape& Shape : Shapes)
+				DynamicObstacleShapes.emplace_back(Shape, Shape.GetBounds());
+		}
+	}
+}
+
+FCPathObstacleShapeList ACPathVolume::GatherDynamicCandidates(FVector TreeLocation, FVector TreeExtent) const
+{
+	FBox TreeBox = FBox::BuildAABB(TreeLocation, TreeExtent + GetAgentExtent());
+
+	FCPathObstacleShapeList Obstacles;
+	for (const auto& Obstacle : DynamicObstacleShapes)
+	{
+		if (Obstacle.second.Intersect(TreeBox))
+			Obstacles.push_back(Obstacle.first);
+	}
+	return Obstacles;
+}
+
+bool ACPathVolume::OverlapsAnyObstacleShape(const FCPathObstacleShapeList& Obstacles, FVector Location, const FCollisionShape& Shape) const
+{
+	FVector Extent = Shape.GetExtent();
+	for (const FCPathObstacleShape& Obstacle : Obstacles)
+	{
+		if (Obstacle.OverlapsBox(Location, Extent))
+			return true;
+	}
+	return false;
+}
+
+void ACPathVolume::BuildGeometryRasterizer()
+{
+	// A single query for the whole volume, the rasterizer bins everything it gets into outer trees
+	TArray<FOverlapResult> Overlaps;
+	FCollisionShape VolumeShape = FCollisionShape::MakeBox(VolumeBox->GetScaledBoxExtent() + GetAgentExtent());
+	GetWorld()->OverlapMultiByChannel(Overlaps, GetActorLocation(), FQuat::Identity, TraceChannel, VolumeShape, StaticQueryParams);
+
+	TArray<UPrimitiveComponent*> Components;
+	for (const FOverlapResult& Overlap : Overlaps)
+	{
+		if (UPrimitiveComponent* Component = Overlap.GetComponent())
+			Components.AddUnique(Component);
+	}
+
+	FVector OuterSize = GetVoxelSizeByDepth(0);
+	GeometryRasterizer = std::make_unique<CPathGeometryRasterizer>();
+	GeometryRasterizer->Build(Components, StartPosition - OuterSize / 2.f, OuterSize, FIntVector(NodeCount[0], NodeCount[1], NodeCount[2]), GetAgentExtent());
+}
+
+bool ACPathVolume::IsRasterizedNodeOccupied(FVector Location, FVector Extent, const std::vector<FCollisionShape>& Shapes) const
+{
+	// The agent shape at the node's center is approximated by its bounding box
+	if (GeometryRasterizer->IsBoxOccupied(Location, Extent.ComponentMax(GetAgentExtent())))
+		return true;
+
+	if (const FCPathCandidateList* Fallback = GeometryRasterizer->GetFallbackComponents(Location))
+	{
+		for (const FCollisionShape& Shape : Shapes)
+		{
+			if (OverlapsAnyCandidate(*Fallback, Location, Shape))
+				return true;
+		}
+	}
+	return false;
+}
+
+int ACPathVolume::ProbeOuterTreeDepth(FVector TreeLocation, FVector TreeExtent, const FCPathCandidateList& Components)
+{
+	FBox TreeBox = FBox::BuildAABB(TreeLocation, TreeExtent + GetAgentExtent());
+
+	// A single big mesh covers most of the tree, while a few small props in open space dont. Bounds that overlap each other are counted twice,
+	// so this only errs towards full detail.
+	double Occupied = 0.0;
+	for (const auto& Candidate : Components)
+	{
+		Occupied += Candidate.second.Overlap(TreeBox).GetVolume();
+	}
+	return Occupied <= OpenSpaceMaxOccupancy * TreeBox.GetVolume() ? OpenSpaceMaxDepth : OctreeDepth;
+}
+
 const FVector ACPathVolume::LookupTable_ChildPositionOffsetMaskByIndex[8] = {
 	{-1, -1, -1},
 	{-1, 1, -1},
@@ -1092,3 +3264,29 @@ const int8 ACPathVolume::LookupTable_ChildrenOnSide[6][4] = {
 
 const int8 ACPathVolume::LookupTable_OppositeSide[6] = {
 	2, 3, 0, 1, 5, 4 };
+
+// Returns bits of a brick mask, whose sub-voxel coordinate on Axis (0 - X, 1 - Y, 2 - Z) is equal to Coord
+static constexpr uint64 ComputeBrickSideMask(uint32 Axis, uint32 Coord)
+{
+	uint64 Mask = 0;
+	for (uint32 Bit = 0; Bit < 64; Bit++)
+	{
+		uint32 FirstIndex = Bit >> 3;
+		uint32 SecondIndex = Bit & 7;
+		uint32 Coords[3] = {
+			((FirstIndex >> 2) & 1) * 2 + ((SecondIndex >> 2) & 1),
+			(FirstIndex & 1) * 2 + (SecondIndex & 1),
+			((FirstIndex >> 1) & 1) * 2 + ((SecondIndex >> 1) & 1) };
+		if (Coords[Axis] == Coord)
+			Mask |= uint64(1) << Bit;
+	}
+	return Mask;
+}
+
+const uint64 ACPathVolume::LookupTable_BrickSideMask[6] = {
+	ComputeBrickSideMask(1, 0),
+	ComputeBrickSideMask(0, 0),
+	ComputeBrickSideMask(1, 3),
+	ComputeBrickSideMask(0, 3),
+	ComputeBrickSideMask(2, 0),
+	ComputeBrickSideMask(2, 3) };
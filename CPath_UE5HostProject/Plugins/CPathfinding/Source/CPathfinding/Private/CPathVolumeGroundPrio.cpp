@@ -13,7 +13,7 @@ void ACPathVolumeGroundPrio::CalcFitness(CPathAStarNode& Node, FVector TargetLoc
 	float CurrDistance = FVector::Distance(Node.WorldLocation, TargetLocation);
 
 
-	if (CurrDistance > VoxelSize && !ExtractIsGroundFromData(Node.TreeUserData))
+	if (CurrDistance > VoxelSize && !IsGroundNode(Node))
 	{
 		Node.DistanceSoFar += UserData;
 	}
@@ -33,14 +33,32 @@ bool ACPathVolumeGroundPrio::RecheckOctreeAtDepth(CPathOctree* OctreeRef, FVecto
 	if (IsFree)
 	{
 		// Checking if this is a ground node
-		uint32 IsGround = GetWorld()->LineTraceTestByChannel(TreeLocation, FVector(TreeLocation.X, TreeLocation.Y, TreeLocation.Z - VoxelSize*1.49), TraceChannel);
+		uint8 IsGround = GetWorld()->LineTraceTestByChannel(TreeLocation, FVector(TreeLocation.X, TreeLocation.Y, TreeLocation.Z - GetLeafVoxelHeight()*1.49), TraceChannel);
 		
-		// Setting IsGround to 2nd bit in tree's data
-		OctreeRef->Data &= 0xFFFFFFFD;
-		OctreeRef->Data |= (IsGround << 1);
+		// Node indexes are reused, so the value is written even when its 0
+		SetAttribute<uint8>(GroundLayer, OctreeRef->NodeIndex, IsGround);
+	}
+	else
+	{
+		// A node that was free before can still have its flag, and sub-voxels of bricks read the flag of their leaf
+		ClearAttribute(GroundLayer, OctreeRef->NodeIndex);
 	}
 
 
 	return IsFree;
 	
 }
+
+void ACPathVolumeGroundPrio::RegisterAttributeLayers()
+{
+	Super::RegisterAttributeLayers();
+	GroundLayer = RegisterAttributeLayer<uint8>(TEXT("Ground"));
+}
+
+bool ACPathVolumeGroundPrio::IsOuterPageEmpty(FVector PageCenter, FVector PageExtent)
+{
+	float GroundTraceLength = GetLeafVoxelHeight() * 1.49;
+	PageCenter.Z -= GroundTraceLength / 2.f;
+	PageExtent.Z += GroundTraceLength / 2.f;
+	return Super::IsOuterPageEmpty(PageCenter, PageExtent);
+}
@@ -1,18 +1,26 @@
 // Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
 
 #include "CPathfinding.h"
+#include "CPathGenerationPool.h"
 
 #define LOCTEXT_NAMESPACE "FCPathfindingModule"
 
+FCPathGenerationPool* FCPathfindingModule::GenerationPool = nullptr;
+
 void FCPathfindingModule::StartupModule()
 {
 	// This code will execute after your module is loaded into memory; the exact timing is specified in the .uplugin file per-module
+
+	// Workers are only started once the first volume starts generating
+	GenerationPool = new FCPathGenerationPool();
 }
 
 void FCPathfindingModule::ShutdownModule()
 {
 	// This function may be called during shutdown to clean up your module.  For modules that support dynamic reloading,
 	// we call this function before unloading the module.
+	delete GenerationPool;
+	GenerationPool = nullptr;
 }
 
 #undef LOCTEXT_NAMESPACE
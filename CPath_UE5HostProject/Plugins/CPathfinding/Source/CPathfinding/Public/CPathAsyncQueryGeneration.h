@@ -0,0 +1,87 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "WorldCollision.h"
+#include "CPathOctreeAllocator.h"
+#include "Async/Future.h"
+#include <vector>
+
+class ACPathVolume;
+class CPathOctree;
+
+// Initial generation through the async scene query API (see ACPathVolume::UseAsyncOverlapQueries).
+// Instead of recursing depth first, every node of a depth is queried at once with AsyncOverlapByChannel,
+// and once all results are in, only occupied nodes get their children queried in the next batch.
+// Driven by the game thread, results are delivered by the world's async trace processing. Results are processed on a worker thread,
+// since RecheckOctreeAtDepth overrides and the density probe can query the scene themselves.
+class CPATHFINDING_API FCPathAsyncQueryGenerator
+{
+public:
+	FCPathAsyncQueryGenerator(ACPathVolume* Volume);
+
+	// Waits for processing that is still running
+	~FCPathAsyncQueryGenerator();
+
+	// Gathers outer trees of the volume on a worker, they are queried by the first Update after that
+	void Start();
+
+	// Called periodically. Once all queries of the current depth returned, nodes are set free or occupied on a worker,
+	// and once that's done children of occupied ones are queried. Returns true once the whole graph is generated.
+	bool Update();
+
+	// Called by the volume for every finished query
+	void OnOverlapCompleted(const FTraceHandle& Handle, FOverlapDatum& Datum);
+
+private:
+
+	struct FQueryNode
+	{
+		CPathOctree* Tree = nullptr;
+		FVector Location;
+
+		// How deep the outer tree of this node is generated
+		uint8 GenerationDepth = 0;
+
+		// Any shape of the node overlapped something
+		bool Overlapped = false;
+
+		// Free, or has free nodes below it, same as the return value of FCPathAsyncVolumeGenerator::RefreshTreeRec
+		bool HasFree = false;
+
+		// Index of the first of 8 children in the next depth, or -1 if the node was not subdivided
+		int32 FirstChild = -1;
+	};
+
+	// Nodes of depth 0, GetOuterTreeGenerationDepth can probe the scene with UseDensityProbe
+	void GatherOuterTrees();
+
+	void QueryDepth(uint32 Depth);
+
+	// Sets nodes of a depth free or occupied with RecheckOctreeAtDepth, and adds children of occupied ones to the next depth
+	void ProcessDepth(uint32 Depth);
+
+	// Bottom-up, children of trees with no free nodes are freed, as in RefreshTreeRec
+	void FinishTrees();
+
+	ACPathVolume* VolumeRef;
+
+	CPathOctreeAllocator::ThreadCache AllocatorCache;
+
+	// Nodes of every depth queried so far
+	std::vector<std::vector<FQueryNode>> Levels;
+
+	uint32 CurrentDepth = 0;
+
+	uint32 QueriesInFlight = 0;
+
+	// Processing of the last depth (or gathering of outer trees) on a worker, invalid while queries are in flight
+	TFuture<void> Processing;
+
+	// Set by the worker once there is nothing left to query
+	bool Finished = false;
+
+	// Nodes processed at every depth, same as in FCPathAsyncVolumeGenerator
+	uint32 OctreeCountAtDepth[MAX_DEPTH + 1] = {};
+};
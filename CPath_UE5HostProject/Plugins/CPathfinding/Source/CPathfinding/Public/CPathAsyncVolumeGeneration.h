@@ -5,11 +5,61 @@
 #include "CoreMinimal.h"
 #include "Core/Public/HAL/Runnable.h"
 #include "Core/Public/HAL/RunnableThread.h"
+#include "CPathDefines.h"
+#include "CPathOctreeAllocator.h"
+#include "CPathDynamicObstacle.h"
+#include <memory>
+#include <atomic>
+#include <vector>
 
 class ACPathVolume;
 class CPathOctree;
+class UPrimitiveComponent;
 
+// Static components that can overlap an outer tree, gathered with a single query per tree (see ACPathVolume::UseCandidatePruning).
+// Lists are shared by tasks that can outlive the components, so they are held weakly and destroyed ones are skipped.
+// Generators hold a FGCScopeGuard while they run, so resolving them on a worker is safe. Bounds are taken when the list is gathered.
+typedef std::vector<std::pair<TWeakObjectPtr<UPrimitiveComponent>, FBox>> FCPathCandidateList;
 
+// Collision of dynamic obstacles that can overlap a tree. Taken on the game thread, so workers never read a transform that is being written.
+typedef std::vector<FCPathObstacleShape> FCPathObstacleShapeList;
+
+
+// A tree whose children were handed out as separate generation tasks.
+// Whichever generator finishes the last child also finishes the tree, the same way RefreshTreeRec does after its children.
+struct FCPathSubtreeJoin
+{
+	CPathOctree* Tree = nullptr;
+
+	// Depth of the children
+	uint32 Depth = 0;
+
+	std::atomic<uint32> ChildrenLeft = 8;
+	std::atomic<uint32> FreeChildren = 0;
+
+	// Set if Tree itself is a child of a split tree
+	std::shared_ptr<FCPathSubtreeJoin> Parent;
+
+	// Outer tree the split subtree belongs to
+	uint32 OuterIndex = 0;
+};
+
+// A subtree that any generator of the batch can pick up, see ACPathVolume::PushGenerationTasks
+struct FCPathGenerationTask
+{
+	CPathOctree* Tree = nullptr;
+	uint32 Depth = 0;
+	FVector Location;
+	uint64* BrickMask = nullptr;
+
+	// GenerationDepth of the outer tree it belongs to
+	uint32 GenerationDepth = 0;
+
+	std::shared_ptr<FCPathSubtreeJoin> Join;
+
+	// Candidates of the outer tree it belongs to, null if they were not gathered
+	std::shared_ptr<const FCPathCandidateList> Candidates;
+};
 
 
 class CPATHFINDING_API FCPathAsyncVolumeGenerator : public FRunnable
@@ -17,8 +67,9 @@ class CPATHFINDING_API FCPathAsyncVolumeGenerator : public FRunnable
 
 
 public:
-	// Geneated trees in range Start(inclusive) - End(not inclusive). If Obstacles = true, it takes from Volume->TreesToRegenerate, if not, it takes from Volume->Octrees (default)
-	FCPathAsyncVolumeGenerator(ACPathVolume* Volume, uint32 StartIndex, uint32 EndIndex, uint8 ThreadID, FString ThreadName, bool Obstacles = false);
+	// Takes chunks of the volume's current batch until none are left. Run by FCPathGenerationPool, ThreadID is only used in its Name. If Obstacles = true, the batch is Volume->GenerationBatchItems (subtrees from TreesToRegenerate),
+	// if not, it is every outer tree, or every outer page with Volume->UseSparseOuterGrid.
+	FCPathAsyncVolumeGenerator(ACPathVolume* Volume, uint8 ThreadID, FString ThreadName, bool Obstacles = false);
 
 	// Not used for now
 	FCPathAsyncVolumeGenerator(ACPathVolume* Volume);
@@ -36,29 +87,101 @@ public:
 	// The main generating function, generated/regenerates the whole octree at given index
 	void RefreshTree(uint32 OuterIndex);
 
-	bool bStop = false;
+	// Generates item Index of the current batch
+	void RefreshBatchItem(uint32 Index);
+
+	// Regenerates a dirty subtree of dynamic obstacles, which MUST exist. Its parents are fixed up by the volume once the batch is done.
+	void RefreshDirtySubtree(CPathTreeID TreeID);
+
+	// Generates all trees of an outer page, unless the page is empty. Only for UseSparseOuterGrid.
+	void RefreshPage(uint32 PageIndex);
+
+	// Regenerates an outer tree with UseLayeredOccupancy, from the static layer and the dynamic obstacles overlapping it
+	void ComposeTree(uint32 OuterIndex);
+
+	std::atomic_bool bStop = false;
 	bool bObstacles = false;
 
-	FRunnableThread* ThreadRef = nullptr;
+	enum EPoolState : uint8
+	{
+		PoolNotQueued,
+		PoolQueued,
+		PoolRunning,
+		// Run returned, the generator can be destroyed
+		PoolFinished
+	};
+
+	// Where the generator is in FCPathGenerationPool, as in EPoolState
+	std::atomic<uint8> PoolState = PoolNotQueued;
+
+	// Set if the last Run returned without doing anything because pathfinders were running, the pool queues it again
+	bool bYielded = false;
 
 	uint8 GenThreadID;
 
 	FString Name = "";
 
-	uint32 OctreeCountAtDepth[4] = { 0, 0, 0, 0 };
+	uint32 OctreeCountAtDepth[MAX_DEPTH + 1] = {};
 
 
 protected:
 
 	ACPathVolume* VolumeRef;
 
-	uint32 FirstIndex = 0;
-	uint32 LastIndex = 0;
+	// This generator's free list of child blocks, taken from Volume's OctreeAllocator
+	CPathOctreeAllocator::ThreadCache AllocatorCache;
 
 	bool bIncreasedGenRunning = false;
 
-	// Gets called by RefreshTree. Returns true if ANY child is free
-	bool RefreshTreeRec(CPathOctree* OctreeRef, uint32 Depth, FVector TreeLocation);
+	// Counted in Volume->IdleGenerators
+	bool bIdle = false;
+
+	void SetIdle(bool Idle);
+
+	// How deep the current outer tree is generated, see ACPathVolume::GetOuterTreeGenerationDepth
+	uint32 GenerationDepth = 0;
+
+	// Gets called by RefreshTree. Returns true if ANY child is free.
+	// BrickMask is where the brick of this tree is stored if it ends up as an occupied leaf at OctreeDepth, null if bricks are not used
+	// With CanSplit, children of a deep tree may be handed out as tasks instead (see SplitSubtree), the return value is meaningless then.
+	bool RefreshTreeRec(CPathOctree* OctreeRef, uint32 Depth, FVector TreeLocation, uint64* BrickMask = nullptr, bool CanSplit = false);
+
+	// Gets called by ComposeTree. Only nodes overlapping a dynamic obstacle are tested and subdivided, the rest are copied from the static layer.
+	// StaticIndex is the index of the same node in Volume->StaticLayer at Depth within the outer tree OuterIndex, CPATH_INVALID_NODEINDEX if it's below a statically free leaf.
+	// Returns true if ANY child is free, same as RefreshTreeRec.
+	bool ComposeTreeRec(CPathOctree* OctreeRef, uint32 Depth, FVector TreeLocation, uint32 OuterIndex, uint32 StaticIndex, const FCPathObstacleShapeList& Obstacles);
+
+	// Makes the subtree the same as in the static layer. Returns true if ANY child is free.
+	bool CopyStaticSubtree(CPathOctree* OctreeRef, uint32 Depth, uint32 OuterIndex, uint32 StaticIndex);
+
+	// Generates a subtree that is the root of a task (or an outer tree), and reports the result to Parent once the whole subtree is done.
+	// Candidates are used by RecheckOctreeAtDepth on this thread while the subtree is generated.
+	void RefreshSubtree(CPathOctree* OctreeRef, uint32 Depth, FVector TreeLocation, uint64* BrickMask, std::shared_ptr<FCPathSubtreeJoin> Parent,
+		std::shared_ptr<const FCPathCandidateList> Candidates);
+
+	// Gathers candidates of a tree at Depth if UseCandidatePruning is enabled and the tree goes below its depth.
+	// Gathered are candidates of the same tree that were already queried for something else, they are returned instead of querying again.
+	std::shared_ptr<const FCPathCandidateList> GatherTreeCandidates(FVector TreeLocation, uint32 Depth, std::shared_ptr<const FCPathCandidateList> Gathered = nullptr) const;
+
+	// Subtrees at least this many depths above GenerationDepth can be split
+	static constexpr uint32 MinSplitLevels = 2;
+
+	// True if children at Depth should be handed out as tasks, because some generators of the batch have nothing to do
+	bool ShouldSplit(uint32 Depth) const;
+
+	// Hands out the children of OctreeRef as tasks. Depth is the depth of the children.
+	void SplitSubtree(CPathOctree* OctreeRef, uint32 Depth, FVector TreeLocation, uint64* ChildBrickMasks);
+
+	// Reports the result of one child of Join, finishing Join (and its parents) if it was the last one
+	void CompleteSubtree(std::shared_ptr<FCPathSubtreeJoin> Join, bool IsFree);
+
+	// Parent of the task being generated, and whether its result will be reported later by SplitSubtree
+	std::shared_ptr<FCPathSubtreeJoin> TaskParent;
+	std::shared_ptr<const FCPathCandidateList> TaskCandidates;
+	bool bTaskSplit = false;
+
+	// Outer tree of the task being generated, so that initial generation can tell the volume once the whole tree is done
+	uint32 TaskOuterIndex = 0;
 
 
 public:
@@ -0,0 +1,89 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+#include "CPathDefines.h"
+#include <atomic>
+#include <memory>
+
+// Values of a single per node attribute (a cost, a flag, clearance...), stored apart from the octree and indexed by CPathOctree::NodeIndex.
+// Values are kept in pages that are allocated the first time a node on them is written, so generators can write from many threads
+// while the layer grows, and searches that dont read this layer never touch its memory. The page table itself is allocated
+// in chunks the same way, so a layer only costs memory for the range of node indexes the volume's allocator actually hands out.
+// Values of nodes that were never written are zero. CPathOctreeAllocator clears values of freed nodes, since their indexes are reused.
+class CPATHFINDING_API CPathAttributeLayer
+{
+public:
+	CPathAttributeLayer(FName InName, uint32 InElementSize);
+
+	~CPathAttributeLayer();
+
+	CPathAttributeLayer(const CPathAttributeLayer&) = delete;
+	CPathAttributeLayer& operator=(const CPathAttributeLayer&) = delete;
+
+	static constexpr uint32 NodesPerPage = 1 << 16;
+
+	// Enough pages for every possible NodeIndex
+	static constexpr uint32 PageCount = (uint32)(((uint64)MAX_uint32 + 1) / NodesPerPage);
+
+	// Pointers to pages are allocated in chunks of this many
+	static constexpr uint32 PagesPerChunk = 256;
+	static constexpr uint32 ChunkCount = PageCount / PagesPerChunk;
+
+	// Returns the value of a node, or null if its page wasnt written to yet
+	inline const uint8* Find(uint32 NodeIndex) const
+	{
+		if (NodeIndex == CPATH_INVALID_NODEINDEX)
+			return nullptr;
+		uint32 PageIndex = NodeIndex / NodesPerPage;
+		const std::atomic<uint8*>* Chunk = Chunks[PageIndex / PagesPerChunk].load(std::memory_order_acquire);
+		if (!Chunk)
+			return nullptr;
+		const uint8* Page = Chunk[PageIndex % PagesPerChunk].load(std::memory_order_acquire);
+		return Page ? Page + (SIZE_T)(NodeIndex % NodesPerPage) * ElementSize : nullptr;
+	}
+
+	// Returns the value of a node to write to, allocating its page if needed. Thread safe.
+	uint8* FindOrAdd(uint32 NodeIndex);
+
+	// Sets the value of a node back to zero, without allocating anything if its page doesnt exist
+	inline void Clear(uint32 NodeIndex)
+	{
+		if (uint8* Value = const_cast<uint8*>(Find(NodeIndex)))
+			FMemory::Memzero(Value, ElementSize);
+	}
+
+	// True if both nodes have the same value
+	bool IsEqual(uint32 NodeIndexA, uint32 NodeIndexB) const;
+
+	// Releases all pages, every value becomes zero. Must not be called while the layer is used.
+	void Reset();
+
+	// Memory used by pages and the page table, in bytes
+	uint64 GetAllocatedSize() const;
+
+	inline FName GetName() const
+	{
+		return Name;
+	}
+
+	inline uint32 GetElementSize() const
+	{
+		return ElementSize;
+	}
+
+private:
+	FName Name;
+
+	uint32 ElementSize;
+
+	std::atomic<std::atomic<uint8*>*> Chunks[ChunkCount];
+
+	std::atomic<uint32> ChunksAllocated = 0;
+
+	std::atomic<uint32> PagesAllocated = 0;
+
+	FCriticalSection PagesLock;
+};
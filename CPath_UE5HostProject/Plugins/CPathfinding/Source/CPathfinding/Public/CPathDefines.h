@@ -5,12 +5,24 @@
 #include "CoreMinimal.h"
 
 // TreeID settings
-// If you change these, you will also need to change some masks in functions like ReplaceDepth, ExtractDepth, etc
+// TreeID is packed as: outer index (DEPTH_0_BITS) | depth (DEPTH_BITS) | child index at depth 1 (3 bits) | child index at depth 2 | ...
+// By default it is 32 bit, which allows ~2M outer trees and MAX_DEPTH of 3.
+// Define CPATH_64BIT_TREEID (for example in CPathfinding.Build.cs) for 64 bit TreeIDs, with ~4G outer trees and MAX_DEPTH of 7.
+#ifdef CPATH_64BIT_TREEID
+#define DEPTH_0_BITS 32
+#define DEPTH_BITS 3
+#define MAX_DEPTH 7
+typedef uint64 CPathTreeID;
+#else
 #define DEPTH_0_BITS 21
-#define DEPTH_0_LIMIT (uint32)1<<DEPTH_0_BITS
-#define DEPTH_0_MASK 0x001FFFFF
-#define DEPTH_MASK 0x00600000
+#define DEPTH_BITS 2
 #define MAX_DEPTH 3
+typedef uint32 CPathTreeID;
+#endif
+
+#define DEPTH_0_LIMIT ((uint64)1 << DEPTH_0_BITS)
+#define CPATH_INVALID_TREEID ((CPathTreeID)-1)
+#define CPATH_INVALID_NODEINDEX ((uint32)-1)
 
 // Time measurement macros
 #define TIMENOW std::chrono::steady_clock::now()
@@ -21,6 +33,79 @@
 //#define LOG_GENERATORS 1
 //#define LOG_PATHFINDERS 1
 
+// Packing and unpacking of TreeIDs, see TreeID settings above.
+// Everything is resolved at compile time for a given layout, and loops over depths are unrolled up to MaxDepth.
+template<typename IDType, uint32 OuterBits, uint32 DepthBits, uint32 MaxDepth>
+struct TCPathTreeIDCodec
+{
+	static_assert(OuterBits + DepthBits + MaxDepth * 3 <= sizeof(IDType) * 8, "CPATH - TreeID:::Layout doesnt fit in the ID type");
+	static_assert(MaxDepth < (1u << DepthBits), "CPATH - TreeID:::MaxDepth doesnt fit in DepthBits");
+
+	static constexpr IDType OuterMask = ((IDType)1 << OuterBits) - 1;
+	static constexpr IDType DepthMask = (((IDType)1 << DepthBits) - 1) << OuterBits;
+
+	// Bit offset of child index at Depth
+	static constexpr uint32 ChildIndexOffset(uint32 Depth)
+	{
+		return (Depth - 1) * 3 + OuterBits + DepthBits;
+	}
+
+	static FORCEINLINE IDType Create(uint32 OuterIndex, uint32 Depth)
+	{
+		return (IDType)OuterIndex | ((IDType)Depth << OuterBits);
+	}
+
+	static FORCEINLINE uint32 ExtractOuterIndex(IDType TreeID)
+	{
+		return (uint32)(TreeID & OuterMask);
+	}
+
+	static FORCEINLINE uint32 ExtractDepth(IDType TreeID)
+	{
+		return (uint32)((TreeID & DepthMask) >> OuterBits);
+	}
+
+	// Also clears child indexes below NewDepth, so that every tree has exactly one TreeID
+	static FORCEINLINE void ReplaceDepth(IDType& TreeID, uint32 NewDepth)
+	{
+		uint32 ChildrenOffset = ChildIndexOffset(NewDepth + 1);
+		if (ChildrenOffset < sizeof(IDType) * 8)
+		{
+			TreeID &= ~(~(IDType)0 << ChildrenOffset);
+		}
+		TreeID &= ~DepthMask;
+		TreeID |= (IDType)NewDepth << OuterBits;
+	}
+
+	static FORCEINLINE uint32 ExtractChildIndex(IDType TreeID, uint32 Depth)
+	{
+		return (uint32)(TreeID >> ChildIndexOffset(Depth)) & 7;
+	}
+
+	static FORCEINLINE void ReplaceChildIndex(IDType& TreeID, uint32 Depth, uint32 ChildIndex)
+	{
+		uint32 Offset = ChildIndexOffset(Depth);
+		TreeID &= ~((IDType)7 << Offset);
+		TreeID |= (IDType)ChildIndex << Offset;
+	}
+
+	// Calls Func(CurrDepth) for every CurrDepth from 1 to Depth, as long as Func returns true.
+	// The loop is unrolled up to MaxDepth, so child index offsets become constants.
+	template<uint32 CurrDepth = 1, typename FuncType>
+	static FORCEINLINE void ForEachDepth(uint32 Depth, FuncType&& Func)
+	{
+		if constexpr (CurrDepth <= MaxDepth)
+		{
+			if (CurrDepth <= Depth && Func(CurrDepth))
+			{
+				ForEachDepth<CurrDepth + 1>(Depth, Func);
+			}
+		}
+	}
+};
+
+typedef TCPathTreeIDCodec<CPathTreeID, DEPTH_0_BITS, DEPTH_BITS, MAX_DEPTH> CPathTreeIDCodec;
+
 enum ENeighbourDirection
 {
 	Left,	// -Y
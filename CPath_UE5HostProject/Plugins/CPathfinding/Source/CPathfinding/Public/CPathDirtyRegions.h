@@ -0,0 +1,48 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CPathDefines.h"
+#include <vector>
+
+// Subtrees marked for regeneration by dynamic obstacles, as a flat list of TreeIDs.
+// A bitset over outer indexes remembers which outer trees are dirty as a whole, so marking the same outer tree again
+// or any subtree of it costs a single bit test. Other duplicates are removed by Compact.
+// Everything is proportional to the amount of regions, except Reset, so clearing it after every update is cheap.
+class CPATHFINDING_API CPathDirtyRegions
+{
+public:
+	// Sizes the bitset for OuterNodeCount outer trees and removes every region
+	void Reset(uint32 OuterNodeCount);
+
+	// Marks a subtree, unless its outer tree is already dirty as a whole
+	void Add(CPathTreeID TreeID);
+
+	// Removes every region
+	void Clear();
+
+	// Sorts regions and removes duplicates
+	void Compact();
+
+	inline const std::vector<CPathTreeID>& GetRegions() const
+	{
+		return Regions;
+	}
+
+	inline uint32 Num() const
+	{
+		return Regions.size();
+	}
+
+	inline bool IsEmpty() const
+	{
+		return Regions.empty();
+	}
+
+private:
+	// One bit per outer index, set if the whole outer tree is dirty
+	std::vector<uint64> DirtyOuterTrees;
+
+	std::vector<CPathTreeID> Regions;
+};
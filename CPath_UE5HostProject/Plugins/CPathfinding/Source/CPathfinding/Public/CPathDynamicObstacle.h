@@ -3,11 +3,36 @@
 
 #include "CoreMinimal.h"
 #include "Components/ActorComponent.h"
+#include "Components/SceneComponent.h"
+#include <vector>
 #include "CPathDynamicObstacle.generated.h"
 
+class UPrimitiveComponent;
+
+// Collision of a dynamic obstacle in world space, as an oriented box or a sphere.
+// Capsules and convex hulls are represented by oriented boxes around them.
+struct FCPathObstacleShape
+{
+	FVector Center = FVector::ZeroVector;
+
+	// Half size along the axes of Rotation, unused by spheres
+	FVector Extent = FVector::ZeroVector;
+	FQuat Rotation = FQuat::Identity;
+
+	// Above 0 for spheres
+	float Radius = 0.f;
+
+	// World space box around the shape
+	FBox GetBounds() const;
+
+	// True if the shape overlaps the axis aligned box
+	bool OverlapsBox(FVector BoxCenter, FVector BoxExtent) const;
+};
+
 // Make sure this actor's collision has Generate Overlaps turned on.
 // Owning actor must be movable.
-// For better performance, call Deactivate() on this component once you dont need it to be updated anymore.
+// Volumes only regenerate the graph around this actor after it moves, a standing obstacle costs nothing.
+// Call Deactivate() on this component once you dont need it to be updated anymore.
 // bAutoActivate should be left unckecked for this component.
 UCLASS(ClassGroup = (Custom), meta = (BlueprintSpawnableComponent))
 class CPATHFINDING_API UCPathDynamicObstacle : public UActorComponent
@@ -35,11 +60,33 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = CPath)
 		bool ActivateOnBeginPlay = true;
 
+	// Movement of this actor's bounds or location smaller than this (on every axis), since the graph was last updated for it, is ignored.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = CPath, meta = (ClampMin = "0", UIMin = "0"))
+		float MovementThreshold = 5.f;
+
+	// Rotation of this actor smaller than this angle (in degrees), since the graph was last updated for it, is ignored.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = CPath, meta = (ClampMin = "0", UIMin = "0", ClampMax = "180", UIMax = "180"))
+		float RotationThreshold = 5.f;
+
 	virtual void Activate(bool bReset = false) override;
 
 	virtual void Deactivate() override;
 
-	void AddIndexesToUpdate(class ACPathVolume* Volume);
+	// Incremented every time any component of the owner moves, volumes skip the obstacle if this didnt change since their last update
+	inline uint32 GetTransformChangeCount() const
+	{
+		return TransformChangeCount;
+	}
+
+	// Bounds of the owning actor's colliding components
+	FBox GetObstacleBounds() const;
+
+	// Adds simple collision of the owning actor's colliding components to Shapes.
+	// Components without usable simple collision add an oriented box around their local bounds.
+	void GetObstacleShapes(std::vector<FCPathObstacleShape>& Shapes) const;
+
+	// Game thread only. Adds simple collision of a single component to Shapes, the same way GetObstacleShapes does.
+	static void GetComponentShapes(UPrimitiveComponent* Component, std::vector<FCPathObstacleShape>& Shapes);
 
 	virtual void EndPlay(EEndPlayReason::Type Reason) override;
 protected:
@@ -47,6 +94,10 @@ protected:
 	virtual void BeginPlay() override;
 	//TArray<class ACPathVolume*> OverlappingVolumes;
 
+	void OnTransformUpdated(USceneComponent* UpdatedComponent, EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport);
+
+	uint32 TransformChangeCount = 0;
+
 public:
 
 
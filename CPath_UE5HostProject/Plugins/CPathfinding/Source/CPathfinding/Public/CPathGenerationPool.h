@@ -0,0 +1,65 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+#include <deque>
+#include <vector>
+
+class FCPathAsyncVolumeGenerator;
+class FCPathGenerationWorker;
+
+// Long lived worker threads shared by all volumes, owned by FCPathfindingModule.
+// Volumes queue their generators here instead of creating a thread for each of them, so starting a batch is just a queue push.
+// Workers are created with the first queued generator.
+class CPATHFINDING_API FCPathGenerationPool
+{
+public:
+	FCPathGenerationPool();
+
+	// Stops and joins all workers. Generators that are still queued are never run.
+	~FCPathGenerationPool();
+
+	FCPathGenerationPool(const FCPathGenerationPool&) = delete;
+	FCPathGenerationPool& operator=(const FCPathGenerationPool&) = delete;
+
+	// Returns the pool of the module, null if the module is not loaded
+	static FCPathGenerationPool* Get();
+
+	// Queues the generator to be run by the first free worker. The generator must stay alive until it's finished or retracted.
+	void Enqueue(FCPathAsyncVolumeGenerator* Generator);
+
+	// Removes the generator from the queue if it didnt start yet, otherwise waits until it finishes.
+	// Set Generator->bStop first, so that it finishes soon.
+	void Retract(FCPathAsyncVolumeGenerator* Generator);
+
+	inline uint32 GetWorkerCount() const
+	{
+		return Workers.size();
+	}
+
+private:
+
+	// Called by workers, returns null if the pool is stopping
+	FCPathAsyncVolumeGenerator* WaitForGenerator(FCPathGenerationWorker* Worker);
+
+	// Called by workers for a generator that yielded, puts it at the back of the queue.
+	// Returns false if nothing else is queued, so that the worker doesnt spin on it.
+	bool Requeue(FCPathAsyncVolumeGenerator* Generator);
+
+	void StartWorkers();
+
+	FCriticalSection QueueLock;
+
+	std::deque<FCPathAsyncVolumeGenerator*> Queue;
+
+	std::vector<FCPathGenerationWorker*> Workers;
+
+	// Workers waiting for a generator, the last one is woken up first
+	std::vector<FCPathGenerationWorker*> IdleWorkers;
+
+	bool bStopping = false;
+
+	friend class FCPathGenerationWorker;
+};
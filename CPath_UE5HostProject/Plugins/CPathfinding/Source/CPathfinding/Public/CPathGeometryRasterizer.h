@@ -0,0 +1,150 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CPathAsyncVolumeGeneration.h"
+#include <vector>
+
+class UPrimitiveComponent;
+class UStaticMeshComponent;
+class UBodySetup;
+
+// Voxelizes collision geometry directly, so that nodes can be checked without physics scene queries (see ACPathVolume::UseGeometryRasterizer).
+// Geometry is collected once, binned into a grid of cells (one per outer tree), and nodes are tested only against the cell of their center
+// with triangle-box separating axis tests, 4 triangles at a time. Box and convex elements are closed, so a node inside of one
+// without touching its surface is found by testing its center against the element's planes.
+// Components that can move are rasterized as oriented boxes and spheres around their collision, as it was when the grid was built.
+// Static components that cant be rasterized are kept per cell as fallback components, and have to be checked some other way.
+class CPATHFINDING_API CPathGeometryRasterizer
+{
+public:
+	CPathGeometryRasterizer();
+
+	// Game thread only. Collects geometry of Components and bins it into CellCount cells of CellSize, Origin is the min corner of the grid.
+	// Every cell is grown by Margin, so that boxes up to the cell size or Margin (whichever is bigger) only need the cell of their center.
+	void Build(const TArray<UPrimitiveComponent*>& Components, FVector Origin, FVector CellSize, FIntVector CellCount, FVector Margin);
+
+	// True if any rasterized geometry overlaps the box. Center must be inside the grid, Extent at most half the cell size or Margin.
+	bool IsBoxOccupied(FVector Center, FVector Extent) const;
+
+	// Components around Center that were not rasterized, null if there are none
+	const FCPathCandidateList* GetFallbackComponents(FVector Center) const;
+
+	inline uint32 GetTriangleCount() const
+	{
+		return TriangleCount;
+	}
+
+	uint64 GetAllocatedSize() const;
+
+private:
+
+	// 4 triangles in SoA layout, Vertex[Corner][Axis][Lane]. Unused lanes repeat the first triangle.
+	struct alignas(16) FTrianglePacket
+	{
+		float Vertex[3][3][4];
+	};
+
+	// World space, only used while building
+	struct FTriangle
+	{
+		FVector Vertex[3];
+	};
+
+	struct FWorldSphere
+	{
+		FVector Center;
+		float Radius;
+	};
+
+	// Relative to the center of its cell
+	struct FSphere
+	{
+		FVector3f Center;
+		float Radius;
+	};
+
+	// Closed element as planes facing out of it, world space, only used while building
+	struct FWorldHull
+	{
+		std::vector<FPlane> Planes;
+		FBox Bounds;
+	};
+
+	// Range of planes in the cell's HullPlanes, XYZ is the normal and W the distance
+	struct FHull
+	{
+		uint32 FirstPlane;
+		uint32 PlaneCount;
+	};
+
+	// Geometry is stored relative to the center of its cell, which keeps floats precise in large worlds
+	struct FCell
+	{
+		FVector Center;
+		std::vector<FTrianglePacket> Packets;
+		std::vector<FSphere> Spheres;
+		std::vector<FHull> Hulls;
+		std::vector<FVector4f> HullPlanes;
+		FCPathCandidateList Fallback;
+	};
+
+	// Returns false if the component has collision the rasterizer doesnt support
+	bool AddComponent(UPrimitiveComponent* Component);
+
+	// Box of Extent around the origin of Transform, both as triangles and as a closed element
+	void AddBox(const FTransform& Transform, FVector Extent);
+
+	// Simple collision, returns false if it has elements that are not supported
+	bool AddBodySetup(const UBodySetup* BodySetup, const FTransform& Transform);
+
+	// Complex collision of a static mesh, false if its render data is not available on the CPU
+	bool AddStaticMeshTriangles(UStaticMeshComponent* MeshComponent, const FTransform& Transform);
+
+	void AddTriangle(FVector A, FVector B, FVector C);
+
+	// Capsules are stored as a row of spheres, slightly bigger so that they cover the capsule completely
+	void AddCapsule(FVector A, FVector B, float Radius);
+
+	// Adds a closed element made of Triangles (vertex indexes into Vertices), planes are oriented away from the center of Vertices
+	void AddHull(const FVector* Vertices, int32 VertexCount, const int32* Indices, int32 IndexCount);
+
+	// Returns the index of the cell that contains Location in Cells, -1 if the cell is empty
+	int32 FindCell(FVector Location) const;
+
+	// Coordinates of the cell that contains Location, clamped to the grid
+	FIntVector CellCoordsFromLocation(FVector Location) const;
+
+	uint32 CellKeyFromCoords(FIntVector Coords) const;
+
+	// Finds or adds the cell, returns its index in Cells
+	int32 GetOrAddCell(FIntVector Coords);
+
+	// Packs triangles into packets relative to Center
+	static void PackTriangles(const std::vector<FTriangle>& InTriangles, const std::vector<uint32>& Indices, FVector Center, std::vector<FTrianglePacket>& OutPackets);
+
+	// Returns a bit for every lane of the packet whose triangle overlaps the box
+	static uint32 PacketOverlapMask(const FTrianglePacket& Packet, const FVector3f& Center, const FVector3f& Extent);
+
+	static bool SphereOverlapsBox(const FSphere& Sphere, const FVector3f& Center, const FVector3f& Extent);
+
+	static bool IsInsideHull(const FVector4f* Planes, uint32 PlaneCount, const FVector3f& Point);
+
+	FVector Origin;
+	FVector CellSize;
+	FIntVector CellCount;
+	FVector Margin;
+
+	// Only kept while building
+	std::vector<FTriangle> Triangles;
+	std::vector<FWorldSphere> Spheres;
+	std::vector<FWorldHull> Hulls;
+	std::vector<std::pair<UPrimitiveComponent*, FBox>> FallbackComponents;
+
+	// Non-empty cells, by cell key
+	TMap<uint32, int32> CellIndexByKey;
+	std::vector<FCell> Cells;
+
+	uint32 TriangleCount = 0;
+};
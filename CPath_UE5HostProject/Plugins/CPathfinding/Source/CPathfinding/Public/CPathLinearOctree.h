@@ -0,0 +1,113 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Templates/Function.h"
+#include <vector>
+#include <memory>
+#include <atomic>
+
+class CPathOctree;
+
+// Pointerless lookup cache of a volume's octrees. It is kept next to the pointer based octrees, not instead of them,
+// so it always costs memory on top of the graph. What it saves is memory touched per lookup.
+// Depth 0 is a single array indexed by the outer index. Every outer tree with children keeps its deeper nodes on its own,
+// so rebuilding an outer tree doesnt move the rest. Indexes below depth 0 are local to their outer tree.
+// Every depth of an outer tree is a contiguous array of node Data, sorted by locational code, which is the same order TreeIDs are built in.
+// Instead of a Children pointer, every depth keeps one bit per node telling if it has children,
+// and the index of the first child is found with a rank query over those bits.
+// A node costs 4 bytes + 1 bit, compared to 16 bytes of CPathOctree.
+class CPATHFINDING_API CPathLinearOctree
+{
+public:
+	CPathLinearOctree();
+
+	// Rebuilds the whole structure from pointer based octrees, GetOuterTree returns an outer tree by its index.
+	// Depths deeper than MaxDepth are ignored.
+	void Build(TFunctionRef<const CPathOctree*(uint32 OuterIndex)> GetOuterTree, uint32 OuterNodeCount, uint32 MaxDepth);
+
+	// Rebuilds only the given outer trees, the structure must already be built
+	void Rebuild(TFunctionRef<const CPathOctree*(uint32 OuterIndex)> GetOuterTree, const std::vector<uint32>& OuterIndexes);
+
+	void Reset();
+
+	inline bool IsBuilt() const
+	{
+		return OuterData.Num() > 0;
+	}
+
+	// At depth 0, Index is the OuterIndex
+	inline uint32 GetData(uint32 OuterIndex, uint32 Depth, uint32 Index) const
+	{
+		return Depth ? GetLevel(OuterIndex, Depth).Data[Index] : OuterData[Index];
+	}
+
+	inline bool GetIsFree(uint32 OuterIndex, uint32 Depth, uint32 Index) const
+	{
+		return GetData(OuterIndex, Depth, Index) & 1;
+	}
+
+	inline bool HasChildren(uint32 OuterIndex, uint32 Depth, uint32 Index) const
+	{
+		if (!Depth)
+			return Subtrees[Index] != nullptr;
+
+		const Level& CurrLevel = GetLevel(OuterIndex, Depth);
+		return (CurrLevel.ChildMask[Index >> 6] >> (Index & 63)) & 1;
+	}
+
+	// Returns index (at Depth + 1) of the child with ChildIndex. Node at Depth and Index MUST have children.
+	inline uint32 GetChild(uint32 OuterIndex, uint32 Depth, uint32 Index, uint32 ChildIndex) const
+	{
+		if (!Depth)
+			return ChildIndex;
+
+		const Level& CurrLevel = GetLevel(OuterIndex, Depth);
+		uint32 Word = Index >> 6;
+		uint64 NodesBefore = CurrLevel.ChildMask[Word] & ((uint64(1) << (Index & 63)) - 1);
+		return (CurrLevel.Rank[Word] + FMath::CountBits(NodesBefore)) * 8 + ChildIndex;
+	}
+
+	// Memory used by all depths, in bytes
+	uint64 GetAllocatedSize() const;
+
+private:
+
+	struct Level
+	{
+		TArray<uint32> Data;
+
+		// One bit per node, set if the node has children
+		TArray<uint64> ChildMask;
+
+		// Rank[i] = number of nodes with children in ChildMask words before i
+		TArray<uint32> Rank;
+	};
+
+	// Depths 1 to MaxDepth of an outer tree
+	struct Subtree
+	{
+		TArray<Level> Levels;
+
+		uint64 AllocatedSize = 0;
+	};
+
+	inline const Level& GetLevel(uint32 OuterIndex, uint32 Depth) const
+	{
+		return Subtrees[OuterIndex]->Levels[Depth - 1];
+	}
+
+	// Rebuilds OuterData and Subtrees of a single outer tree
+	void BuildOuterTree(const CPathOctree* Tree, uint32 OuterIndex);
+
+	TArray<uint32> OuterData;
+
+	// Null for outer trees without children
+	std::vector<std::unique_ptr<Subtree>> Subtrees;
+
+	uint32 MaxDepth = 0;
+
+	// Sum of AllocatedSize of all subtrees
+	std::atomic<uint64> SubtreeBytes = 0;
+};
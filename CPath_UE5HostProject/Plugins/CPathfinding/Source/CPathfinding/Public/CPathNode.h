@@ -3,6 +3,8 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "CPathDefines.h"
+#include "CPathOctree.h"
 #include "CPathNode.generated.h"
 
 /**
@@ -14,22 +16,31 @@ class CPATHFINDING_API CPathAStarNode
 {
 public:
 	CPathAStarNode();
-	CPathAStarNode(uint32 ID)
+	CPathAStarNode(CPathTreeID ID)
 		:
 		TreeID(ID)
 	{}
-	CPathAStarNode(uint32 ID, uint32 Data)
+	CPathAStarNode(CPathTreeID ID, uint32 Data)
 		:
 		TreeID(ID),
 		TreeUserData(Data)
 	{}
+	CPathAStarNode(CPathTreeID ID, const CPathOctree& Tree)
+		:
+		TreeID(ID),
+		TreeUserData(Tree.Data),
+		NodeIndex(Tree.NodeIndex)
+	{}
 
-	uint32 TreeID = 0xFFFFFFFF;
+	CPathTreeID TreeID = CPATH_INVALID_TREEID;
 
 	// Data from Octree that you may modify by overriding `RecheckOctreeAtDepth`
 	// and access from `CalcFitness`
 	uint32 TreeUserData = 0;
 
+	// Index of the node in attribute layers, see ACPathVolume::GetAttribute
+	uint32 NodeIndex = CPATH_INVALID_NODEINDEX;
+
 	// We want to find a node with minimum fitness, this way distance doesnt have to be inverted
 	float FitnessResult = 9999999999.f;
 	float DistanceSoFar = 0;
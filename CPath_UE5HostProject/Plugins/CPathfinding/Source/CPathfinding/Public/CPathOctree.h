@@ -3,6 +3,7 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "CPathDefines.h"
 
 /**
  *
@@ -16,11 +17,15 @@ class CPATHFINDING_API CPathOctree
 public:
 	CPathOctree();
 
-
+	// Block of 8 children, allocated and owned by the volume's CPathOctreeAllocator
 	CPathOctree* Children = nullptr;
 
 	uint32 Data = 0;
 
+	// Index of this node in attribute layers (see CPathAttributeLayer). Outer trees use their outer index,
+	// children get theirs from the allocator. It fills what would be padding, so the node stays 16 bytes.
+	uint32 NodeIndex = CPATH_INVALID_NODEINDEX;
+
 
 	inline void SetIsFree(bool IsFree)
 	{
@@ -32,11 +37,6 @@ public:
 	{
 		return Data << 31;
 	}
-
-	~CPathOctree()
-	{
-		delete[] Children;
-	};
 };
 
 // Class used to remember data needed to draw a debug voxel 
@@ -48,7 +48,7 @@ public:
 	CPathVoxelDrawData()
 	{}
 
-	CPathVoxelDrawData(FVector WorldLocation, float VoxelExtent, bool IsFree)
+	CPathVoxelDrawData(FVector WorldLocation, FVector VoxelExtent, bool IsFree)
 		:
 		Location(WorldLocation),
 		Extent(VoxelExtent),
@@ -56,7 +56,7 @@ public:
 	{}
 
 	FVector Location;
-	float Extent;
+	FVector Extent;
 	bool Free = false;
 
 };
@@ -0,0 +1,187 @@
+// Copyright Dominik Trautman. Published in 2022. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+#include "CPathDefines.h"
+#include <vector>
+#include <atomic>
+#include <memory>
+
+class CPathOctree;
+class CPathAttributeLayer;
+
+// Allocates blocks of 8 children (CPathOctree::Children) for a single CPathVolume.
+// Blocks are carved out of large slabs, so generating a graph is a handful of big allocations instead of millions of small ones,
+// and the whole graph is released at once when the volume is destroyed.
+class CPATHFINDING_API CPathOctreeAllocator
+{
+public:
+	CPathOctreeAllocator();
+
+	~CPathOctreeAllocator();
+
+	CPathOctreeAllocator(const CPathOctreeAllocator&) = delete;
+	CPathOctreeAllocator& operator=(const CPathOctreeAllocator&) = delete;
+
+	// Free list owned by a single thread (a generator), so that most allocations dont need to lock anything.
+	// It is NOT thread safe, every thread needs its own. Cached blocks are given back to the allocator on destruction.
+	class CPATHFINDING_API ThreadCache
+	{
+	public:
+		ThreadCache(CPathOctreeAllocator* InAllocator)
+			:
+			Allocator(InAllocator)
+		{}
+
+		~ThreadCache()
+		{
+			Flush();
+		}
+
+		// Gives all cached blocks back to the allocator
+		void Flush();
+
+	private:
+		CPathOctreeAllocator* Allocator = nullptr;
+
+		std::vector<CPathOctree*> FreeBlocks;
+
+		// Blocks from before ReleaseAll was called must never be returned
+		uint32 Epoch = 0;
+
+		friend class CPathOctreeAllocator;
+	};
+
+	// Returns a block of 8 default initialized children, with NodeIndex of the block's slot. Depth is the depth of the children, only used for accounting.
+	CPathOctree* AllocateChildren(ThreadCache& Cache, uint32 Depth);
+
+	// Returns a copy of Block (including its payload, but not NodeIndex), the children of the copy are the same as of Block
+	CPathOctree* AllocateCopy(const CPathOctree* Block, ThreadCache& Cache, uint32 Depth);
+
+	// Frees Tree->Children together with all of their subtrees, and sets Tree->Children to null.
+	// Depth is the depth of Tree->Children. Frozen blocks are never freed. Values of freed nodes in attribute layers are cleared.
+	void FreeChildren(CPathOctree* Tree, ThreadCache& Cache, uint32 Depth);
+
+	// Allocates BlockCount zeroed blocks in one contiguous frozen arena.
+	// Frozen blocks can be shared by many trees, so they must never be modified, copy them with AllocateCopy instead.
+	// They stay allocated until ReleaseAll. There can only be one frozen arena at a time.
+	CPathOctree* AllocateFrozenBlocks(uint32 BlockCount);
+
+	// Returns a block from the frozen arena
+	inline CPathOctree* GetFrozenBlock(uint32 Index) const
+	{
+		return (CPathOctree*)(FrozenArena + (SIZE_T)Index * BlockStride);
+	}
+
+	inline bool IsFrozen(const CPathOctree* Block) const
+	{
+		return (const uint8*)Block >= FrozenArena && (const uint8*)Block < FrozenArenaEnd;
+	}
+
+	inline uint32 GetFrozenBlockCount() const
+	{
+		return FrozenBlockCount;
+	}
+
+	// Reserves PayloadBytes of extra zeroed memory right after every block of 8 children, see GetBlockPayload.
+	// Must be called before anything is allocated.
+	void SetBlockPayloadSize(uint32 PayloadBytes);
+
+	// Every slot of a block in slabs has its own range of 8 node indexes, starting at FirstIndex for the first slot.
+	// Frozen blocks have no node indexes. Must be called before anything is allocated.
+	void SetFirstNodeIndex(uint32 FirstIndex);
+
+	// Layers whose values are cleared when nodes are freed, null if there are none. Must be called before anything is allocated.
+	void SetAttributeLayers(const std::vector<std::unique_ptr<CPathAttributeLayer>>* Layers);
+
+	// Returns the extra memory reserved after a block of 8 children
+	template<typename T>
+	static inline T* GetBlockPayload(CPathOctree* Block)
+	{
+		return reinterpret_cast<T*>(Block + 8);
+	}
+
+	// Releases every slab at once, without walking the trees. All blocks given out by this allocator become invalid.
+	// Must not be called while any thread is still using the allocator.
+	void ReleaseAll();
+
+	// Same as ReleaseAll, but keeps the frozen arena
+	void ReleaseSlabs();
+
+	// How many blocks of 8 children are currently in use
+	inline int64 GetAllocatedBlockCount() const
+	{
+		return AllocatedBlocks.load();
+	}
+
+	// How many blocks with children at Depth are currently in use, frozen blocks are not included
+	inline int64 GetAllocatedBlockCount(uint32 Depth) const
+	{
+		return AllocatedBlocksAtDepth[Depth].load(std::memory_order_relaxed);
+	}
+
+	// Memory of blocks in use (including frozen ones), in bytes. Lock free, so it can be checked on every allocation.
+	inline uint64 GetUsedBytes() const
+	{
+		return (uint64)(AllocatedBlocks.load(std::memory_order_relaxed) + FrozenBlockCount) * BlockStride;
+	}
+
+	// Memory reserved by slabs, in bytes
+	uint64 GetReservedBytes() const;
+
+	// Size of 8 children together with their payload, in bytes
+	inline uint32 GetBlockStride() const
+	{
+		return BlockStride;
+	}
+
+	// How many blocks of 8 children fit in a single slab
+	static constexpr uint32 BlocksPerSlab = 4096;
+
+	// How many blocks are moved between the shared free list and a ThreadCache at once
+	static constexpr uint32 BatchSize = 64;
+
+	// ThreadCache gives half of its blocks back once it holds more than this
+	static constexpr uint32 MaxCachedBlocks = BatchSize * 4;
+
+private:
+
+	// Moves up to BatchSize blocks from the shared free list (or a new slab) to the Cache
+	void RefillCache(ThreadCache& Cache);
+
+	// Moves Count blocks from the back of the Cache to the shared free list
+	void ReturnToShared(ThreadCache& Cache, uint32 Count);
+
+	void FreeChildrenRec(CPathOctree* Block, ThreadCache& Cache, uint32 Depth);
+
+	mutable FCriticalSection SharedLock;
+
+	std::vector<uint8*> Slabs;
+
+	std::vector<CPathOctree*> SharedFreeBlocks;
+
+	// Index of the first never used block in Slabs.back()
+	uint32 NextBlockInSlab = BlocksPerSlab;
+
+	// Size of 8 children together with their payload, in bytes
+	uint32 BlockStride;
+
+	uint32 PayloadSize = 0;
+
+	uint32 FirstNodeIndex = 0;
+
+	const std::vector<std::unique_ptr<CPathAttributeLayer>>* AttributeLayers = nullptr;
+
+	uint8* FrozenArena = nullptr;
+	uint8* FrozenArenaEnd = nullptr;
+	uint32 FrozenBlockCount = 0;
+
+	std::atomic<int64> AllocatedBlocks = 0;
+
+	std::atomic<int64> AllocatedBlocksAtDepth[MAX_DEPTH + 1];
+
+	// Bumped under SharedLock by ReleaseAll, read without it by thread caches
+	std::atomic<uint32> Epoch = 1;
+};
@@ -9,21 +9,127 @@
 #include <vector>
 #include <atomic>
 #include <set>
+#include <unordered_map>
 #include <list>
+#include <deque>
 #include "PhysicsInterfaceTypesCore.h"
 #include "CPathDefines.h"
 #include "CPathOctree.h"
+#include "CPathOctreeAllocator.h"
+#include "CPathLinearOctree.h"
+#include "CPathAttributeLayer.h"
+#include "CPathDirtyRegions.h"
+#include "CPathGeometryRasterizer.h"
+#include "CPathAsyncQueryGeneration.h"
 #include "CPathNode.h"
 #include "CPathAsyncVolumeGeneration.h"
 #include "CPathVolume.generated.h"
 
 
+// Part of a volume with its own maximum depth, see ACPathVolume::DepthRegions
+USTRUCT(BlueprintType)
+struct FCPathDepthRegion
+{
+	GENERATED_BODY()
+
+	// Relative to the volume's location
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = CPath, meta = (MakeEditWidget = true))
+		FVector Center = FVector::ZeroVector;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = CPath, meta = (ClampMin = "0", UIMin = "0"))
+		FVector Extent = FVector(100);
+
+	// Outer trees touching this region are not subdivided deeper than this. Where regions overlap, the lowest depth is used.
+	// Depths above the volume's OctreeDepth (at most 3, or 7 with CPATH_64BIT_TREEID) have no effect.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = CPath, meta = (ClampMin = "0", ClampMax = "7", UIMin = "0", UIMax = "7"))
+		int MaxDepth = 0;
+};
+
+
+// Memory used by a volume, see ACPathVolume::GetMemoryStats
+USTRUCT(BlueprintType)
+struct FCPathMemoryStats
+{
+	GENERATED_BODY()
+
+	// Nodes that currently exist at every depth, up to OctreeDepth. Nodes in shared (deduplicated) blocks are not included.
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = CPath)
+		TArray<int64> NodeCountAtDepth;
+
+	// Bytes used by nodes at every depth, including brick masks stored with them
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = CPath)
+		TArray<int64> BytesAtDepth;
+
+	// Blocks of 8 children currently allocated
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = CPath)
+		int64 ChildBlockCount = 0;
+
+	// Blocks of 8 children shared between trees after UseSubtreeDeduplication
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = CPath)
+		int64 SharedChildBlockCount = 0;
+
+	// Memory reserved for child blocks, including the unused part of slabs
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = CPath)
+		int64 ReservedChildBlockBytes = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = CPath)
+		int64 LinearOctreeBytes = 0;
+
+	// Static occupancy layer of UseLayeredOccupancy
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = CPath)
+		int64 StaticLayerBytes = 0;
+
+	// All attribute layers together, including their page tables
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = CPath)
+		int64 AttributeLayerBytes = 0;
+
+	// A* containers of searches that are running right now
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = CPath)
+		int64 PathfindingScratchBytes = 0;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = CPath)
+		int32 SearchesInFlight = 0;
+
+	// Outer trees, reserved child block memory, the linear octree, the static layer, attribute layers and pathfinding scratch memory together
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = CPath)
+		int64 TotalBytes = 0;
+
+	// Highest TotalBytes seen so far
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = CPath)
+		int64 PeakTotalBytes = 0;
+
+	// True if some trees were not subdivided because of MemoryBudgetMB
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = CPath)
+		bool MemoryBudgetReached = false;
+};
+
+
+// What a volume knows about a tracked dynamic obstacle, see ACPathVolume::TrackedDynamicObstacles
+struct FCPathObstacleState
+{
+	// GetTransformChangeCount of the obstacle when it was last checked
+	uint32 TransformChangeCount = 0;
+
+	// Bounds of the obstacle when the graph was last regenerated around it, invalid before the first update
+	FBox Bounds = FBox(ForceInit);
+
+	// Transform of the owning actor at that time. Rotations can keep the bounds the same, for example a cross turned by 90 degrees.
+	FTransform Transform;
+
+	// Subtrees its collision shapes touched at that time, sorted. They are regenerated again once it moves away.
+	std::vector<CPathTreeID> FootprintTreeIDs;
+};
+
+
+struct FCPathObstacleShape;
+
 UCLASS()
 class CPATHFINDING_API ACPathVolume : public AActor
 {
 	GENERATED_BODY()
 
 		friend class FCPathAsyncVolumeGenerator;
+	friend class FCPathAsyncQueryGenerator;
 	friend class UCPathDynamicObstacle;
 public:
 	ACPathVolume();
@@ -40,10 +146,39 @@ public:
 	virtual void CalcFitness(CPathAStarNode& Node, FVector TargetLocation, int32 UserData);
 
 	// Overwrite this function to change the default conditions of a tree being free/ocupied.
-	// You may also save other information in the Data field of an Octree, as only the least significant bit is used.
+	// You may also save other information in the Data field of an Octree, as only the least significant bit is used,
+	// or in attribute layers with SetAttribute(Layer, OctreeRef->NodeIndex, Value).
 	// This is called during graph generation, for every subtree including leafs, so potentially millions of times. 
 	virtual bool RecheckOctreeAtDepth(CPathOctree* OctreeRef, FVector TreeLocation, uint32 Depth);
 
+	// Overwrite this function to add attribute layers with RegisterAttributeLayer. Called when generation starts.
+	virtual void RegisterAttributeLayers() {}
+
+	// Only used with UseSparseOuterGrid. Returns true if an area of outer trees has nothing that could make any of them occupied,
+	// in which case they are not stored at all and RecheckOctreeAtDepth is never called for them.
+	// Overwrite this if your RecheckOctreeAtDepth looks outside of the tree it checks.
+	virtual bool IsOuterPageEmpty(FVector PageCenter, FVector PageExtent);
+
+	// Only used with UseDensityProbe. Called before an outer tree is generated for the first time, returns the deepest depth it should be subdivided to.
+	// Components are the ones overlapping the tree grown by the agent extent, with their bounds when they were gathered, the same query GatherCandidates does, so pruning can reuse it.
+	// Trees overlapped by a component that is not Static are not probed and get OctreeDepth.
+	// By default, trees with at most OpenSpaceMaxOccupancy of their volume covered by bounds of overlapping components get OpenSpaceMaxDepth, the rest get OctreeDepth.
+	virtual int ProbeOuterTreeDepth(FVector TreeLocation, FVector TreeExtent, const FCPathCandidateList& Components);
+
+	// Only used with UseCandidatePruning. Returns the components overlapping a tree grown by the agent extent,
+	// which are the only ones any node of that tree can overlap. Returns null if any of them is not Static, a component
+	// that can move cant be tested off the game thread, so nodes of that tree query the scene instead.
+	std::shared_ptr<const FCPathCandidateList> GatherCandidates(FVector TreeLocation, FVector TreeExtent) const;
+
+	// Candidates RecheckOctreeAtDepth and RecheckBrick test against on the calling thread instead of querying the whole scene, null if there are none.
+	// Generators set them for every tree they generate, so an override of RecheckOctreeAtDepth can use them too.
+	static const FCPathCandidateList* GetThreadCandidates();
+	static void SetThreadCandidates(const FCPathCandidateList* Candidates);
+
+	// Set if the scene overlap RecheckOctreeAtDepth would do on the calling thread is already known from an async query (see UseAsyncOverlapQueries)
+	static TOptional<bool> GetThreadPrefetchedOverlap();
+	static void SetThreadPrefetchedOverlap(TOptional<bool> Overlap);
+
 
 	// -------- BP EXPOSED ----------
 
@@ -76,19 +211,137 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false", ClampMin = "0.1", UIMin = "0.1"))
 		float VoxelSize = 60;
 
+	// Height (Z edge) of the smallest voxel, 0 means the same as VoxelSize.
+	// In mostly flat levels with tall agents, setting this up to AgentHalfHeight*2 cuts the node count without losing horizontal detail.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false", ClampMin = "0", UIMin = "0"))
+		float VoxelHeight = 0;
+
 	// How many times per second do parts of the volume get regenerated based on dynamic obstacles, in seconds.
 	// Values higher than 5 are an overkill, but for the purpose of user freedom, I leave it unlocked.
 	// If no dynamic obstacles were added, this doesnt have any performance impact
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false", ClampMin = "0.01", UIMin = "0.01", ClampMax = "30", UIMax = "30"))
 		float DynamicObstaclesUpdateRate = 3;
 
+	// Generator time one dynamic obstacles update may use, in milliseconds summed over all generator threads. 0 means no limit.
+	// With a limit, dirty regions are regenerated most urgent first, and the ones that dont fit are carried over to the next updates.
+	// Regions on recent or in-flight paths and near players are the most urgent, and every region gets more urgent the longer it waits.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false", ClampMin = "0", UIMin = "0"))
+		float RegenerationBudgetMs = 0;
+
 	// 2 Is optimal in most cases. If you have very large open speces with small amount of obstacles, then 3 will be better.
 	// For dense labirynths with little to no open space, 1 or even 0 will be faster.
 	// Check documentation for detailed performance guidance.
-	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false", ClampMin = "0", ClampMax = "3", UIMin = "0", UIMax = "3"))
+	// Values above MAX_DEPTH (3, or 7 with CPATH_64BIT_TREEID) are clamped when generation starts.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false", ClampMin = "0", ClampMax = "7", UIMin = "0", UIMax = "7"))
 		int OctreeDepth = 2;
 
 
+	// After every generation, keep a compact pointerless copy of the graph (see CPathLinearOctree) as a lookup cache for neighbour finding during pathfinding.
+	// It's kept in addition to the graph, so it costs ~4 bytes per node on top of it. Dynamic obstacle updates only rebuild the outer trees they changed.
+	// Neighbour finding touches far less memory.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false"))
+		bool UseLinearOctree = false;
+
+	// Occupied leafs at OctreeDepth keep a 4x4x4 grid of sub-voxels as a 64 bit mask (a brick), so thin free spaces
+	// next to obstacles are still walkable, without subdividing the octree any further.
+	// Sub-voxels are addressed as TreeIDs 2 depths below OctreeDepth, so OctreeDepth can be at most MAX_DEPTH - 2.
+	// Not used by the linear octree, neighbour lookups fall back to Octrees when this is enabled.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false"))
+		bool UseLeafBricks = false;
+
+	// After initial generation, identical subtrees are merged into one shared copy, which can save a lot of memory in levels with repeating geometry.
+	// Shared subtrees are copied on write when dynamic obstacles regenerate them, pathfinding results are not affected.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false"))
+		bool UseSubtreeDeduplication = false;
+
+	// Only store outer trees in pages of 8x8x8 that touch geometry, the rest of the volume is implicitly free.
+	// For huge volumes that are mostly empty, memory and generation time depend on the amount of geometry instead of volume size.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false"))
+		bool UseSparseOuterGrid = false;
+
+	// After initial generation, free outer trees with the same Data are greedily merged into boxes of up to 8 trees per axis, and pathfinding
+	// treats every box as a single node, so a big open room costs a few nodes instead of one per outer tree.
+	// Dynamic obstacle updates only merge boxes again around the outer trees they changed.
+	// Paths cross between boxes through points on their shared faces. Only outer trees are merged, subdivided trees are searched as usual.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false"))
+		bool UseFreeSpaceBoxes = false;
+
+	// Initial generation only checks outer trees. Occupied ones are subdivided to OctreeDepth by the dynamic obstacles update after a query reaches them,
+	// until then queries see them as occupied outer trees. Async pathfinding that reaches one waits for that update and searches again,
+	// so first paths into a new area take longer instead of going around it. Call RequestLazyGeneration to have them subdivided ahead of agents.
+	// Huge volumes become usable much sooner and only keep detail where agents actually go. Needs OctreeDepth above 0 and DynamicObstaclesUpdateRate above 0, disables UseLinearOctree.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false"))
+		bool UseLazyGeneration = false;
+
+	// With UseLazyGeneration, once the graph takes more than this (in megabytes), subdivided outer trees that were not reached
+	// by a query for the longest time are collapsed back to depth 0. 0 means they are never collapsed.
+	// This is checked with every dynamic obstacles update, so DynamicObstaclesUpdateRate must be above 0.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false && UseLazyGeneration", ClampMin = "0", UIMin = "0"))
+		float LazyResidentMemoryMB = 0;
+
+	// Every outer tree is queried once for the components overlapping it, and all of its nodes (and bricks) are then tested only against those components.
+	// Trees with nothing nearby cost a single query, and the rest of generation cost depends on local geometry instead of the whole scene.
+	// RecheckOctreeAtDepth overrides that query the world themselves are not affected.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false"))
+		bool UseCandidatePruning = false;
+
+	// Initial generation voxelizes collision geometry on TraceChannel directly (see CPathGeometryRasterizer), instead of querying the physics scene for every node.
+	// Supports simple collision (boxes, spheres, capsules, convex hulls) of Static components, and complex collision of static meshes with Allow CPU Access.
+	// Components that are not Static are rasterized as boxes and spheres around their collision, other Static ones are still tested with OverlapComponent. Agent shape is approximated by its bounding box, which can make the graph slightly more conservative.
+	// Dynamic obstacle updates and lazy refinement query the scene as usual.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false"))
+		bool UseGeometryRasterizer = false;
+
+	// Initial generation issues overlap queries of a whole depth at once with AsyncOverlapByChannel, and only occupied nodes
+	// get their children queried in the next batch, instead of blocking queries in a depth first recursion on generator threads.
+	// Keeps many queries in flight for the physics scene to batch. Queries are issued from the game thread over several frames, at least two per depth.
+	// RecheckOctreeAtDepth is still called for every node on a worker thread, with the result of the query already known. Not used with leaf bricks, sparse outer grid or the geometry rasterizer.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false"))
+		bool UseAsyncOverlapQueries = false;
+
+	// Occupancy is kept in two layers. The static layer is generated once, without actors that have a CPathDynamicObstacle component, and never queried again.
+	// Dynamic obstacle updates only test the tracked obstacles' own components against the affected trees, and a node is occupied if either layer says so.
+	// Costs a pointerless copy of the initial graph (see CPathLinearOctree). RecheckOctreeAtDepth is not called by dynamic updates.
+	// Not used with leaf bricks, lazy generation or attribute layers. UseDensityProbe is not rerun for dynamic obstacles, they are subdivided up to DepthRegions.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false"))
+		bool UseLayeredOccupancy = false;
+
+	// Initial generation goes outwards from GenerationSeeds and every PlayerStart in the level, and pathfinding doesnt wait for all of it.
+	// A search starts once the outer trees of its start and end are generated, and treats outer trees that arent generated yet as occupied.
+	// If it fails after reaching such trees, it's retried as more of the volume gets generated.
+	// Not used with sparse outer grid, async overlap queries, lazy generation, subtree deduplication, free space boxes or linear octree.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false"))
+		bool UseProgressiveGeneration = false;
+
+	// Relative to the volume's location. Places that agents need first, like spawners, for UseProgressiveGeneration.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false && UseProgressiveGeneration", MakeEditWidget = true))
+		TArray<FVector> GenerationSeeds;
+
+	// Hard limit on the graph memory (outer trees and child blocks), in megabytes. 0 means no limit.
+	// Once it is reached, trees that would need new children stay occupied leafs, so the graph gets coarser instead of growing.
+	// Trees freed by dynamic obstacles give the memory back.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath", meta = (EditCondition = "GenerationStarted==false", ClampMin = "0", UIMin = "0"))
+		float MemoryBudgetMB = 0;
+
+	// Outer trees touching these boxes are only subdivided up to the box's MaxDepth.
+	// Use it where coarse leafs are enough, to make those parts cheaper to generate and faster to search.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath|Adaptive Depth", meta = (EditCondition = "GenerationStarted==false"))
+		TArray<FCPathDepthRegion> DepthRegions;
+
+	// Before an outer tree is generated for the first time, the part of it covered by bounds of overlapping components is measured (see ProbeOuterTreeDepth).
+	// Trees that are mostly empty are considered open space and subdivided only up to OpenSpaceMaxDepth,
+	// so that isolated obstacles in open areas dont get subdivided to full detail, while dense areas keep OctreeDepth.
+	// The result is kept for the tree, dynamic obstacles dont change it.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath|Adaptive Depth", meta = (EditCondition = "GenerationStarted==false"))
+		bool UseDensityProbe = false;
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath|Adaptive Depth", meta = (EditCondition = "GenerationStarted==false && UseDensityProbe", ClampMin = "0", ClampMax = "1", UIMin = "0", UIMax = "1"))
+		float OpenSpaceMaxOccupancy = 0.05f;
+
+	// Depths above OctreeDepth (at most 3, or 7 with CPATH_64BIT_TREEID) have no effect.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath|Adaptive Depth", meta = (EditCondition = "GenerationStarted==false && UseDensityProbe", ClampMin = "0", ClampMax = "7", UIMin = "0", UIMax = "7"))
+		int OpenSpaceMaxDepth = 1;
+
 	// If want to call Generate() later or with some condition.
 	// Note that volume wont be usable before it is generated
 	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "CPath")
@@ -124,14 +377,29 @@ public:
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "CPath|Info")
 		bool GenerationStarted = false;
 
-	// This is a read only info about initially generated graph
+	// This is a read only info about the graph, updated after generation and with every dynamic obstacles update
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "CPath|Info")
-		TArray<int> OctreeCountAtDepth = { 0, 0, 0, 0 };
+		TArray<int> OctreeCountAtDepth;
 
-	// This is a read only info about initially generated graph
+	// This is a read only info about the graph, updated after generation and with every dynamic obstacles update
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "CPath|Info")
 		int TotalNodeCount = 0;
 
+	// With UseLazyGeneration, outer trees within Radius of WorldLocation (on every axis) are subdivided with the next dynamic obstacles update,
+	// so that they are already detailed when queries get there. Call it ahead of agents, for example from a trigger around the player.
+	UFUNCTION(BlueprintCallable, Category = "CPath")
+		void RequestLazyGeneration(FVector WorldLocation, float Radius);
+
+	// With RegenerationBudgetMs, dirty regions in the outer tree at WorldLocation are regenerated sooner for a while. Called by pathfinding, safe on any thread.
+	void NotePathUsage(FVector WorldLocation);
+
+	// NotePathUsage for every outer tree along a found path
+	void NotePathUsage(const TArray<FCPathNode>& Path);
+
+	// Current memory usage of this volume. Also refreshes OctreeCountAtDepth, TotalNodeCount and the CPathfinding stat group.
+	UFUNCTION(BlueprintCallable, Category = "CPath|Info")
+		FCPathMemoryStats GetMemoryStats();
+
 	// Draws FREE neighbouring leafs
 	UFUNCTION(BlueprintCallable, Category = "CPath|Render")
 		void DebugDrawNeighbours(FVector WorldLocation);
@@ -153,6 +421,9 @@ public:
 	// Shapes to use when checking if voxel is free or not
 	std::vector<std::vector<FCollisionShape>> TraceShapesByDepth;
 
+	// Shapes to use when checking if a sub-voxel of a brick is free or not
+	std::vector<FCollisionShape> BrickTraceShapes;
+
 	// Returns false if graph couldnt start generating
 	bool GenerateGraph();
 
@@ -168,70 +439,269 @@ public:
 	// Location of the first voxel, set during graph generation
 	FVector StartPosition;
 
+	// Count of all outer trees, including the ones that are not stored with UseSparseOuterGrid
+	// and the ones that only pad NodeCount to whole tiles
+	uint32 OuterNodeCount = 0;
+
+	// Outer trees are stored in tiles of 4^3, tiles are ordered by X, then Y, then Z.
+	// Inside a tile, trees are in Z-order (Morton order), so spatial neighbours are mostly close in memory.
+	// Tiles are only used if padding NodeCount to them adds at most 1/MaxOuterTilePadding trees, thin volumes use tiles of 1 (plain X, Y, Z order).
+	static constexpr uint32 MaxOuterTilePadding = 8;
+
+	// Tile size is 1 << OuterTileBits on every axis, 2 or 0
+	uint32 OuterTileBits = 2;
+
+	// Dimension sizes in tiles, XYZ. NodeCount rounded up to whole tiles
+	uint32 OuterTileCount[3];
+
+	// Outer index from local integer coordinates. NO BOUNDS CHECK
+	inline uint32 OuterIndexFromCoords(uint32 X, uint32 Y, uint32 Z) const
+	{
+		uint32 TileIndex = ((X >> OuterTileBits) * OuterTileCount[1] + (Y >> OuterTileBits)) * OuterTileCount[2] + (Z >> OuterTileBits);
+
+		// 2 bits per axis interleaved in the same order as child indexes - X, Z, Y from the most significant bit
+		uint32 Mask = (1 << OuterTileBits) - 1;
+		X &= Mask;
+		Y &= Mask;
+		Z &= Mask;
+		uint32 IndexInTile = ((X & 2) << 4) | ((Z & 2) << 3) | ((Y & 2) << 2) | ((X & 1) << 2) | ((Z & 1) << 1) | (Y & 1);
+		return (TileIndex << (3 * OuterTileBits)) + IndexInTile;
+	}
+
+	inline void CoordsFromOuterIndex(uint32 OuterIndex, uint32& X, uint32& Y, uint32& Z) const
+	{
+		uint32 TileIndex = OuterIndex >> (3 * OuterTileBits);
+		uint32 IndexInTile = OuterIndex & ((1 << (3 * OuterTileBits)) - 1);
+
+		uint32 TileX = TileIndex / (OuterTileCount[1] * OuterTileCount[2]);
+		TileIndex -= TileX * OuterTileCount[1] * OuterTileCount[2];
+
+		X = (TileX << OuterTileBits) + (((IndexInTile >> 4) & 2) | ((IndexInTile >> 2) & 1));
+		Y = ((TileIndex / OuterTileCount[2]) << OuterTileBits) + (((IndexInTile >> 2) & 2) | (IndexInTile & 1));
+		Z = ((TileIndex % OuterTileCount[2]) << OuterTileBits) + (((IndexInTile >> 3) & 2) | ((IndexInTile >> 1) & 1));
+	}
+
+	// False for outer indexes that only pad the last tiles on some axis
+	bool IsOuterIndexInVolume(uint32 OuterIndex) const;
+
+	// Outer trees are stored in pages of OuterPageSize^3 with UseSparseOuterGrid
+	static constexpr uint32 OuterPageSize = 8;
+
+	// Size of the OuterPages array
+	uint32 OuterPageCount = 0;
+
 	// Dimension sizes of the Nodes array, XYZ 
 	uint32 NodeCount[3];
 
 	//----------- TreeID ------------------------------------------------------------------------
 
+	// Returns the outer tree at OuterIndex. With UseSparseOuterGrid, trees that are not stored return a shared free tree, that MUST NOT be modified.
+	inline CPathOctree* GetOuterTree(uint32 OuterIndex);
+
 	// Returns the child with this tree id, or his parent at DepthReached in case the child doesnt exist
-	CPathOctree* FindTreeByID(uint32 TreeID, uint32& DepthReached);
+	CPathOctree* FindTreeByID(CPathTreeID TreeID, uint32& DepthReached);
 
-	inline CPathOctree* FindTreeByID(uint32 TreeID);
+	inline CPathOctree* FindTreeByID(CPathTreeID TreeID);
 
 	// Returns a tree and its TreeID by world location, returns null if location outside of volume. Only for Outer index
-	CPathOctree* FindTreeByWorldLocation(FVector WorldLocation, uint32& TreeID);
+	CPathOctree* FindTreeByWorldLocation(FVector WorldLocation, CPathTreeID& TreeID);
 
 	// Returns a leaf and its TreeID by world location, returns null if location outside of volume. 
-	inline CPathOctree* FindLeafByWorldLocation(FVector WorldLocation, uint32& TreeID, bool MustBeFree = 1);
+	inline CPathOctree* FindLeafByWorldLocation(FVector WorldLocation, CPathTreeID& TreeID, bool MustBeFree = 1);
 
 	// Returns a free leaf and its TreeID by world location, as long as it exists in provided search range and WorldLocation is in this Volume
 	// If SearchRange <= 0, it uses a default dynamic search range
 	// If SearchRange is too large, you might get a free node that is inaccessible from provided WorldLocation
-	CPathOctree* FindClosestFreeLeaf(FVector WorldLocation, uint32& TreeID, float SearchRange = -1);
+	CPathOctree* FindClosestFreeLeaf(FVector WorldLocation, CPathTreeID& TreeID, float SearchRange = -1);
 
 	// Returns a neighbour of the tree with TreeID in given direction, also returns  TreeID if the neighbour if found
-	CPathOctree* FindNeighbourByID(uint32 TreeID, ENeighbourDirection Direction, uint32& NeighbourID);
+	CPathOctree* FindNeighbourByID(CPathTreeID TreeID, ENeighbourDirection Direction, CPathTreeID& NeighbourID);
 
-	// Returns a list of adjecent leafs as TreeIDs
-	std::vector<uint32> FindNeighbourLeafs(uint32 TreeID, bool MustBeFree = true);
+	// Returns a list of adjecent leafs as TreeIDs. With bricks, free neighbours can be sub-voxels,
+	// while without MustBeFree occupied leafs are returned whole and only sub-voxels get sub-voxel neighbours.
+	std::vector<CPathTreeID> FindNeighbourLeafs(CPathTreeID TreeID, bool MustBeFree = true);
 
 	// Returns a list of adjecent free leafs as CPathAStarNode
 	std::vector<CPathAStarNode> FindFreeNeighbourLeafs(CPathAStarNode& Node);
 
+	//----------- Attribute layers --------------------------------------------------------------
+
+	// Per node data that doesnt fit in CPathOctree::Data, every layer is a separate array indexed by NodeIndex.
+	// Using any layer disables UseLinearOctree and UseSubtreeDeduplication, as their nodes dont have their own NodeIndex.
+	std::vector<std::unique_ptr<CPathAttributeLayer>> AttributeLayers;
+
+	// Adds a layer with ElementSize bytes per node and returns its index. Only valid in RegisterAttributeLayers.
+	uint32 RegisterAttributeLayer(FName Name, uint32 ElementSize);
+
+	template<typename T>
+	inline uint32 RegisterAttributeLayer(FName Name)
+	{
+		return RegisterAttributeLayer(Name, sizeof(T));
+	}
+
+	// Returns index of the layer with Name, -1 if there is none
+	int32 FindAttributeLayer(FName Name) const;
+
+	// Returns the value of a node in Layer, or zero if it was never set
+	template<typename T>
+	inline T GetAttribute(uint32 Layer, uint32 NodeIndex) const
+	{
+		const uint8* Value = AttributeLayers[Layer]->Find(NodeIndex);
+		return Value ? *reinterpret_cast<const T*>(Value) : T();
+	}
+
+	template<typename T>
+	inline void SetAttribute(uint32 Layer, uint32 NodeIndex, T Value)
+	{
+		*reinterpret_cast<T*>(AttributeLayers[Layer]->FindOrAdd(NodeIndex)) = Value;
+	}
+
+	// Sets the value of a node in Layer back to zero
+	inline void ClearAttribute(uint32 Layer, uint32 NodeIndex)
+	{
+		AttributeLayers[Layer]->Clear(NodeIndex);
+	}
+
+	// True if both nodes have the same values in every layer
+	bool HaveSameAttributes(uint32 NodeIndexA, uint32 NodeIndexB) const;
+
+	// Returns NodeIndex of the node with exactly this TreeID. Sub-voxels of bricks use the index of their leaf.
+	uint32 GetNodeIndex(CPathTreeID TreeID);
+
+	//----------- Free space boxes --------------------------------------------------------------
+
+	// Axis aligned box of free outer trees, in local integer coordinates, inclusive
+	struct CPathFreeBox
+	{
+		FIntVector Min;
+		FIntVector Max;
+	};
+
+	// Built after initial generation if UseFreeSpaceBoxes is true, and updated around changed outer trees after every dynamic batch.
+	// Outer trees that couldnt be merged with any other tree are not in a box. Removed boxes are left empty until their slot is reused.
+	std::vector<CPathFreeBox> FreeBoxes;
+
+	// Slots of FreeBoxes that were removed
+	std::vector<uint32> FreeBoxSlots;
+
+	// Index of the box + 1 for every outer tree, 0 if the tree is not in a box
+	std::vector<uint32> OuterFreeBox;
+
+	// Boxes are at most this many outer trees long on every axis, so that expanding a box in a search adds a bounded number of neighbours
+	static constexpr int32 MaxFreeBoxSize = 8;
+
+	// Rebuilds FreeBoxes from the whole graph
+	void BuildFreeBoxes();
+
+	// Removes boxes that contain any of OuterIndexes, and merges boxes again only where they were and at OuterIndexes
+	void UpdateFreeBoxes(const std::vector<uint32>& OuterIndexes);
+
+	// Merges a new box starting at the outer tree at Coords, growing along Z, then Y by whole rows, then X by whole slabs.
+	// Nothing happens if the tree is not a free leaf, is already in a box, or cant be merged with any other tree.
+	void MergeFreeBoxAt(FIntVector Coords);
+
+	// Unique outer indexes of the items of the last dynamic batch, sorted
+	void GetBatchOuterIndexes(std::vector<uint32>& OutOuterIndexes) const;
+
+	// Returns index of the box + 1 that TreeID belongs to, 0 if it's not in a box
+	inline uint32 FindFreeBox(CPathTreeID TreeID) const;
+
+	// TreeID that represents the node in a search. For trees in a box, this is the TreeID of the box's first outer tree, otherwise TreeID itself.
+	CPathTreeID GetSearchNodeID(CPathTreeID TreeID) const;
+
+	// Location of a search node when it's reached from FromLocation. For boxes, this is the point of the box closest to FromLocation,
+	// so paths go through shared faces. For any other node, its center.
+	FVector GetSearchNodeLocation(CPathTreeID TreeID, FVector FromLocation) const;
+
+	// Point where a path leaves the box of FromTreeID for its neighbour ToTreeID - FromLocation clamped into the face they share.
+	// A straight line from inside of a box to the neighbour's location could leave the box outside of the neighbour. FromLocation if FromTreeID is not a box.
+	FVector GetSearchNodeExit(CPathTreeID FromTreeID, FVector FromLocation, CPathTreeID ToTreeID) const;
+
+	// World space bounds of a search node, the whole box for trees in a box
+	FBox GetSearchNodeBounds(CPathTreeID TreeID) const;
+
+	// Adds free leafs adjacent to the box at BoxIndex
+	void FindFreeBoxNeighbours(uint32 BoxIndex, std::vector<CPathAStarNode>* Vector);
+
+	// Adds free leafs adjacent to the tree with TreeID in given direction
+	void AddFreeNeighboursOnSide(CPathTreeID TreeID, ENeighbourDirection Direction, std::vector<CPathAStarNode>* Vector);
+
+	//----------- Linear octree -----------------------------------------------------------------
+
+	// Pointerless lookup cache of Octrees, only built if UseLinearOctree is true
+	CPathLinearOctree LinearOctree;
+
+	// Same as FindTreeByID, but returns an index of the node in LinearOctree at DepthReached, within its outer tree
+	uint32 FindLinearNodeByID(CPathTreeID TreeID, uint32& DepthReached);
+
+	// Same as FindNeighbourByID, but uses LinearOctree. Returns false if there is no neighbour.
+	// NeighbourIndex is an index in LinearOctree at depth of NeighbourID, within its outer tree
+	bool FindNeighbourLinear(CPathTreeID TreeID, ENeighbourDirection Direction, CPathTreeID& NeighbourID, uint32& NeighbourIndex);
+
+	// Same as FindFreeNeighbourLeafs, but uses LinearOctree
+	std::vector<CPathAStarNode> FindFreeNeighbourLeafsLinear(CPathAStarNode& Node);
+
+	//----------- Leaf bricks -------------------------------------------------------------------
+
+	// Returns true if TreeID is a sub-voxel of a brick
+	inline bool IsBrickVoxel(CPathTreeID TreeID) const;
+
+	// Returns the 64 bit free mask of a leaf at OctreeDepth, or null if bricks are not used or the leaf doesnt exist
+	uint64* FindBrickMask(CPathTreeID LeafID);
+
+	// Returns true if a sub-voxel of a brick is free
+	bool IsBrickVoxelFree(CPathTreeID TreeID);
+
+	// Works for both trees and sub-voxels of bricks
+	bool IsNodeFree(CPathTreeID TreeID);
+
+	// Returns TreeID of a sub-voxel from a TreeID of a leaf at OctreeDepth and a bit of its brick mask
+	inline CPathTreeID CreateBrickVoxelID(CPathTreeID LeafID, uint32 Bit);
+
+	// Returns the brick mask bit of a sub-voxel
+	inline uint32 ExtractBrickBit(CPathTreeID TreeID) const;
+
+	// Sub-voxel coordinates within a brick are 0-3 on every axis
+	static inline uint32 BrickBitFromCoords(uint32 X, uint32 Y, uint32 Z);
+	static inline void BrickCoordsFromBit(uint32 Bit, uint32& X, uint32& Y, uint32& Z);
+
 	// Returns a parent of tree with given TreeID or null if TreeID has depth of 0
-	inline CPathOctree* GetParentTree(uint32 TreeId);
+	inline CPathOctree* GetParentTree(CPathTreeID TreeId);
 
 	// Returns world location of a voxel at this TreeID. This returns CENTER of the voxel
-	inline FVector WorldLocationFromTreeID(uint32 TreeID) const;
+	inline FVector WorldLocationFromTreeID(CPathTreeID TreeID) const;
 
 	inline FVector LocalCoordsInt3FromOuterIndex(uint32 OuterIndex) const;
 
 	// Creates TreeID for AsyncOverlapByChannel
-	inline uint32 CreateTreeID(uint32 Index, uint32 Depth) const;
+	inline CPathTreeID CreateTreeID(uint32 Index, uint32 Depth) const;
+
+	// Creates TreeID of a voxel at Depth from its integer coordinates at that depth, relative to the first voxel. NO BOUNDS CHECK
+	CPathTreeID TreeIDFromLocalCoords(uint32 X, uint32 Y, uint32 Z, uint32 Depth) const;
 
 	// Extracts Octrees array index from TreeID
-	inline uint32 ExtractOuterIndex(uint32 TreeID) const;
+	inline uint32 ExtractOuterIndex(CPathTreeID TreeID) const;
 
 	// Replaces Depth in the TreeID with NewDepth
-	inline void ReplaceDepth(uint32& TreeID, uint32 NewDepth);
+	inline void ReplaceDepth(CPathTreeID& TreeID, uint32 NewDepth);
 
 	// Extracts depth from TreeID
-	inline uint32 ExtractDepth(uint32 TreeID) const;
+	inline uint32 ExtractDepth(CPathTreeID TreeID) const;
 
 	// Returns a number from  0 to 7 - a child index at requested Depth
-	inline uint32 ExtractChildIndex(uint32 TreeID, uint32 Depth) const;
+	inline uint32 ExtractChildIndex(CPathTreeID TreeID, uint32 Depth) const;
 
 	// This assumes that child index at Depth is 000, if its not use ReplaceChildIndex
-	inline void AddChildIndex(uint32& TreeID, uint32 Depth, uint32 ChildIndex);
+	inline void AddChildIndex(CPathTreeID& TreeID, uint32 Depth, uint32 ChildIndex);
 
 	// Replaces child index at given depth
-	inline void ReplaceChildIndex(uint32& TreeID, uint32 Depth, uint32 ChildIndex);
+	inline void ReplaceChildIndex(CPathTreeID& TreeID, uint32 Depth, uint32 ChildIndex);
 
 	// Replaces child index at given depth and also replaces depth to the same one
-	inline void ReplaceChildIndexAndDepth(uint32& TreeID, uint32 Depth, uint32 ChildIndex);
+	inline void ReplaceChildIndexAndDepth(CPathTreeID& TreeID, uint32 Depth, uint32 ChildIndex);
 
 	// Traverses the tree downwards and adds every tree to the container
-	void GetAllSubtrees(uint32 TreeID, std::vector<uint32>& Container);
+	void GetAllSubtrees(CPathTreeID TreeID, std::vector<CPathTreeID>& Container);
 
 	// Volume is not safe to access as long as this is not 0, pathfinders should wait till this is 0
 	std::atomic_int GeneratorsRunning = 0;
@@ -239,20 +709,55 @@ public:
 	// Volume wont start generating as long as this is not 0
 	std::atomic_int PathfindersRunning = 0;
 
+	// True while generators of a batch are running or still queued in the pool, which doesnt start them all at once.
+	// After initial generation, pathfinders should wait till this is false.
+	inline bool IsGenerationBatchActive() const
+	{
+		return GeneratorsRunning.load() > 0 || BatchGeneratorsLeft.load() > 0;
+	}
+
 	// This is for other threads to check if graph is accessible
 	std::atomic_bool InitialGenerationCompleteAtom = false;
 
+	// True if the outer tree at WorldLocation can be searched, which with UseProgressiveGeneration can be before InitialGenerationCompleteAtom.
+	// Locations outside of the volume are considered generated, searches from there fail on their own.
+	bool IsGeneratedAt(FVector WorldLocation) const;
+
+	// Returns whether a query on the calling thread reached an outer tree that wasnt generated yet since the last call, and resets it.
+	// With UseLazyGeneration, coarse outer trees that are still occupied count as well, and are returned in OutCoarseTrees.
+	static bool ConsumeThreadReachedUngenerated(std::vector<uint32>* OutCoarseTrees = nullptr);
+
+	// True if any of the outer trees is queued to be subdivided by UseLazyGeneration and wasnt yet
+	bool IsAnyOuterTreeAwaitingRefinement(const std::vector<uint32>& OuterIndexes) const;
+
 	// This is filled by DynamicObstacle component
-	std::set<class UCPathDynamicObstacle*> TrackedDynamicObstacles;
+	std::unordered_map<class UCPathDynamicObstacle*, FCPathObstacleState> TrackedDynamicObstacles;
+
+	void TrackDynamicObstacle(class UCPathDynamicObstacle* Obstacle);
+
+	// The area the obstacle was in is regenerated with the next update
+	void UntrackDynamicObstacle(class UCPathDynamicObstacle* Obstacle);
+
+	// Memory used by A* containers of running searches, updated by the searches themselves
+	std::atomic<int64> PathfindingScratchBytes = 0;
+
+	std::atomic_int SearchesInFlight = 0;
 
 	// ----------- Other helper functions ---------------------
 
-	inline float GetVoxelSizeByDepth(int Depth) const;
+	// Edges of a voxel at Depth, X and Y are always the same
+	inline FVector GetVoxelSizeByDepth(int Depth) const;
+
+	// VoxelHeight, or VoxelSize if it's not set
+	float GetLeafVoxelHeight() const;
+
+	// The deepest depth a TreeID can have in this volume, including sub-voxels of bricks
+	inline int GetMaxTreeIDDepth() const;
 
 	// Draws the voxel, this takes all the drawing options into condition. If Duraiton is below 0, it never disappears. 
 	// If Color = green, free trees are green and occupied are red.
 	// Returns true if drawn, false otherwise
-	bool DrawDebugVoxel(uint32 TreeID, bool DrawIfNotLeaf = true, float Duration = 0, FColor Color = FColor::Green, CPathVoxelDrawData* OutDrawData = nullptr);
+	bool DrawDebugVoxel(CPathTreeID TreeID, bool DrawIfNotLeaf = true, float Duration = 0, FColor Color = FColor::Green, CPathVoxelDrawData* OutDrawData = nullptr);
 	void DrawDebugVoxel(const CPathVoxelDrawData& DrawData, float Duration) const;
 
 
@@ -261,60 +766,360 @@ protected:
 	// Returns an index in the Octree array from world position. NO BOUNDS CHECK
 	inline int WorldLocationToIndex(FVector WorldLocation) const;
 
-	// Multiplies local integer coordinates into index
-	inline float LocalCoordsInt3ToIndex(FVector V) const;
+	// Converts local integer coordinates into index
+	inline uint32 LocalCoordsInt3ToIndex(FVector V) const;
 
 	// Returns the X Y and Z relative to StartPosition and divided by VoxelSize. Multiply them to get the index. NO BOUNDS CHECK
 	inline FVector WorldLocationToLocalCoordsInt3(FVector WorldLocation) const;
 
 	// Returns world location of a tree at depth 0. Extracts only outer index from TreeID
-	inline FVector GetOuterTreeWorldLocation(uint32 TreeID) const;
+	inline FVector GetOuterTreeWorldLocation(CPathTreeID TreeID) const;
 
 	// takes in what `WorldLocationToLocalCoordsInt3` returns and performs a bounds check
 	inline bool IsInBounds(FVector LocalCoordsInt3) const;
 
 	// Helper function for 'FindLeafByWorldLocation'. Relative location is location relative to the middle of CurrentTree
-	CPathOctree* FindLeafRecursive(FVector RelativeLocation, uint32& TreeID, uint32 CurrentDepth, CPathOctree* CurrentTree);
+	CPathOctree* FindLeafRecursive(FVector RelativeLocation, CPathTreeID& TreeID, uint32 CurrentDepth, CPathOctree* CurrentTree);
 
 	// Returns IDs of all free leafs on chosen side of a tree. Sides are indexed in the same way as neighbours, and adds them to passed Vector.
 	// ASSUMES THAT PASSED TREE HAS CHILDREN
-	void FindLeafsOnSide(uint32 TreeID, ENeighbourDirection Side, std::vector<uint32>* Vector, bool MustBeFree = true);
+	void FindLeafsOnSide(CPathTreeID TreeID, ENeighbourDirection Side, std::vector<CPathTreeID>* Vector, bool MustBeFree = true);
 
 	// Same as above, but skips the part of getting a tree by TreeID so its faster
-	void FindLeafsOnSide(CPathOctree* Tree, uint32 TreeID, ENeighbourDirection Side, std::vector<uint32>* Vector, bool MustBeFree = true);
+	void FindLeafsOnSide(CPathOctree* Tree, CPathTreeID TreeID, ENeighbourDirection Side, std::vector<CPathTreeID>* Vector, bool MustBeFree = true);
 
 	// Same as above, but wrapped in CPathAStarNode
-	void FindLeafsOnSide(CPathOctree* Tree, uint32 TreeID, ENeighbourDirection Side, std::vector<CPathAStarNode>* Vector, bool MustBeFree = true);
+	void FindLeafsOnSide(CPathOctree* Tree, CPathTreeID TreeID, ENeighbourDirection Side, std::vector<CPathAStarNode>* Vector, bool MustBeFree = true);
+
+	// Same as above, but uses LinearOctree. NodeIndex is the index of TreeID in LinearOctree
+	void FindLeafsOnSideLinear(uint32 NodeIndex, CPathTreeID TreeID, ENeighbourDirection Side, std::vector<CPathAStarNode>* Vector);
+
+	// Adds free sub-voxels from the Side of a brick to the Vector
+	void AddFreeBrickVoxelsOnSide(CPathTreeID LeafID, uint64 BrickMask, const CPathOctree& Leaf, ENeighbourDirection Side, std::vector<CPathAStarNode>* Vector);
+
+	// Neighbours of a sub-voxel, both from the same brick and from neighbouring leafs
+	void FindFreeBrickNeighbours(CPathTreeID TreeID, std::vector<CPathAStarNode>* Vector);
+
+	// Same as above, but free or not
+	void FindBrickNeighbours(CPathTreeID TreeID, std::vector<CPathTreeID>* Vector);
 
 	// Internal function used in GetAllSubtrees
-	void GetAllSubtreesRec(uint32 TreeID, CPathOctree* Tree, std::vector<uint32>& Container, uint32 Depth);
+	void GetAllSubtreesRec(CPathTreeID TreeID, CPathOctree* Tree, std::vector<CPathTreeID>& Container, uint32 Depth);
 
 
 	// -------- GENERATION -----
 	FTimerHandle GenerationTimerHandle;
 
+	// Owns every child block of Octrees. Declared before GeneratorThreads, so that it outlives them.
+	CPathOctreeAllocator OctreeAllocator;
+
+	// Generators of running batches, they are run by FCPathGenerationPool
 	std::list<std::unique_ptr<FCPathAsyncVolumeGenerator>> GeneratorThreads;
 
-	// Garbage collection
+	// Garbage collection, removes generators that the pool has finished running
 	void CleanFinishedGenerators();
 
+	// Same as GetOuterTree, but creates the page if it doesnt exist yet. Only for generators.
+	CPathOctree* GetOrCreateOuterTree(uint32 OuterIndex);
+
+	// Page index and index within the page of an outer tree
+	inline void OuterPageFromIndex(uint32 OuterIndex, uint32& PageIndex, uint32& IndexInPage) const;
+
+	// Local coordinates of the first outer tree of a page, and the outer tree count on every axis (smaller at the volume border)
+	void GetOuterPageCells(uint32 PageIndex, FIntVector& FirstCoords, FIntVector& CellCount) const;
+
+	// Page table of UseSparseOuterGrid, null pages are implicitly free
+	std::unique_ptr<std::atomic<CPathOctree*>[]> OuterPages;
+
+	// Dimension sizes of the OuterPages array, XYZ
+	uint32 OuterPageCountXYZ[3];
+
+	FCriticalSection OuterPagesLock;
+
+	// Returned for outer trees that are not stored
+	CPathOctree FreeOuterTree;
+
+	// Disables options that cant work with current settings
+	void ValidateGenerationSettings();
+
+	// Extents of the agent's bounding box
+	FVector GetAgentExtent() const;
+
+	// Adds shapes that need to be checked for a voxel of given Size
+	void AddTraceShapes(std::vector<FCollisionShape>& Shapes, FVector Size) const;
+
+	// Returns the brick mask of an occupied leaf at OctreeDepth, bit is set if a sub-voxel is free.
+	// Sub-voxels are tested against candidates of the outer tree, or of the leaf if there are none, instead of querying the scene.
+	uint64 RecheckBrick(FVector LeafLocation);
+
+	// OverlapComponent of every candidate, candidates were already filtered by TraceChannel when gathered.
+	// Only static components are ever candidates, so their transforms dont change while workers read them.
+	bool OverlapsAnyCandidate(const FCPathCandidateList& Candidates, FVector Location, const FCollisionShape& Shape) const;
+
+	// Only exists during initial generation with UseGeometryRasterizer
+	std::unique_ptr<CPathGeometryRasterizer> GeometryRasterizer;
+
+	// Game thread only. Collects components overlapping the volume and rasterizes them into a grid of outer trees.
+	void BuildGeometryRasterizer();
+
+	// Checks a node of given Extent against GeometryRasterizer, and its fallback components against Shapes
+	bool IsRasterizedNodeOccupied(FVector Location, FVector Extent, const std::vector<FCollisionShape>& Shapes) const;
+
+	// Brick masks of outer trees, only used if OctreeDepth is 0. Deeper leafs keep their masks in the allocator block payload.
+	std::vector<uint64> OuterBrickMasks;
+
+	//----------- Layered occupancy -------------------------------------------------------------
+
+	// Used by every scene query of generation. With UseLayeredOccupancy it ignores actors with a CPathDynamicObstacle component,
+	// so that the initial graph only has static geometry.
+	FCollisionQueryParams StaticQueryParams;
+
+	// Copy of the initial graph with static geometry only, built once after initial generation with UseLayeredOccupancy
+	CPathLinearOctree StaticLayer;
+
+	std::atomic<int64> StaticLayerBytes = 0;
+
+	// Collision of tracked dynamic obstacles' components that block TraceChannel, with its bounds.
+	// Snapshotted on the game thread with every dynamic obstacles update, generators only read it.
+	std::vector<std::pair<FCPathObstacleShape, FBox>> DynamicObstacleShapes;
+
+	// Game thread only. Fills StaticQueryParams from actors overlapping the volume.
+	void IgnoreDynamicObstacleActors();
+
+	// Game thread only. Refreshes DynamicObstacleShapes from TrackedDynamicObstacles.
+	void GatherDynamicObstacleShapes();
+
+	// Shapes of DynamicObstacleShapes that can overlap any node of an outer tree
+	FCPathObstacleShapeList GatherDynamicCandidates(FVector TreeLocation, FVector TreeExtent) const;
+
+	// Tests obstacle shapes against the bounding box of Shape, which can only make a node more conservative
+	bool OverlapsAnyObstacleShape(const FCPathObstacleShapeList& Obstacles, FVector Location, const FCollisionShape& Shape) const;
+
 	// Checking if initial generation has finished
 	void InitialGenerationUpdate();
 
+	// Only exists during initial generation with UseAsyncOverlapQueries
+	std::unique_ptr<FCPathAsyncQueryGenerator> AsyncQueryGenerator;
+
+	void OnAsyncOverlapCompleted(const FTraceHandle& Handle, FOverlapDatum& Datum);
+
 	// Checking if there are any trees to regenerate from dynamic obstacles
 	void GenerationUpdate();
 
-	std::set<int32> TreesToRegenerate;
+	// How many generators from the last started batch have not finished their work yet
+	std::atomic_int BatchGeneratorsLeft = 0;
+
+	//----------- Generation batch --------------------------------------------------------------
+	// Generators dont get fixed ranges, they take chunks of the batch from a shared cursor,
+	// and split deep subtrees into tasks for each other once there are no chunks left for some of them.
+
+	// Resets the shared state for a new batch of ItemCount items generated by GeneratorCount generators. Game thread only.
+	void StartGenerationBatch(uint32 ItemCount, uint32 GeneratorCount);
+
+	// Takes the next chunk of the batch, items from First (inclusive) to Last (not inclusive).
+	// Returns false if all items are taken. The caller MUST decrement GenerationWorkLeft once it's done with the chunk.
+	bool TakeGenerationChunk(uint32& First, uint32& Last);
+
+	// Adds tasks that any generator of the batch can take, see FCPathAsyncVolumeGenerator::SplitSubtree
+	void PushGenerationTasks(FCPathGenerationTask* Tasks, uint32 Count);
+
+	// The caller MUST decrement GenerationWorkLeft once it's done with the task
+	bool PopGenerationTask(FCPathGenerationTask& Task);
+
+	inline bool HasQueuedGenerationTasks() const
+	{
+		return QueuedGenerationTasks.load(std::memory_order_relaxed) > 0;
+	}
+
+	// Subtrees of a dynamic obstacles batch, resolved from TreesToRegenerate by ResolveDirtySubtrees. None of them is a parent of another one.
+	std::vector<CPathTreeID> GenerationBatchItems;
+
+	uint32 GenerationBatchItemCount = 0;
+	uint32 GenerationBatchGeneratorCount = 1;
+
+	// Chunks never get larger than this, so that one generator cant take a large part of the batch at once
+	static constexpr uint32 MaxGenerationChunkSize = 64;
+
+	std::atomic<uint32> NextGenerationBatchItem = 0;
+
+	// Chunks and tasks that are taken or queued, but not finished yet
+	std::atomic<int32> GenerationWorkLeft = 0;
+
+	// Generators that are waiting for other generators to split their work
+	std::atomic<int32> IdleGenerators = 0;
+
+	FCriticalSection GenerationTasksLock;
+	std::deque<FCPathGenerationTask> GenerationTasks;
+	std::atomic<int32> QueuedGenerationTasks = 0;
+
+	// Called by the last generator of a batch, from its thread, before it lets pathfinders access the volume.
+	// This is the place for any post processing of the whole graph.
+	void OnGenerationBatchFinished();
+
+	// Merges identical subtrees of the whole graph into the allocator's frozen arena, see UseSubtreeDeduplication
+	void DeduplicateSubtrees();
+
+	// Bytes used by outer trees, including page tables, brick masks and free boxes stored with them
+	uint64 GetOuterTreeBytes() const;
+
+	// Checked by generators before allocating new children, see MemoryBudgetMB
+	bool IsOverMemoryBudget() const;
+
+	// Fills everything from live counters, safe to call from any thread
+	void FillMemoryStats(FCPathMemoryStats& Stats) const;
+
+	// Game thread only. Refreshes OctreeCountAtDepth, TotalNodeCount and the stat group.
+	void UpdateMemoryStats(FCPathMemoryStats& Stats);
+
+	uint64 MemoryBudgetBytes = 0;
+
+	// Set by generators when MemoryBudgetBytes stopped a tree from being subdivided
+	std::atomic_bool MemoryBudgetReached = false;
+
+	std::atomic<int64> PeakMemoryBytes = 0;
+
+	// Size of LinearOctree, cached after it's built so that it can be read while it's rebuilt
+	std::atomic<int64> LinearOctreeBytes = 0;
+
+	// Number of pages allocated with UseSparseOuterGrid
+	std::atomic<uint32> OuterPagesAllocated = 0;
+
+	// What this volume added to the stat group, so that multiple volumes can be summed up
+	int64 ReportedStatBytes[3] = {};
+
+	// Dirty subtrees, at whatever depth GetFootprintTreeIDs picked for them. Outer trees are TreeIDs at depth 0, same as their outer index.
+	// Collected between updates, and cleared once a batch is started from them.
+	CPathDirtyRegions TreesToRegenerate;
+
+	// Adds TreeIDs of voxels that Shape, grown by the agent extent, overlaps. Voxels are tested against the shape itself,
+	// so a rotated beam only marks voxels along the beam instead of everything in its bounding box.
+	// The depth is the deepest one with at most MaxFootprintVoxels voxels in the shape's bounds. Safe to call from any thread.
+	void GetFootprintTreeIDs(const FCPathObstacleShape& Shape, std::vector<CPathTreeID>& TreeIDs) const;
+
+	// Voxel coordinates at Depth touched by Box, clamped to the volume. False if Box is outside of the volume.
+	bool GetVoxelRange(FBox Box, int Depth, FIntVector& Min, FIntVector& Max) const;
+
+	// Upper limit of voxels tested for one shape, a shape that fits in a voxel at some depth uses at least that depth
+	static constexpr int64 MaxFootprintVoxels = 512;
+
+	// Game thread only. Marks the previous and the current footprint of tracked obstacles that moved by more than their MovementThreshold, or turned by more than their RotationThreshold.
+	// Obstacles without any transform change since the last update are skipped without looking at their bounds.
+	void MarkMovedObstacles();
+
+	// With more moved obstacles than this in one update, their footprints are rasterized with ParallelFor
+	static constexpr int32 ParallelObstacleThreshold = 64;
+
+	// Game thread only. Fills GenerationBatchItems from TreesToRegenerate. Subtrees that dont exist are replaced by their deepest existing parent,
+	// and subtrees of other dirty subtrees are dropped.
+	void ResolveDirtySubtrees();
+
+	// Game thread only. With RegenerationBudgetMs, sorts GenerationBatchItems by urgency and keeps as many as fit in the budget.
+	// The rest go back to TreesToRegenerate (or LazyTreesRequested), and are resolved again with the next update.
+	void ScheduleDirtySubtrees();
+
+	// Relative generator time of a dirty subtree at Depth. Only nodes along obstacle surfaces are subdivided,
+	// so the work grows about 4 times per depth instead of 8.
+	double GetRegenerationWeight(uint32 Depth) const;
+
+	// Value of RegenerationClock when a path last started, ended or went through an outer tree, 0 if never. Only with RegenerationBudgetMs.
+	std::unique_ptr<std::atomic<uint32>[]> PathLastUsed;
+
+	// Advanced with every dynamic obstacles update, starts at 1 so that 0 can mean never
+	std::atomic<uint32> RegenerationClock = 1;
+
+	// RegenerationClock of the update in which an outer tree first had a dirty subtree left over by ScheduleDirtySubtrees
+	std::unordered_map<uint32, uint32> OuterDirtySince;
+
+	// Generator milliseconds per unit of GetRegenerationWeight, averaged over previous batches. 0 until the first batch is measured.
+	double RegenerationMsPerWeight = 0.0;
+
+	// Sum of GetRegenerationWeight of the scheduled batch and when it started, measured in OnGenerationBatchFinished
+	double BatchRegenerationWeight = 0.0;
+	double BatchStartSeconds = 0.0;
+
+	// Urgency of a dirty subtree is the sum of these, scaled by how recently a path used it, how close the nearest player is
+	// (in outer tree sizes), and how long it waited
+	static constexpr float PathUrgency = 4.f;
+	static constexpr float PlayerUrgency = 2.f;
+	static constexpr float WaitingUrgencyPerSecond = 1.f;
+
+	// Paths older than this dont make regions more urgent
+	static constexpr float RecentPathSeconds = 5.f;
+
+	// Generators only rebuild dirty subtrees, so their parents are fixed up afterwards, bottom-up: parents without any free children left
+	// are collapsed into occupied leafs, parents with only free leafs are merged into a free leaf if they are free at their own depth
+	void CollapseDirtySubtreeParents();
+
+	// Tests a parent of a dirty subtree at its own depth, against the static layer and dynamic obstacles when layered. Sets Data if its free.
+	bool RecheckDirtySubtreeParent(CPathOctree* OctreeRef, CPathTreeID TreeID, uint32 StaticIndex);
+
+	// Outer trees of TreesToRegenerate that are subdivided for the first time with UseLazyGeneration
+	std::set<int32> TreesToRefine;
+
+	// Filled by RequestLazyGeneration, moved to TreesToRefine with the next update
+	std::set<int32> LazyTreesRequested;
+
+	// Coarse outer trees reached by queries, moved to LazyTreesRequested with the next update
+	std::vector<uint32> LazyTreesTouched;
+	FCriticalSection LazyTreesTouchedLock;
+
+	enum ELazyTreeState : uint8
+	{
+		// Only the outer tree itself was checked
+		LazyCoarse,
+		// Reached by a query, waiting for the next update to subdivide it
+		LazyTouched,
+		// Generated to OctreeDepth
+		LazyRefined
+	};
+
+	// State of every outer tree with UseLazyGeneration, as in ELazyTreeState
+	std::unique_ptr<std::atomic<uint8>[]> LazyTreeStates;
+
+	// Value of LazyClock when an outer tree was last reached by a query
+	std::unique_ptr<std::atomic<uint32>[]> LazyLastTouched;
+
+	// Advanced with every dynamic obstacles update
+	std::atomic<uint32> LazyClock = 0;
+
+	// Marks the outer tree as used, and with UseLazyGeneration queues it to be subdivided if it wasnt yet. Called by queries, never waits.
+	void TouchOuterTree(uint32 OuterIndex);
+
+	// How deep generators should go with this outer tree, GetOuterTreeMaxDepth unless it's left coarse by UseLazyGeneration
+	uint32 GetOuterTreeGenerationDepth(uint32 OuterIndex, std::shared_ptr<const FCPathCandidateList>* OutProbedCandidates = nullptr);
+
+	// OctreeDepth, lowered by DepthRegions and UseDensityProbe.
+	// If the tree is probed now and OutProbedCandidates is set, it receives the components the probe gathered (see GatherCandidates).
+	uint32 GetOuterTreeMaxDepth(uint32 OuterIndex, std::shared_ptr<const FCPathCandidateList>* OutProbedCandidates = nullptr);
+
+	// Max depth of every outer tree from DepthRegions, empty if there are none
+	std::vector<uint8> OuterMaxDepths;
+
+	// Result of ProbeOuterTreeDepth for every outer tree with UseDensityProbe, CPATH_UNPROBED_DEPTH until the tree is generated for the first time
+	std::unique_ptr<std::atomic<uint8>[]> ProbedOuterDepths;
+	static constexpr uint8 CPATH_UNPROBED_DEPTH = 0xFF;
+
+	// Set for every outer tree once initial generation finished it, only with UseProgressiveGeneration
+	std::unique_ptr<std::atomic<bool>[]> OuterTreeGenerated;
+
+	// Called by initial generators once every subtree of the outer tree is done
+	void MarkOuterTreeGenerated(uint32 OuterIndex);
+
+	// Queries skip outer trees for which this is false, and remember that they did for ConsumeThreadReachedUngenerated
+	inline bool IsOuterTreeGenerated(uint32 OuterIndex) const;
+
+	// Fills GenerationBatchItems with outer trees of the volume, closest to GenerationSeeds and PlayerStarts first
+	void OrderGenerationFromSeeds();
+
+	// Collapses least recently used outer trees until the graph fits in LazyResidentMemoryMB. Game thread only.
+	void EvictLazySubtrees();
 
-	// This is so that when an actor moves, the previous space it was in needs to be regenerated as well
-	std::set<int32> TreesToRegeneratePreviousUpdate;
 
 	// This is set in GenerateGraph() using a formula that estimates total voxel count
 	int OuterIndexesPerThread;
 
-	bool ThreadIDs[64];
-
-	inline uint32 GetFreeThreadID() const;
+	// Creates a generator for the current batch and queues it in the module's FCPathGenerationPool
+	void QueueGenerator(uint8 GeneratorID, FString Name, bool Obstacles);
 
 
 	// ----- Lookup tables-------
@@ -330,8 +1135,11 @@ protected:
 	// Left returns right, up returns down, Front returns behind, etc
 	static const int8 LookupTable_OppositeSide[6];
 
+	// Bits of a brick mask on each side, as in ENeighbourDirection
+	static const uint64 LookupTable_BrickSideMask[6];
+
 	// Set in begin play
-	float LookupTable_VoxelSizeByDepth[MAX_DEPTH + 1];
+	FVector LookupTable_VoxelSizeByDepth[MAX_DEPTH + 1];
 
 
 	// -------- DEBUGGING -----
@@ -18,9 +18,17 @@ public:
 
 	virtual bool RecheckOctreeAtDepth(CPathOctree* OctreeRef, FVector TreeLocation, uint32 Depth);
 
-	inline bool ExtractIsGroundFromData(uint32 TreeUserData)
+	// Ground trace reaches below the page, so the page is extended downwards
+	virtual bool IsOuterPageEmpty(FVector PageCenter, FVector PageExtent) override;
+
+	virtual void RegisterAttributeLayers() override;
+
+	inline bool IsGroundNode(const CPathAStarNode& Node) const
 	{
-		return TreeUserData & 0x00000002;
+		return GetAttribute<uint8>(GroundLayer, Node.NodeIndex);
 	}
 
+	// Attribute layer with 1 for free nodes that are right above the ground
+	uint32 GroundLayer = 0;
+
 };
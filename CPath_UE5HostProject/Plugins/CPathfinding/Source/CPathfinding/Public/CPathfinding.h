@@ -5,6 +5,7 @@
 #include "CoreMinimal.h"
 #include "Modules/ModuleManager.h"
 
+class FCPathGenerationPool;
 
 class CPATHFINDING_API FCPathfindingModule : public IModuleInterface
 {
@@ -13,4 +14,14 @@ public:
 	/** IModuleInterface implementation */
 	virtual void StartupModule() override;
 	virtual void ShutdownModule() override;
+
+	// Worker threads that run generators of all volumes, null while the module is not loaded
+	static FCPathGenerationPool* GetGenerationPool()
+	{
+		return GenerationPool;
+	}
+
+private:
+
+	static FCPathGenerationPool* GenerationPool;
 };